@@ -0,0 +1,78 @@
+#pragma once
+
+#include <format>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Synthetic Husk corpora, generated in memory, shared by husk_bench and
+// husk_perf_gate. Each is deterministic for a given size.
+
+// fn f0() { let v0 = 0 + 1; ... } repeated: many small functions and lets
+inline string functions_corpus(size_t functions, size_t lets)
+{
+  string out;
+  for (size_t f = 0; f < functions; ++f) {
+    out += format("fn f{}() {{\n", f);
+    for (size_t l = 0; l < lets; ++l) {
+      out += l == 0 ? format("  let v0 = {};\n", f) : format("  let v{} = v{} + {};\n", l, l - 1, l);
+    }
+    out += format("  return v{};\n}}\n", lets - 1);
+  }
+  out += "fn main() {\n  return 0;\n}\n";
+  return out;
+}
+
+// one long binary-expression chain
+inline string expression_corpus(size_t terms)
+{
+  string out = "fn main() {\n  let x = 1";
+  static constexpr string_view ops[] = {" + ", " - ", " * ", " / "};
+  for (size_t i = 1; i < terms; ++i) {
+    out += ops[i % 4 == 3 ? 0 : i % 4];  // no division, so the chain can't trap
+    out += to_string(i % 97 + 1);
+  }
+  out += ";\n  print(x);\n}\n";
+  return out;
+}
+
+// many distinct identifiers, to stress interning and the symbol table
+inline string identifiers_corpus(size_t identifiers)
+{
+  string out = "fn main() {\n";
+  for (size_t i = 0; i < identifiers; ++i) {
+    out += format("  let identifierNumber{}x = {};\n", i, i);
+  }
+  out += "  return 0;\n}\n";
+  return out;
+}
+
+// deeply indented, blank-line-separated lets, like formatted generated code
+inline string whitespace_corpus(size_t lets)
+{
+  string out = "fn main() {\n";
+  const string indent(48, ' ');
+  for (size_t i = 0; i < lets; ++i) {
+    out += format("{}let    value{}    =    {}    +    {}    ;\n\n\n", indent, i, i, i % 97);
+  }
+  out += indent + "return 0;\n}\n";
+  return out;
+}
+
+struct Corpus {
+  string name;
+  string source;
+};
+
+// the benchmark corpora at `scale` times their default size
+inline vector<Corpus> synthetic_corpora(size_t scale)
+{
+  return {
+    {format("functions_{}x20", 1000 * scale), functions_corpus(1000 * scale, 20)},
+    {format("expression_{}_terms", 2000 * scale), expression_corpus(2000 * scale)},
+    {format("identifiers_{}", 20000 * scale), identifiers_corpus(20000 * scale)},
+    {format("whitespace_{}", 20000 * scale), whitespace_corpus(20000 * scale)},
+  };
+}
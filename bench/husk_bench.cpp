@@ -0,0 +1,207 @@
+// Throughput benchmarks for the lexer, parser and code generator.
+//
+// Generates synthetic Husk corpora in memory, times Lexer::tokenize (serial
+// and chunked on a thread pool), Parser::parse, TypeChecker::check and
+// CodeGen::generate separately plus the four end to end,
+// and prints the best-of-N results as JSON so runs can be compared.
+
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <print>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "ast.hpp"
+#include "codegen.hpp"
+#include "corpora.hpp"
+#include "lexer.hpp"
+#include "parallel_lexer.hpp"
+#include "source.hpp"
+#include "typecheck.hpp"
+
+using namespace std;
+
+struct Result {
+  string name;
+  size_t bytes = 0;
+  size_t tokens = 0;
+  size_t functions = 0;
+  double lex_seconds = 0;
+  double lex_parallel_seconds = 0;
+  double parse_seconds = 0;
+  double check_seconds = 0;
+  double codegen_seconds = 0;
+  double end_to_end_seconds = 0;
+};
+
+// best wall-clock time of `iterations` runs
+double best_of(size_t iterations, const function<void()>& body)
+{
+  double best = numeric_limits<double>::max();
+  for (size_t i = 0; i < iterations; ++i) {
+    const auto start = chrono::steady_clock::now();
+    body();
+    best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  }
+  return best;
+}
+
+// helper to abort the benchmark on a compile error in a generated corpus
+template<typename T>
+T check(Expected<T> value, string_view corpus)
+{
+  if (!value) {
+    println(cerr, "{}: {}", corpus, llvm::toString(value.takeError()));
+    exit(EXIT_FAILURE);
+  }
+  return std::move(*value);
+}
+
+void check(llvm::Error err, string_view corpus)
+{
+  if (err) {
+    println(cerr, "{}: {}", corpus, llvm::toString(std::move(err)));
+    exit(EXIT_FAILURE);
+  }
+}
+
+Result run_corpus(const Corpus& corpus, size_t iterations, ThreadPool& pool)
+{
+  const auto source = SourceFile::from_string(corpus.source, corpus.name + ".hsk");
+  const auto error_reporter = ErrorReporter(source.text(), source.filename());
+
+  Result result{.name = corpus.name, .bytes = source.size()};
+
+  // each phase is timed on its own from a fresh copy of the previous phase's output
+  Interner interner;
+  const auto tokens = check(Lexer(source, interner, error_reporter).tokenize(), corpus.name);
+  auto program = check(Parser(tokens, interner, error_reporter).parse(), corpus.name);
+  check(TypeChecker::check(program, interner, error_reporter), corpus.name);
+  result.tokens = tokens.size();
+  result.functions = program.functions.size();
+
+  result.lex_seconds = best_of(iterations, [&] {
+    Interner fresh;
+    check(Lexer(source, fresh, error_reporter).tokenize(), corpus.name);
+  });
+
+  // serial below two PARALLEL_LEX_MIN_CHUNK chunks; raise --scale to split
+  result.lex_parallel_seconds = best_of(iterations, [&] {
+    Interner fresh;
+    check(tokenize_parallel(source, fresh, error_reporter, pool), corpus.name);
+  });
+
+  result.parse_seconds = best_of(iterations, [&] {
+    check(Parser(tokens, interner, error_reporter).parse(), corpus.name);
+  });
+
+  // checking again overwrites the types with the same ones
+  result.check_seconds = best_of(iterations, [&] {
+    check(TypeChecker::check(program, interner, error_reporter), corpus.name);
+  });
+
+  result.codegen_seconds = best_of(iterations, [&] {
+    auto codegen = CodeGen(interner);
+    check(codegen.generate(program), corpus.name);
+  });
+
+  result.end_to_end_seconds = best_of(iterations, [&] {
+    Interner fresh;
+    auto fresh_tokens = check(Lexer(source, fresh, error_reporter).tokenize(), corpus.name);
+    auto fresh_program = check(Parser(fresh_tokens, fresh, error_reporter).parse(), corpus.name);
+    check(TypeChecker::check(fresh_program, fresh, error_reporter), corpus.name);
+    auto codegen = CodeGen(fresh);
+    check(codegen.generate(fresh_program), corpus.name);
+  });
+
+  return result;
+}
+
+double megabytes_per_second(size_t bytes, double seconds)
+{
+  return seconds > 0 ? static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+string to_json(const vector<Result>& results, size_t iterations, size_t threads)
+{
+  string out = format("{{\n  \"iterations\": {},\n  \"threads\": {},\n  \"benchmarks\": [\n", iterations, threads);
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    out += format(
+      "    {{\"corpus\": \"{}\", \"bytes\": {}, \"tokens\": {}, \"functions\": {}, "
+      "\"lex_ms\": {:.3f}, \"lex_mb_s\": {:.2f}, \"tokens_per_s\": {:.0f}, "
+      "\"lex_parallel_ms\": {:.3f}, \"lex_parallel_mb_s\": {:.2f}, "
+      "\"parse_ms\": {:.3f}, \"check_ms\": {:.3f}, \"codegen_ms\": {:.3f}, "
+      "\"end_to_end_ms\": {:.3f}, \"end_to_end_mb_s\": {:.2f}}}{}\n",
+      r.name, r.bytes, r.tokens, r.functions,
+      r.lex_seconds * 1e3, megabytes_per_second(r.bytes, r.lex_seconds),
+      r.lex_seconds > 0 ? static_cast<double>(r.tokens) / r.lex_seconds : 0.0,
+      r.lex_parallel_seconds * 1e3, megabytes_per_second(r.bytes, r.lex_parallel_seconds),
+      r.parse_seconds * 1e3, r.check_seconds * 1e3, r.codegen_seconds * 1e3,
+      r.end_to_end_seconds * 1e3, megabytes_per_second(r.bytes, r.end_to_end_seconds),
+      i + 1 < results.size() ? "," : ""
+    );
+  }
+  out += "  ]\n}\n";
+  return out;
+}
+
+// helper to parse a positive integer flag value
+size_t parse_count(string_view flag, string_view value)
+{
+  size_t count = 0;
+  const auto [end, ec] = from_chars(value.data(), value.data() + value.size(), count);
+  if (ec != errc() || end != value.data() + value.size() || count == 0) {
+    println(cerr, "Invalid value '{}' for {}", value, flag);
+    exit(EXIT_FAILURE);
+  }
+  return count;
+}
+
+int main(int argc, char* argv[])
+{
+  size_t iterations = 5;
+  size_t scale = 1;
+  string output_path;
+
+  for (int i = 1; i < argc; ++i) {
+    const auto arg = string_view(argv[i]);
+    if ((arg == "--iterations" || arg == "--scale" || arg == "-o") && i + 1 >= argc) {
+      println(cerr, "Expected value after {}", arg);
+      return EXIT_FAILURE;
+    }
+    if (arg == "--iterations") {
+      iterations = parse_count(arg, argv[++i]);
+    } else if (arg == "--scale") {
+      scale = parse_count(arg, argv[++i]);
+    } else if (arg == "-o") {
+      output_path = argv[++i];
+    } else {
+      println(cerr, "Usage: husk_bench [--iterations N] [--scale N] [-o results.json]");
+      return EXIT_FAILURE;
+    }
+  }
+
+  const auto corpora = synthetic_corpora(scale);
+
+  auto pool = ThreadPool(max(thread::hardware_concurrency(), 1u) - 1);
+  vector<Result> results;
+  for (const auto& corpus : corpora) {
+    results.push_back(run_corpus(corpus, iterations, pool));
+  }
+
+  const auto json = to_json(results, iterations, pool.slot_count());
+  if (output_path.empty()) {
+    print("{}", json);
+  } else {
+    ofstream(output_path) << json;
+  }
+  return EXIT_SUCCESS;
+}
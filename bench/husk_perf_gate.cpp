@@ -0,0 +1,498 @@
+// Compile-throughput regression gate.
+//
+// Compiles a fixed corpus through Lexer::tokenize, Parser::parse,
+// TypeChecker::check, Folder::fold and CodeGen::generate, timing each phase
+// with PhaseTimers, and records the module's size and the best-of-N phase
+// times. The corpus is the checked-in .hsk programs, whose IR instruction
+// counts are also recorded per function, and husk_bench's synthetic
+// corpora, which are large enough for phase times to mean something. With
+// --update the measurements become the checked-in baseline; otherwise they
+// are compared against it and the gate fails when any of them grew past
+// its tolerance. Phase times are compared after scaling the baseline by
+// how fast a fixed calibration workload ran on either side, so a slower or
+// busier machine does not read as a compiler regression.
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <print>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include "ast.hpp"
+#include "codegen.hpp"
+#include "corpora.hpp"
+#include "fold.hpp"
+#include "instrumentation.hpp"
+#include "lexer.hpp"
+#include "source.hpp"
+#include "typecheck.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// the phases a corpus program goes through, all of them timed
+inline constexpr Phase GATED_PHASES[] = {Phase::lex, Phase::parse, Phase::check, Phase::fold, Phase::codegen};
+
+// Phase times less than this many microseconds apart are scheduling noise,
+// so they never count as a regression
+inline constexpr int64_t TIME_NOISE_FLOOR_US = 200;
+
+// A noisy stretch can outlast every iteration of a corpus, so a corpus over
+// its time tolerance is measured this many more times before it counts
+inline constexpr size_t TIME_RETRIES = 3;
+
+// what one corpus program compiles to, and how long each phase took
+struct Measurement {
+  map<string, unsigned> instructions_per_function;  // checked-in programs only
+  size_t instructions = 0;  // module size: instructions and basic blocks over all functions
+  size_t basic_blocks = 0;
+  map<string, int64_t> phase_us;
+};
+
+// the checked-in measurements, and the calibration time recorded with them
+struct Baseline {
+  int64_t calibration_us = 0;  // 0 for baselines without one: times are compared unscaled
+  map<string, Measurement> corpus;
+};
+
+// Best-of-N time of a fixed workload unrelated to the compiler: sorting a
+// pseudo-random array, which like the phases is bound by branches and
+// memory. The ratio of two runs tells how much faster one machine is.
+int64_t calibrate(size_t iterations)
+{
+  vector<uint64_t> values(1 << 18);
+  auto best = numeric_limits<int64_t>::max();
+  for (size_t i = 0; i < iterations; ++i) {
+    uint64_t state = 0x9e3779b97f4a7c15;
+    for (auto& value : values) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      value = state;
+    }
+    const auto start = chrono::steady_clock::now();
+    ranges::sort(values);
+    const auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+    best = min(best, static_cast<int64_t>(elapsed.count()));
+  }
+  return best;
+}
+
+// helper to stop the gate on a program that does not compile
+template<typename T>
+T check(Expected<T> value, string_view corpus)
+{
+  if (!value) {
+    println(cerr, "{}: {}", corpus, llvm::toString(value.takeError()));
+    exit(EXIT_FAILURE);
+  }
+  return std::move(*value);
+}
+
+void check(llvm::Error err, string_view corpus)
+{
+  if (err) {
+    println(cerr, "{}: {}", corpus, llvm::toString(std::move(err)));
+    exit(EXIT_FAILURE);
+  }
+}
+
+// helper to keep each phase's best time of two measurements of one corpus
+void keep_best_times(Measurement& measurement, const Measurement& again)
+{
+  for (auto& [phase, us] : measurement.phase_us) {
+    if (const auto it = again.phase_us.find(phase); it != again.phase_us.end()) {
+      us = min(us, it->second);
+    }
+  }
+}
+
+// Compile `source` `iterations` times and keep each phase's best time.
+// The IR is the same every time, so it is counted once.
+Measurement measure(const SourceFile& source, size_t iterations, bool per_function)
+{
+  const auto& input = source.filename();
+  const auto error_reporter = ErrorReporter(source.text(), input);
+
+  Measurement measurement;
+  for (const auto phase : GATED_PHASES) {
+    measurement.phase_us[string(PHASE_NAMES[static_cast<size_t>(phase)])] = numeric_limits<int64_t>::max();
+  }
+
+  for (size_t i = 0; i < iterations; ++i) {
+    auto timers = PhaseTimers(false);
+    timers.enter(Phase::lex);
+    auto interner = Interner();
+    const auto tokens = check(Lexer(source, interner, error_reporter).tokenize(), input);
+    timers.enter(Phase::parse);
+    auto program = check(Parser(tokens, interner, error_reporter).parse(), input);
+    timers.enter(Phase::check);
+    check(TypeChecker::check(program, interner, error_reporter), input);
+    timers.enter(Phase::fold);
+    Folder::fold(program);
+    timers.enter(Phase::codegen);
+    auto codegen = CodeGen(interner);
+    check(codegen.generate(program), input);
+    timers.stop();
+
+    for (const auto phase : GATED_PHASES) {
+      auto& best = measurement.phase_us[string(PHASE_NAMES[static_cast<size_t>(phase)])];
+      best = min(best, static_cast<int64_t>(llround(timers.wall_seconds(phase) * 1e6)));
+    }
+
+    if (i == 0) {
+      const auto context = codegen.getContext();
+      const auto module = codegen.getModule();
+      if (per_function) {
+        auto stats = CompileStats();
+        stats.record_module(*module);
+        measurement.instructions_per_function.insert(stats.instructions_per_function.begin(),
+                                                     stats.instructions_per_function.end());
+      }
+      for (const auto& function : *module) {
+        measurement.instructions += function.getInstructionCount();
+        measurement.basic_blocks += function.size();
+      }
+    }
+  }
+  return measurement;
+}
+
+// every .hsk file directly in `directory`, keyed by file name
+map<string, fs::path> corpus_files(const fs::path& directory)
+{
+  map<string, fs::path> files;
+  error_code ec;
+  for (const auto& entry : fs::directory_iterator(directory, ec)) {
+    if (entry.is_regular_file() && entry.path().extension() == ".hsk") {
+      files.emplace(entry.path().filename().string(), entry.path());
+    }
+  }
+  if (ec || files.empty()) {
+    println(cerr, "No .hsk programs in corpus directory '{}'", directory.string());
+    exit(EXIT_FAILURE);
+  }
+  return files;
+}
+
+// helper to print a measurement as one baseline entry
+void write_measurement(llvm::json::OStream& json, const Measurement& measurement)
+{
+  json.object([&] {
+    json.attribute("instructions", static_cast<int64_t>(measurement.instructions));
+    json.attribute("basic_blocks", static_cast<int64_t>(measurement.basic_blocks));
+    if (!measurement.instructions_per_function.empty()) {
+      json.attributeObject("functions", [&] {
+        for (const auto& [name, count] : measurement.instructions_per_function) {
+          json.attribute(name, static_cast<int64_t>(count));
+        }
+      });
+    }
+    json.attributeObject("phase_us", [&] {
+      for (const auto& [phase, us] : measurement.phase_us) {
+        json.attribute(phase, us);
+      }
+    });
+  });
+}
+
+string to_json(const map<string, Measurement>& measurements, size_t iterations, int64_t calibration_us)
+{
+  string out;
+  llvm::raw_string_ostream os(out);
+  llvm::json::OStream json(os, 2);
+  json.object([&] {
+    json.attribute("iterations", static_cast<int64_t>(iterations));
+    json.attribute("calibration_us", calibration_us);
+    json.attributeObject("corpus", [&] {
+      for (const auto& [name, measurement] : measurements) {
+        json.attributeBegin(name);
+        write_measurement(json, measurement);
+        json.attributeEnd();
+      }
+    });
+  });
+  os << "\n";
+  return os.str();
+}
+
+// helper to read a baseline entry back; missing counts read as 0
+Measurement read_measurement(const llvm::json::Object& entry)
+{
+  Measurement measurement;
+  measurement.instructions = entry.getInteger("instructions").value_or(0);
+  measurement.basic_blocks = entry.getInteger("basic_blocks").value_or(0);
+  if (const auto* functions = entry.getObject("functions")) {
+    for (const auto& [name, count] : *functions) {
+      measurement.instructions_per_function[name.str()] = count.getAsInteger().value_or(0);
+    }
+  }
+  if (const auto* phases = entry.getObject("phase_us")) {
+    for (const auto& [phase, us] : *phases) {
+      measurement.phase_us[phase.str()] = us.getAsInteger().value_or(0);
+    }
+  }
+  return measurement;
+}
+
+auto read_baseline(const fs::path& path) -> Expected<Baseline>
+{
+  auto buffer = llvm::MemoryBuffer::getFile(path.string());
+  if (!buffer) {
+    return llvm::createStringError(buffer.getError(), format("Cannot read baseline '{}'", path.string()));
+  }
+  auto parsed = llvm::json::parse((*buffer)->getBuffer());
+  if (!parsed) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Invalid baseline '{}': {}", path.string(),
+                                                                          llvm::toString(parsed.takeError())));
+  }
+  const auto* root = parsed->getAsObject();
+  const auto* corpus = root ? root->getObject("corpus") : nullptr;
+  if (!corpus) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   format("Invalid baseline '{}': expected a \"corpus\" object", path.string()));
+  }
+
+  Baseline baseline;
+  baseline.calibration_us = root->getInteger("calibration_us").value_or(0);
+  for (const auto& [name, entry] : *corpus) {
+    if (const auto* object = entry.getAsObject()) {
+      baseline.corpus[name.str()] = read_measurement(*object);
+    }
+  }
+  return baseline;
+}
+
+// Compares measurements against the baseline and prints one line per
+// regression; improvements past the tolerance are printed as notes, since
+// they mean the baseline should be refreshed to keep the gate tight.
+class Comparison
+{
+public:
+  // time_scale: how much longer the calibration took now than for the baseline
+  Comparison(double size_tolerance, double time_tolerance, double time_scale)
+    : m_size_tolerance(size_tolerance), m_time_tolerance(time_tolerance), m_time_scale(time_scale)
+  {
+  }
+
+  void compare(string_view corpus, const Measurement& current, const Measurement& baseline)
+  {
+    compare_size(corpus, "instructions", current.instructions, baseline.instructions);
+    compare_size(corpus, "basic blocks", current.basic_blocks, baseline.basic_blocks);
+    for (const auto& [name, count] : current.instructions_per_function) {
+      const auto it = baseline.instructions_per_function.find(name);
+      if (it == baseline.instructions_per_function.end()) {
+        regression(format("{}: function '{}' ({} instructions) is not in the baseline", corpus, name, count));
+      } else {
+        compare_size(corpus, format("'{}' instructions", name), count, it->second);
+      }
+    }
+    for (const auto& [phase, us] : current.phase_us) {
+      const auto it = baseline.phase_us.find(phase);
+      if (it != baseline.phase_us.end()) {
+        compare_time(corpus, phase, us, it->second);
+      }
+    }
+  }
+
+  // whether every phase time is within its tolerance, without reporting
+  bool times_within(const Measurement& current, const Measurement& baseline) const
+  {
+    return ranges::all_of(current.phase_us, [&](const auto& phase) {
+      const auto it = baseline.phase_us.find(phase.first);
+      return it == baseline.phase_us.end() || !slower(phase.second, scaled(it->second));
+    });
+  }
+
+  void missing(string_view corpus)
+  {
+    regression(format("{}: not in the baseline", corpus));
+  }
+
+  size_t regressions() const
+  {
+    return m_regressions;
+  }
+
+private:
+  void compare_size(string_view corpus, string_view what, size_t current, size_t baseline)
+  {
+    const double limit = static_cast<double>(baseline) * (1.0 + m_size_tolerance / 100.0);
+    if (static_cast<double>(current) > limit) {
+      regression(format("{}: {} grew from {} to {} ({})", corpus, what, baseline, current, change(current, baseline)));
+    } else if (static_cast<double>(current) < static_cast<double>(baseline) * (1.0 - m_size_tolerance / 100.0)) {
+      println("note: {}: {} shrank from {} to {} ({})", corpus, what, baseline, current, change(current, baseline));
+    }
+  }
+
+  // helper to scale a recorded time to this machine's calibration
+  int64_t scaled(int64_t recorded) const
+  {
+    return static_cast<int64_t>(static_cast<double>(recorded) * m_time_scale);
+  }
+
+  bool slower(int64_t current, int64_t baseline) const
+  {
+    const double limit = static_cast<double>(baseline) * (1.0 + m_time_tolerance / 100.0);
+    return static_cast<double>(current) > limit && current - baseline > TIME_NOISE_FLOOR_US;
+  }
+
+  void compare_time(string_view corpus, string_view phase, int64_t current, int64_t recorded)
+  {
+    const auto baseline = scaled(recorded);
+    if (slower(current, baseline)) {
+      regression(format("{}: {} took {} us, baseline {} us scaled to {} us ({})", corpus, phase, current, recorded,
+                        baseline, change(current, baseline)));
+    }
+  }
+
+  // helper to format a relative change, e.g. +12.5%
+  static string change(double current, double baseline)
+  {
+    return baseline > 0 ? format("{:+.1f}%", (current - baseline) / baseline * 100.0) : "was 0";
+  }
+
+  void regression(string message)
+  {
+    println("regression: {}", message);
+    ++m_regressions;
+  }
+
+  double m_size_tolerance;  // percent
+  double m_time_tolerance;  // percent
+  double m_time_scale;
+  size_t m_regressions = 0;
+};
+
+// helper to parse a positive integer flag value
+size_t parse_count(string_view flag, string_view value)
+{
+  size_t count = 0;
+  const auto [end, ec] = from_chars(value.data(), value.data() + value.size(), count);
+  if (ec != errc() || end != value.data() + value.size() || count == 0) {
+    println(cerr, "Invalid value '{}' for {}", value, flag);
+    exit(EXIT_FAILURE);
+  }
+  return count;
+}
+
+// helper to parse a non-negative percentage flag value
+double parse_percent(string_view flag, string_view value)
+{
+  double percent = -1;
+  const auto [end, ec] = from_chars(value.data(), value.data() + value.size(), percent);
+  if (ec != errc() || end != value.data() + value.size() || percent < 0) {
+    println(cerr, "Invalid value '{}' for {}", value, flag);
+    exit(EXIT_FAILURE);
+  }
+  return percent;
+}
+
+int main(int argc, char* argv[])
+{
+  size_t iterations = 5;
+  double size_tolerance = 2;
+  double time_tolerance = 50;
+  bool update = false;
+  fs::path corpus_dir;
+  fs::path baseline_path;
+
+  for (int i = 1; i < argc; ++i) {
+    const auto arg = string_view(argv[i]);
+    const bool takes_value = arg == "--corpus" || arg == "--baseline" || arg == "--iterations" ||
+                             arg == "--size-tolerance" || arg == "--time-tolerance";
+    if (takes_value && i + 1 >= argc) {
+      println(cerr, "Expected value after {}", arg);
+      return EXIT_FAILURE;
+    }
+    if (arg == "--corpus") {
+      corpus_dir = argv[++i];
+    } else if (arg == "--baseline") {
+      baseline_path = argv[++i];
+    } else if (arg == "--iterations") {
+      iterations = parse_count(arg, argv[++i]);
+    } else if (arg == "--size-tolerance") {
+      size_tolerance = parse_percent(arg, argv[++i]);
+    } else if (arg == "--time-tolerance") {
+      time_tolerance = parse_percent(arg, argv[++i]);
+    } else if (arg == "--update") {
+      update = true;
+    } else {
+      corpus_dir.clear();
+      break;
+    }
+  }
+  if (corpus_dir.empty() || baseline_path.empty()) {
+    println(cerr, "Usage: husk_perf_gate --corpus <dir> --baseline <baseline.json> [--update] [--iterations N]\n"
+                  "                      [--size-tolerance PERCENT] [--time-tolerance PERCENT]");
+    return EXIT_FAILURE;
+  }
+
+  // the programs are kept so that a corpus can be measured again
+  struct Corpus {
+    SourceFile source;
+    bool per_function;  // checked-in programs only
+  };
+  map<string, Corpus> corpora;
+  for (const auto& [name, path] : corpus_files(corpus_dir)) {
+    corpora.emplace(name, Corpus{check(SourceFile::open(path), name), true});
+  }
+  for (const auto& corpus : synthetic_corpora(1)) {
+    corpora.emplace(corpus.name, Corpus{SourceFile::from_string(corpus.source, corpus.name + ".hsk"), false});
+  }
+
+  const auto calibration_us = calibrate(iterations);
+  map<string, Measurement> measurements;
+  for (const auto& [name, corpus] : corpora) {
+    measurements[name] = measure(corpus.source, iterations, corpus.per_function);
+  }
+
+  if (update) {
+    ofstream(baseline_path) << to_json(measurements, iterations, calibration_us);
+    println("Wrote baseline for {} corpora to {}", measurements.size(), baseline_path.string());
+    return EXIT_SUCCESS;
+  }
+
+  auto baseline = read_baseline(baseline_path);
+  if (!baseline) {
+    println(cerr, "{}", llvm::toString(baseline.takeError()));
+    return EXIT_FAILURE;
+  }
+
+  const double time_scale = baseline->calibration_us > 0 ? static_cast<double>(max<int64_t>(calibration_us, 1)) /
+                                                               static_cast<double>(baseline->calibration_us)
+                                                         : 1.0;
+  auto comparison = Comparison(size_tolerance, time_tolerance, time_scale);
+  for (auto& [name, measurement] : measurements) {
+    const auto it = baseline->corpus.find(name);
+    if (it == baseline->corpus.end()) {
+      comparison.missing(name);
+    } else {
+      const auto& corpus = corpora.at(name);
+      for (size_t retry = 0; retry < TIME_RETRIES && !comparison.times_within(measurement, it->second); ++retry) {
+        keep_best_times(measurement, measure(corpus.source, iterations, corpus.per_function));
+      }
+      comparison.compare(name, measurement, it->second);
+    }
+  }
+
+  if (comparison.regressions() > 0) {
+    println("{} regressions against {}; if they are intended, refresh it with --update", comparison.regressions(),
+            baseline_path.string());
+    return EXIT_FAILURE;
+  }
+  println("{} corpora within {}% size and {}% time of {}", measurements.size(), size_tolerance, time_tolerance,
+          baseline_path.string());
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+#include "husk_internal.h"
+#include "husk_runtime.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Channels are Vyukov's bounded MPMC queue: one sequence number per cell
+ * tells senders and receivers whose turn it is, so the common case of a
+ * channel that is neither full nor empty is one CAS and no lock. Only a
+ * caller that has to wait takes the channel's lock, to join a wait list;
+ * a successful send or receive takes it only when the opposite list is
+ * non-empty, to wake the first waiter. */
+
+enum {
+  HUSK_MAX_CAPACITY = 1 << 30
+};
+
+typedef struct {
+  _Atomic size_t sequence;
+  int64_t value;
+} husk_cell;
+
+/* a FIFO of waiters */
+typedef struct {
+  husk_waiter* head;
+  husk_waiter* tail;
+  _Atomic int count;  /* read without the lock by the fast paths */
+} husk_wait_list;
+
+struct husk_channel {
+  husk_channel* next;       /* every live channel, for husk_free_channels */
+  size_t mask;              /* capacity - 1 */
+  pthread_mutex_t lock;     /* guards the wait lists */
+  husk_wait_list senders;   /* waiting for a free cell */
+  husk_wait_list receivers; /* waiting for a value */
+  _Alignas(64) _Atomic size_t send_position;
+  _Alignas(64) _Atomic size_t receive_position;
+  _Alignas(64) husk_cell cells[];
+};
+
+static _Atomic(husk_channel*) all_channels;
+
+husk_channel* husk_channel_new(int64_t capacity)
+{
+  /* with a single cell a freed cell's sequence would read as filled */
+  size_t cells = 2;
+  while ((int64_t)cells < capacity && cells < HUSK_MAX_CAPACITY) {
+    cells <<= 1;
+  }
+  const size_t size = sizeof(husk_channel) + cells * sizeof(husk_cell);
+  husk_channel* channel = aligned_alloc(64, (size + 63) / 64 * 64);
+  if (!channel) {
+    husk_fatal("out of memory creating a channel");
+  }
+  memset(channel, 0, sizeof(husk_channel));
+  channel->mask = cells - 1;
+  pthread_mutex_init(&channel->lock, NULL);
+  for (size_t i = 0; i < cells; ++i) {
+    atomic_init(&channel->cells[i].sequence, i);
+  }
+
+  husk_channel* head = atomic_load_explicit(&all_channels, memory_order_relaxed);
+  do {
+    channel->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(&all_channels, &head, channel, memory_order_release,
+                                                  memory_order_relaxed));
+  return channel;
+}
+
+void husk_free_channels(void)
+{
+  husk_channel* channel = atomic_exchange_explicit(&all_channels, NULL, memory_order_acquire);
+  while (channel) {
+    husk_channel* next = channel->next;
+    pthread_mutex_destroy(&channel->lock);
+    free(channel);
+    channel = next;
+  }
+}
+
+static int try_send(husk_channel* channel, int64_t value)
+{
+  size_t position = atomic_load_explicit(&channel->send_position, memory_order_relaxed);
+  for (;;) {
+    husk_cell* cell = &channel->cells[position & channel->mask];
+    const size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    const intptr_t lag = (intptr_t)sequence - (intptr_t)position;
+    if (lag == 0) {
+      if (atomic_compare_exchange_weak_explicit(&channel->send_position, &position, position + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        cell->value = value;
+        atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+        return 1;
+      }
+    } else if (lag < 0) {
+      return 0;  /* full */
+    } else {
+      position = atomic_load_explicit(&channel->send_position, memory_order_relaxed);
+    }
+  }
+}
+
+static int try_receive(husk_channel* channel, int64_t* value)
+{
+  size_t position = atomic_load_explicit(&channel->receive_position, memory_order_relaxed);
+  for (;;) {
+    husk_cell* cell = &channel->cells[position & channel->mask];
+    const size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    const intptr_t lag = (intptr_t)sequence - (intptr_t)(position + 1);
+    if (lag == 0) {
+      if (atomic_compare_exchange_weak_explicit(&channel->receive_position, &position, position + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        *value = cell->value;
+        atomic_store_explicit(&cell->sequence, position + channel->mask + 1, memory_order_release);
+        return 1;
+      }
+    } else if (lag < 0) {
+      return 0;  /* empty */
+    } else {
+      position = atomic_load_explicit(&channel->receive_position, memory_order_relaxed);
+    }
+  }
+}
+
+static void append_waiter(husk_wait_list* list, husk_waiter* waiter)
+{
+  waiter->next = NULL;
+  if (list->tail) {
+    list->tail->next = waiter;
+  } else {
+    list->head = waiter;
+  }
+  list->tail = waiter;
+  atomic_fetch_add(&list->count, 1);
+}
+
+static void remove_waiter(husk_wait_list* list, husk_waiter* waiter)
+{
+  husk_waiter* previous = NULL;
+  for (husk_waiter* it = list->head; it; previous = it, it = it->next) {
+    if (it == waiter) {
+      if (previous) {
+        previous->next = it->next;
+      } else {
+        list->head = it->next;
+      }
+      if (list->tail == it) {
+        list->tail = previous;
+      }
+      atomic_fetch_sub(&list->count, 1);
+      return;
+    }
+  }
+}
+
+/* after a send or receive succeeded: wake the first waiter of the other
+ * side. The fence pairs with the one a waiter issues between joining its
+ * list and retrying, so one of the two always sees the other. */
+static void wake_first(husk_channel* channel, husk_wait_list* list)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&list->count, memory_order_relaxed) == 0) {
+    return;
+  }
+  pthread_mutex_lock(&channel->lock);
+  husk_waiter* waiter = list->head;
+  if (waiter) {
+    remove_waiter(list, waiter);
+  }
+  pthread_mutex_unlock(&channel->lock);
+  if (waiter) {
+    husk_wake(waiter);
+  }
+}
+
+/* Join `list`, retry once and park if that still fails. Returns 1 when
+ * the retry succeeded; otherwise the caller was woken and tries again. */
+static int wait_on(husk_channel* channel, husk_wait_list* list, int (*retry)(husk_channel*, void*), void* arg)
+{
+  husk_waiter waiter = {.task = husk_current_task()};
+  pthread_mutex_lock(&channel->lock);
+  append_waiter(list, &waiter);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (retry(channel, arg)) {
+    remove_waiter(list, &waiter);
+    pthread_mutex_unlock(&channel->lock);
+    return 1;
+  }
+  husk_park(&waiter, &channel->lock);
+  return 0;
+}
+
+static int retry_send(husk_channel* channel, void* value)
+{
+  return try_send(channel, *(int64_t*)value);
+}
+
+static int retry_receive(husk_channel* channel, void* value)
+{
+  return try_receive(channel, value);
+}
+
+void husk_channel_send(husk_channel* channel, int64_t value)
+{
+  husk_flush();  /* what was printed before the send comes before what the receiver prints */
+  while (!try_send(channel, value)) {
+    if (wait_on(channel, &channel->senders, retry_send, &value)) {
+      break;
+    }
+  }
+  wake_first(channel, &channel->receivers);
+}
+
+int64_t husk_channel_receive(husk_channel* channel)
+{
+  int64_t value;
+  while (!try_receive(channel, &value)) {
+    if (wait_on(channel, &channel->receivers, retry_receive, &value)) {
+      break;
+    }
+  }
+  wake_first(channel, &channel->senders);
+  return value;
+}
@@ -0,0 +1,36 @@
+#ifndef HUSK_INTERNAL_H
+#define HUSK_INTERNAL_H
+
+#include <pthread.h>
+
+/* Interface between the scheduler (husk_scheduler.c) and the channels
+ * (husk_channel.c); not part of what compiled programs call. */
+
+typedef struct husk_task husk_task;
+
+/* A task or OS thread blocked on a channel, linked into its wait list.
+ * Lives on the blocked caller's stack. */
+typedef struct husk_waiter {
+  struct husk_waiter* next;
+  husk_task* task;  /* NULL when an OS thread (main) waits */
+  int woken;        /* OS threads only, guarded by the scheduler's parking lock */
+} husk_waiter;
+
+/* the task running on the calling thread, NULL on an OS thread */
+husk_task* husk_current_task(void);
+
+/* Block the caller until husk_wake(waiter). `lock` is held on entry and
+ * guards the wait list the waiter was added to; it is released once the
+ * caller can no longer miss the wake-up. */
+void husk_park(husk_waiter* waiter, pthread_mutex_t* lock);
+
+/* make a parked waiter runnable; the caller has already taken it off its wait list */
+void husk_wake(husk_waiter* waiter);
+
+/* free every channel; only called by husk_shutdown once no task can use them */
+void husk_free_channels(void);
+
+/* report a runtime error on stderr and exit with status 2 */
+_Noreturn void husk_fatal(const char* message);
+
+#endif
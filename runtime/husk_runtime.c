@@ -0,0 +1,167 @@
+#include "husk_internal.h"
+#include "husk_runtime.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Output is formatted into a per-thread buffer and written with write(2),
+ * so print takes no stdio lock and parses no format string. */
+
+enum { HUSK_PRINT_BUFFER_SIZE = 64 * 1024 };
+
+/* longest line print produces: "-9223372036854775808\n" */
+enum { HUSK_MAX_LINE = 21 };
+
+static _Thread_local struct {
+  size_t used;
+  char data[HUSK_PRINT_BUFFER_SIZE];
+} output;
+
+static atomic_int flush_registered;
+
+static const char digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+static void write_all(int fd, const char* data, size_t size)
+{
+  while (size > 0) {
+    const ssize_t written = write(fd, data, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return;  /* like printf to a closed stdout: the output is lost */
+    }
+    data += written;
+    size -= (size_t)written;
+  }
+}
+
+void husk_flush(void)
+{
+  write_all(STDOUT_FILENO, output.data, output.used);
+  output.used = 0;
+}
+
+_Noreturn void husk_fatal(const char* message)
+{
+  husk_flush();
+  write_all(STDERR_FILENO, "husk: ", 6);
+  write_all(STDERR_FILENO, message, strlen(message));
+  write_all(STDERR_FILENO, "\n", 1);
+  _Exit(2);
+}
+
+void husk_print_i64(int64_t value)
+{
+  if (!atomic_load_explicit(&flush_registered, memory_order_relaxed) &&
+      !atomic_exchange(&flush_registered, 1)) {
+    atexit(husk_flush);
+  }
+  if (output.used + HUSK_MAX_LINE > HUSK_PRINT_BUFFER_SIZE) {
+    husk_flush();
+  }
+
+  /* digits are produced two at a time from the end of a scratch line */
+  char line[HUSK_MAX_LINE];
+  char* end = line + HUSK_MAX_LINE;
+  char* p = end;
+  *--p = '\n';
+
+  uint64_t magnitude = value < 0 ? 0u - (uint64_t)value : (uint64_t)value;
+  while (magnitude >= 100) {
+    const uint64_t pair = magnitude % 100;
+    magnitude /= 100;
+    p -= 2;
+    memcpy(p, digit_pairs + 2 * pair, 2);
+  }
+  if (magnitude >= 10) {
+    p -= 2;
+    memcpy(p, digit_pairs + 2 * magnitude, 2);
+  }
+  else {
+    *--p = (char)('0' + magnitude);
+  }
+  if (value < 0) {
+    *--p = '-';
+  }
+
+  memcpy(output.data + output.used, p, (size_t)(end - p));
+  output.used += (size_t)(end - p);
+}
+
+void husk_print_i32(int32_t value)
+{
+  husk_print_i64(value);
+}
+
+void* husk_array_alloc(size_t size)
+{
+  void* data = malloc(size ? size : 1);
+  if (!data) {
+    husk_fatal("out of memory allocating an array");
+  }
+  return data;
+}
+
+void husk_array_free(void* data)
+{
+  free(data);
+}
+
+/* the header of a chained block, aligned for any element that follows it */
+typedef union husk_array_link {
+  void* next;
+  max_align_t align;
+} husk_array_link;
+
+void* husk_array_alloc_chained(void** chain, size_t size)
+{
+  husk_array_link* link = malloc(sizeof *link + size);
+  if (!link) {
+    husk_fatal("out of memory allocating an array");
+  }
+  link->next = *chain;
+  *chain = link;
+  return link + 1;
+}
+
+void husk_array_free_chain(void* chain)
+{
+  while (chain) {
+    husk_array_link* link = chain;
+    chain = link->next;
+    free(link);
+  }
+}
+
+void husk_index_fail(int64_t index, int64_t length)
+{
+  char message[112];
+  snprintf(message, sizeof message, "index %" PRId64 " is out of bounds for an array of length %" PRId64, index,
+           length);
+  husk_fatal(message);
+}
+
+void husk_slice_fail(int64_t start, int64_t end, int64_t length)
+{
+  char message[144];
+  snprintf(message, sizeof message, "slice [%" PRId64 "..%" PRId64 "] is out of bounds for an array of length %" PRId64,
+           start, end, length);
+  husk_fatal(message);
+}
@@ -0,0 +1,74 @@
+#ifndef HUSK_RUNTIME_H
+#define HUSK_RUNTIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Runtime library of compiled Husk programs. Executables link the static
+ * library; `husk run` links it into the compiler itself and hands its
+ * addresses to the JIT. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* print(expr): append the decimal value and a newline to the calling
+ * thread's output buffer, writing it to stdout when it fills; one entry
+ * point per integer width */
+void husk_print_i32(int32_t value);
+void husk_print_i64(int64_t value);
+
+/* write out the calling thread's buffer; runs at exit for the main thread */
+void husk_flush(void);
+
+/* Storage of an array literal too large for the stack, allocated when the
+ * function that holds it is entered and freed when it returns */
+void* husk_array_alloc(size_t size);
+void husk_array_free(void* data);
+
+/* Storage of an array literal in a loop whose body assigns arrays, which a
+ * let mut can carry past the iteration: each evaluation gets a block of
+ * its own, linked into *chain (a slot of the function that starts out
+ * NULL), and husk_array_free_chain frees them all when it returns */
+void* husk_array_alloc_chained(void** chain, size_t size);
+void husk_array_free_chain(void* chain);
+
+/* Out-of-bounds a[index] and a[start..end]: report the error and exit with
+ * status 2; neither returns */
+void husk_index_fail(int64_t index, int64_t length);
+void husk_slice_fail(int64_t start, int64_t end, int64_t length);
+
+/* A bounded multi-producer multi-consumer channel of int (i64) values. */
+typedef struct husk_channel husk_channel;
+
+/* channel<int>(capacity): capacity is rounded up to a power of two, at least 2 */
+husk_channel* husk_channel_new(int64_t capacity);
+
+/* ch.send(value): wait while the channel is full */
+void husk_channel_send(husk_channel* channel, int64_t value);
+
+/* ch.receive(): wait while the channel is empty */
+int64_t husk_channel_receive(husk_channel* channel);
+
+/* spawn: run entry(env) as a green task on the scheduler's worker threads.
+ * The env_size bytes at env are copied into the task first. */
+void husk_spawn(void (*entry)(void*), const void* env, size_t env_size);
+
+/* `husk run`: call the program's main and return its result. A main that
+ * blocks on a channel no task can wake is abandoned instead of exiting the
+ * process: husk_run_main returns 0 and husk_shutdown counts main among the
+ * blocked tasks. */
+int husk_run_main(int (*main_fn)(void));
+
+/* Wait for every spawned task to finish, stop the workers and free the
+ * channels. Returns the number of tasks still blocked on a channel when
+ * nothing else can run (a deadlock), main included when husk_run_main
+ * abandoned it, 0 otherwise. Runs at exit once a task was spawned;
+ * `husk run` calls it after main returns. */
+long husk_shutdown(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
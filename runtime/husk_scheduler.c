@@ -0,0 +1,664 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE  /* MAP_ANON */
+#endif
+
+#include "husk_internal.h"
+#include "husk_runtime.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* M:N green tasks. Every spawn becomes a task with its own small stack;
+ * one worker thread per core runs tasks, each from its own Chase-Lev
+ * deque, stealing from the others when it runs dry. A task blocked on a
+ * channel switches back to its worker's scheduler loop, so the worker
+ * runs something else instead of blocking the thread.
+ *
+ * Tasks migrate between threads, so code that can run on a task never
+ * caches a thread-local address across a context switch: it re-reads the
+ * worker through current_worker(), which is kept out of line. */
+
+enum {
+  HUSK_STACK_SIZE = 256 * 1024,   /* per task, including the guard page */
+  HUSK_STACK_CACHE = 16,          /* free stacks a worker keeps */
+  HUSK_DEQUE_SIZE = 4096,         /* tasks per worker deque; more go to the injector */
+  HUSK_MAX_WORKERS = 256,
+  HUSK_DEADLOCK_POLL_MS = 50      /* how often blocked OS threads check for deadlock */
+};
+
+/* ---- context switching ------------------------------------------------ */
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+/* the callee-saved registers live on the suspended stack; a context is its stack pointer */
+typedef struct {
+  void* sp;
+} husk_context;
+
+#if defined(__APPLE__)
+#define HUSK_ASM_SYMBOL(name) "_" #name
+#else
+#define HUSK_ASM_SYMBOL(name) #name
+#endif
+
+/* save the callee-saved registers on the current stack, store the stack
+ * pointer in *from and resume the context saved in *to */
+void husk_switch_context(husk_context* from, husk_context* to);
+
+#if defined(__x86_64__)
+__asm__(
+  ".text\n"
+  ".p2align 4\n"
+  HUSK_ASM_SYMBOL(husk_switch_context) ":\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq (%rsi), %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+);
+#else
+__asm__(
+  ".text\n"
+  ".p2align 2\n"
+  HUSK_ASM_SYMBOL(husk_switch_context) ":\n"
+  "  sub sp, sp, #160\n"
+  "  stp x19, x20, [sp, #0]\n"
+  "  stp x21, x22, [sp, #16]\n"
+  "  stp x23, x24, [sp, #32]\n"
+  "  stp x25, x26, [sp, #48]\n"
+  "  stp x27, x28, [sp, #64]\n"
+  "  stp x29, x30, [sp, #80]\n"
+  "  stp d8, d9, [sp, #96]\n"
+  "  stp d10, d11, [sp, #112]\n"
+  "  stp d12, d13, [sp, #128]\n"
+  "  stp d14, d15, [sp, #144]\n"
+  "  mov x9, sp\n"
+  "  str x9, [x0]\n"
+  "  ldr x9, [x1]\n"
+  "  mov sp, x9\n"
+  "  ldp x19, x20, [sp, #0]\n"
+  "  ldp x21, x22, [sp, #16]\n"
+  "  ldp x23, x24, [sp, #32]\n"
+  "  ldp x25, x26, [sp, #48]\n"
+  "  ldp x27, x28, [sp, #64]\n"
+  "  ldp x29, x30, [sp, #80]\n"
+  "  ldp d8, d9, [sp, #96]\n"
+  "  ldp d10, d11, [sp, #112]\n"
+  "  ldp d12, d13, [sp, #128]\n"
+  "  ldp d14, d15, [sp, #144]\n"
+  "  add sp, sp, #160\n"
+  "  ret\n"
+);
+#endif
+
+/* lay out a stack so the first switch to it "returns" into start */
+static void init_context(husk_context* context, char* stack, void (*start)(void))
+{
+  uintptr_t* sp = (uintptr_t*)(stack + HUSK_STACK_SIZE);
+#if defined(__x86_64__)
+  *--sp = 0;                   /* start's return address: keeps the ABI's stack alignment */
+  *--sp = (uintptr_t)start;    /* popped by ret */
+  sp -= 6;                     /* rbp rbx r12 r13 r14 r15 */
+  memset(sp, 0, 6 * sizeof(*sp));
+#else
+  sp -= 20;                    /* x19..x30 and d8..d15 */
+  memset(sp, 0, 20 * sizeof(*sp));
+  sp[11] = (uintptr_t)start;   /* x30, the link register */
+#endif
+  context->sp = sp;
+}
+
+#else
+
+/* other targets fall back to the slower ucontext calls */
+#include <ucontext.h>
+
+typedef struct {
+  ucontext_t uc;
+} husk_context;
+
+static void husk_switch_context(husk_context* from, husk_context* to)
+{
+  swapcontext(&from->uc, &to->uc);
+}
+
+static void init_context(husk_context* context, char* stack, void (*start)(void))
+{
+  getcontext(&context->uc);
+  context->uc.uc_stack.ss_sp = stack;
+  context->uc.uc_stack.ss_size = HUSK_STACK_SIZE;
+  context->uc.uc_link = NULL;
+  makecontext(&context->uc, start, 0);
+}
+
+#endif
+
+/* ---- tasks and workers ------------------------------------------------ */
+
+struct husk_task {
+  husk_context context;
+  void (*entry)(void*);
+  char* stack;           /* mapped on first run, guard page at the low end */
+  husk_task* next;       /* injector queue link */
+  unsigned char env[];   /* the spawn's captured values, at least pointer-aligned */
+};
+
+/* Chase-Lev work-stealing deque (Le et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models"), fixed size. The owner pushes and
+ * pops at the bottom, thieves take from the top. */
+typedef struct {
+  _Alignas(64) _Atomic int64_t top;
+  _Alignas(64) _Atomic int64_t bottom;
+  _Atomic(husk_task*) slots[HUSK_DEQUE_SIZE];
+} husk_deque;
+
+/* what the scheduler loop does once a task has switched back to it */
+typedef enum {
+  AFTER_EXIT,  /* the task finished: release it */
+  AFTER_PARK   /* the task blocked: release the lock guarding its wait list */
+} husk_after;
+
+typedef struct {
+  husk_deque deque;
+  husk_context scheduler;     /* the worker's loop, suspended while a task runs */
+  husk_task* current;
+  husk_after after;
+  pthread_mutex_t* unlock;    /* for AFTER_PARK */
+  char* stacks[HUSK_STACK_CACHE];
+  unsigned cached_stacks;
+  uint64_t rng;               /* victim selection */
+  pthread_t thread;
+} husk_worker;
+
+static struct {
+  pthread_mutex_t start_lock;    /* starting and shutting down */
+  _Atomic int running;
+  unsigned worker_count;
+  husk_worker* workers;
+
+  pthread_mutex_t lock;          /* the injector, sleeping workers and `stopping` */
+  pthread_cond_t wake;           /* idle workers wait here */
+  pthread_cond_t done;           /* husk_shutdown waits here */
+  husk_task* inject_head;        /* tasks spawned off a worker, FIFO */
+  husk_task* inject_tail;
+  _Atomic size_t injected;
+  _Atomic int sleepers;
+  int stopping;
+
+  _Atomic long live;             /* spawned and not finished */
+  _Atomic long active;           /* runnable or running, i.e. not parked */
+
+  pthread_mutex_t parking_lock;  /* OS threads blocked on channels */
+  pthread_cond_t parking;
+  _Atomic long main_blocked;     /* 1 once husk_run_main abandoned a deadlocked main */
+} sched = {
+  .start_lock = PTHREAD_MUTEX_INITIALIZER,
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER,
+  .parking_lock = PTHREAD_MUTEX_INITIALIZER,
+  .parking = PTHREAD_COND_INITIALIZER,
+};
+
+static _Thread_local husk_worker* tls_worker;
+
+/* where a deadlocked main leaves to, while husk_run_main runs it on this thread */
+static _Thread_local jmp_buf* main_exit;
+
+/* out of line so every call reads the thread-local of the thread it runs on */
+__attribute__((noinline)) static husk_worker* current_worker(void)
+{
+  return tls_worker;
+}
+
+husk_task* husk_current_task(void)
+{
+  husk_worker* worker = current_worker();
+  return worker ? worker->current : NULL;
+}
+
+static int deque_push(husk_deque* deque, husk_task* task)
+{
+  const int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  const int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  if (bottom - top >= HUSK_DEQUE_SIZE) {
+    return 0;
+  }
+  atomic_store_explicit(&deque->slots[bottom & (HUSK_DEQUE_SIZE - 1)], task, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  return 1;
+}
+
+static husk_task* deque_pop(husk_deque* deque)
+{
+  const int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+  if (top > bottom) {
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return NULL;
+  }
+  husk_task* task = atomic_load_explicit(&deque->slots[bottom & (HUSK_DEQUE_SIZE - 1)], memory_order_relaxed);
+  if (top == bottom) {
+    /* the last task: race the thieves for it */
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+      task = NULL;
+    }
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return task;
+}
+
+static husk_task* deque_steal(husk_deque* deque)
+{
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  const int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if (top >= bottom) {
+    return NULL;
+  }
+  husk_task* task = atomic_load_explicit(&deque->slots[top & (HUSK_DEQUE_SIZE - 1)], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,
+                                               memory_order_relaxed)) {
+    return NULL;
+  }
+  return task;
+}
+
+static int deque_empty(husk_deque* deque)
+{
+  return atomic_load_explicit(&deque->bottom, memory_order_acquire) <=
+         atomic_load_explicit(&deque->top, memory_order_acquire);
+}
+
+/* wake one idle worker if there is any; pairs with the fence in worker_idle */
+static void notify_worker(void)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&sched.sleepers, memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&sched.lock);
+    pthread_cond_signal(&sched.wake);
+    pthread_mutex_unlock(&sched.lock);
+  }
+}
+
+/* queue a runnable task: on this worker's deque, where it runs next, or
+ * through the injector when called off a worker or the deque is full */
+static void make_runnable(husk_task* task)
+{
+  husk_worker* worker = current_worker();
+  if (!worker || !deque_push(&worker->deque, task)) {
+    pthread_mutex_lock(&sched.lock);
+    task->next = NULL;
+    if (sched.inject_tail) {
+      sched.inject_tail->next = task;
+    } else {
+      sched.inject_head = task;
+    }
+    sched.inject_tail = task;
+    atomic_fetch_add(&sched.injected, 1);
+    pthread_mutex_unlock(&sched.lock);
+  }
+  notify_worker();
+}
+
+static husk_task* take_injected(void)
+{
+  if (atomic_load_explicit(&sched.injected, memory_order_acquire) == 0) {
+    return NULL;
+  }
+  pthread_mutex_lock(&sched.lock);
+  husk_task* task = sched.inject_head;
+  if (task) {
+    sched.inject_head = task->next;
+    if (!sched.inject_head) {
+      sched.inject_tail = NULL;
+    }
+    atomic_fetch_sub(&sched.injected, 1);
+  }
+  pthread_mutex_unlock(&sched.lock);
+  return task;
+}
+
+/* try every other worker once, starting at a random one */
+static husk_task* steal(husk_worker* self)
+{
+  const unsigned count = sched.worker_count;
+  self->rng ^= self->rng << 13;
+  self->rng ^= self->rng >> 7;
+  self->rng ^= self->rng << 17;
+  const unsigned first = (unsigned)(self->rng % count);
+  for (unsigned i = 0; i < count; ++i) {
+    husk_worker* victim = &sched.workers[(first + i) % count];
+    if (victim == self) {
+      continue;
+    }
+    husk_task* task = deque_steal(&victim->deque);
+    if (task) {
+      return task;
+    }
+  }
+  return NULL;
+}
+
+static int work_available(void)
+{
+  if (atomic_load_explicit(&sched.injected, memory_order_relaxed) > 0) {
+    return 1;
+  }
+  for (unsigned i = 0; i < sched.worker_count; ++i) {
+    if (!deque_empty(&sched.workers[i].deque)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static char* take_stack(husk_worker* worker)
+{
+  if (worker->cached_stacks > 0) {
+    return worker->stacks[--worker->cached_stacks];
+  }
+  char* stack = mmap(NULL, HUSK_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (stack == MAP_FAILED) {
+    husk_fatal("out of memory for task stacks");
+  }
+  mprotect(stack, (size_t)sysconf(_SC_PAGESIZE), PROT_NONE);
+  return stack;
+}
+
+static void release_stack(husk_worker* worker, char* stack)
+{
+  if (worker->cached_stacks < HUSK_STACK_CACHE) {
+    worker->stacks[worker->cached_stacks++] = stack;
+  } else {
+    munmap(stack, HUSK_STACK_SIZE);
+  }
+}
+
+/* first frame of every task */
+static void task_main(void)
+{
+  husk_task* task = current_worker()->current;
+  task->entry(task->env);
+
+  /* the task may have moved to another worker while it was parked */
+  husk_worker* worker = current_worker();
+  worker->after = AFTER_EXIT;
+  husk_switch_context(&task->context, &worker->scheduler);
+  abort();  /* a finished task is never resumed */
+}
+
+static void run_task(husk_worker* worker, husk_task* task)
+{
+  if (!task->stack) {
+    task->stack = take_stack(worker);
+    init_context(&task->context, task->stack, task_main);
+  }
+  worker->current = task;
+  husk_switch_context(&worker->scheduler, &task->context);
+  worker->current = NULL;
+
+  if (worker->after == AFTER_PARK) {
+    pthread_mutex_unlock(worker->unlock);
+    return;
+  }
+  release_stack(worker, task->stack);
+  free(task);
+  /* live first: whoever sees active at 0 then sees this task gone */
+  const long live = atomic_fetch_sub(&sched.live, 1) - 1;
+  atomic_fetch_sub(&sched.active, 1);
+  if (live == 0) {
+    pthread_mutex_lock(&sched.lock);
+    pthread_cond_broadcast(&sched.done);
+    pthread_mutex_unlock(&sched.lock);
+  }
+}
+
+/* sleep until there may be work; returns 0 once the scheduler stops */
+static int worker_idle(void)
+{
+  husk_flush();  /* what finished tasks printed goes out before the worker waits */
+  pthread_mutex_lock(&sched.lock);
+  atomic_fetch_add(&sched.sleepers, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  int keep_running = 1;
+  if (!work_available()) {
+    if (sched.stopping) {
+      keep_running = 0;
+    } else {
+      pthread_cond_wait(&sched.wake, &sched.lock);
+    }
+  }
+  atomic_fetch_sub(&sched.sleepers, 1);
+  pthread_mutex_unlock(&sched.lock);
+  return keep_running;
+}
+
+static void* worker_main(void* arg)
+{
+  husk_worker* worker = arg;
+  tls_worker = worker;
+  for (;;) {
+    husk_task* task = deque_pop(&worker->deque);
+    if (!task) {
+      task = take_injected();
+    }
+    if (!task) {
+      task = steal(worker);
+    }
+    if (task) {
+      run_task(worker, task);
+    } else if (!worker_idle()) {
+      break;
+    }
+  }
+  husk_flush();
+  return NULL;
+}
+
+/* HUSK_THREADS, or one worker per online core */
+static unsigned worker_count(void)
+{
+  const char* value = getenv("HUSK_THREADS");
+  long count = value ? strtol(value, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+  if (count < 1) {
+    count = 1;
+  }
+  return count > HUSK_MAX_WORKERS ? HUSK_MAX_WORKERS : (unsigned)count;
+}
+
+static void shutdown_at_exit(void)
+{
+  if (husk_shutdown() > 0) {
+    husk_fatal("deadlock: spawned tasks are blocked on channels forever");
+  }
+}
+
+/* start the workers on the first spawn (again after a husk_shutdown) */
+static void start_scheduler(void)
+{
+  if (atomic_load_explicit(&sched.running, memory_order_acquire)) {
+    return;
+  }
+  pthread_mutex_lock(&sched.start_lock);
+  if (!atomic_load_explicit(&sched.running, memory_order_relaxed)) {
+    static int exit_registered;
+    if (!exit_registered) {
+      exit_registered = 1;
+      atexit(shutdown_at_exit);
+    }
+
+    const unsigned count = worker_count();
+    husk_worker* workers = aligned_alloc(64, ((sizeof(husk_worker) * count + 63) / 64) * 64);
+    if (!workers) {
+      husk_fatal("out of memory starting the scheduler");
+    }
+    memset(workers, 0, sizeof(husk_worker) * count);
+    sched.workers = workers;
+    sched.worker_count = count;
+    sched.stopping = 0;
+    for (unsigned i = 0; i < count; ++i) {
+      workers[i].rng = 0x9E3779B97F4A7C15ull * (i + 1);
+      if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+        husk_fatal("cannot start scheduler threads");
+      }
+    }
+    atomic_store_explicit(&sched.running, 1, memory_order_release);
+  }
+  pthread_mutex_unlock(&sched.start_lock);
+}
+
+void husk_spawn(void (*entry)(void*), const void* env, size_t env_size)
+{
+  husk_flush();  /* what the spawner printed comes before anything the task prints */
+  start_scheduler();
+
+  husk_task* task = malloc(sizeof(husk_task) + env_size);
+  if (!task) {
+    husk_fatal("out of memory spawning a task");
+  }
+  task->entry = entry;
+  task->stack = NULL;
+  memcpy(task->env, env, env_size);
+
+  atomic_fetch_add(&sched.live, 1);
+  atomic_fetch_add(&sched.active, 1);
+  make_runnable(task);
+}
+
+/* deadline `ms` from now for pthread_cond_timedwait */
+static struct timespec deadline_after(long ms)
+{
+  struct timespec when;
+  clock_gettime(CLOCK_REALTIME, &when);
+  when.tv_nsec += ms * 1000000;
+  when.tv_sec += when.tv_nsec / 1000000000;
+  when.tv_nsec %= 1000000000;
+  return when;
+}
+
+void husk_park(husk_waiter* waiter, pthread_mutex_t* lock)
+{
+  husk_worker* worker = current_worker();
+  if (worker && worker->current) {
+    /* output must not be reordered if the task resumes on another thread */
+    husk_flush();
+    husk_task* task = worker->current;
+    atomic_fetch_sub(&sched.active, 1);
+    worker->after = AFTER_PARK;
+    worker->unlock = lock;
+    husk_switch_context(&task->context, &worker->scheduler);
+    return;
+  }
+
+  /* An OS thread blocks for real. When no task is active nobody can wake
+   * it any more. */
+  pthread_mutex_unlock(lock);
+  pthread_mutex_lock(&sched.parking_lock);
+  while (!waiter->woken) {
+    const struct timespec deadline = deadline_after(HUSK_DEADLOCK_POLL_MS);
+    pthread_cond_timedwait(&sched.parking, &sched.parking_lock, &deadline);
+    if (!waiter->woken && atomic_load(&sched.active) == 0) {
+      pthread_mutex_unlock(&sched.parking_lock);
+      if (main_exit) {
+        /* the waiter stays on its list; nothing can wake it any more */
+        atomic_store(&sched.main_blocked, 1);
+        longjmp(*main_exit, 1);
+      }
+      husk_fatal("deadlock: main is blocked on a channel and no task can run");
+    }
+  }
+  pthread_mutex_unlock(&sched.parking_lock);
+}
+
+void husk_wake(husk_waiter* waiter)
+{
+  husk_task* task = waiter->task;
+  if (task) {
+    atomic_fetch_add(&sched.active, 1);
+    make_runnable(task);
+    return;
+  }
+  pthread_mutex_lock(&sched.parking_lock);
+  waiter->woken = 1;
+  pthread_cond_broadcast(&sched.parking);
+  pthread_mutex_unlock(&sched.parking_lock);
+}
+
+int husk_run_main(int (*main_fn)(void))
+{
+  jmp_buf exit_point;
+  if (setjmp(exit_point)) {
+    main_exit = NULL;
+    return 0;
+  }
+  main_exit = &exit_point;
+  const int exit_code = main_fn();
+  main_exit = NULL;
+  return exit_code;
+}
+
+long husk_shutdown(void)
+{
+  long blocked = atomic_exchange(&sched.main_blocked, 0);
+  pthread_mutex_lock(&sched.start_lock);
+  if (atomic_load_explicit(&sched.running, memory_order_relaxed)) {
+    pthread_mutex_lock(&sched.lock);
+    while (atomic_load(&sched.live) > 0) {
+      const struct timespec deadline = deadline_after(HUSK_DEADLOCK_POLL_MS);
+      pthread_cond_timedwait(&sched.done, &sched.lock, &deadline);
+      /* with main here, only an active task can wake or spawn another */
+      if (atomic_load(&sched.active) == 0) {
+        blocked += atomic_load(&sched.live);
+        break;
+      }
+    }
+    sched.stopping = 1;
+    pthread_cond_broadcast(&sched.wake);
+    pthread_mutex_unlock(&sched.lock);
+
+    for (unsigned i = 0; i < sched.worker_count; ++i) {
+      pthread_join(sched.workers[i].thread, NULL);
+    }
+    for (unsigned i = 0; i < sched.worker_count; ++i) {
+      while (sched.workers[i].cached_stacks > 0) {
+        munmap(sched.workers[i].stacks[--sched.workers[i].cached_stacks], HUSK_STACK_SIZE);
+      }
+    }
+    free(sched.workers);
+    sched.workers = NULL;
+    sched.worker_count = 0;
+
+    /* blocked tasks are abandoned and may still point into their channels */
+    if (blocked == 0) {
+      husk_free_channels();
+    }
+    atomic_store(&sched.live, 0);
+    atomic_store(&sched.active, 0);
+    atomic_store_explicit(&sched.running, 0, memory_order_release);
+  }
+  pthread_mutex_unlock(&sched.start_lock);
+  husk_flush();
+  return blocked;
+}
@@ -1,17 +1,20 @@
 #pragma once
 #include "lexer.hpp"
+#include "token_buffer.hpp"
 #include "error_reporting.hpp"
+#include "types.hpp"
 #include <print>
 #include <variant>
 #include <vector>
-#include <memory>
 #include <string>
 #include <algorithm>
+#include <llvm/ADT/DenseSet.h>
 
 using namespace std;
 
-// forward declaration for recursive structure
-struct ASTExpr;
+// node handles: 32-bit indices into the program's ASTArena
+using ExprId = uint32_t;
+using StmtId = uint32_t;
 
 // primary expression - literal or identifier
 struct ASTPrimaryExpr {
@@ -19,61 +22,269 @@ struct ASTPrimaryExpr {
   optional<Token> ident;      // variable like x
 };
 
+// what a binary node computes. The shift forms have no syntax of their
+// own; the fold pass rewrites multiplications and divisions by powers of
+// two into them, with the shift amount as the right operand.
+enum class BinaryOp : uint8_t
+{
+  add,
+  sub,
+  mul,
+  div,
+  shl,       // x * 2^k
+  div_pow2,  // x / 2^k, rounding toward zero like div
+  lt,        // comparisons give 1 or 0
+  le,
+  gt,
+  ge,
+  eq,
+  ne
+};
+
+// helper to map an operator token onto its operation
+inline BinaryOp binary_op_for(TokenType type)
+{
+  switch (type) {
+    case TokenType::plus: return BinaryOp::add;
+    case TokenType::minus: return BinaryOp::sub;
+    case TokenType::star: return BinaryOp::mul;
+    case TokenType::lt: return BinaryOp::lt;
+    case TokenType::lt_eq: return BinaryOp::le;
+    case TokenType::gt: return BinaryOp::gt;
+    case TokenType::gt_eq: return BinaryOp::ge;
+    case TokenType::eq_eq: return BinaryOp::eq;
+    case TokenType::not_eq_: return BinaryOp::ne;
+    default: return BinaryOp::div;
+  }
+}
+
+inline bool is_comparison(BinaryOp op)
+{
+  return op >= BinaryOp::lt;
+}
+
+inline bool is_comparison_token(TokenType type)
+{
+  switch (type) {
+    case TokenType::lt:
+    case TokenType::lt_eq:
+    case TokenType::gt:
+    case TokenType::gt_eq:
+    case TokenType::eq_eq:
+    case TokenType::not_eq_:
+      return true;
+    default:
+      return false;
+  }
+}
+
 // binary operation - supports chaining
 struct ASTBinaryExpr {
-  ASTPrimaryExpr lhs;
-  Token op;                        // operator (+, -, *, /)
-  shared_ptr<ASTExpr> rhs;   // right side (can be another expression)
+  ExprId lhs;
+  Token op;                        // operator (+, -, *, / or a comparison)
+  ExprId rhs;                      // right side
+  BinaryOp kind;                   // operation, from op unless folded
+};
+
+// channel<int>() or channel<int>(capacity): a new channel of int values
+struct ASTChannelExpr {
+  Token keyword;
+  optional<ExprId> capacity;  // CodeGen's default when omitted
+};
+
+// ch.receive(): the next value sent on a channel, waiting for one
+struct ASTReceiveExpr {
+  Token channel;
+};
+
+// array literal: [a, b, c], or [value; count] for count copies of value
+struct ASTArrayExpr {
+  Token bracket;
+  vector<ExprId> elements;  // the one value when count is set
+  optional<Token> count;    // an integer literal
+};
+
+// a.len(): the number of elements of an array or slice
+struct ASTLenExpr {
+  ExprId array;
+};
+
+// a[index]: one element, checked against the length
+struct ASTIndexExpr {
+  ExprId array;
+  ExprId index;
+  Token bracket;
+};
+
+// a[start..end]: the elements [start, end) as a slice sharing a's storage;
+// start defaults to 0 and end to the length
+struct ASTSliceExpr {
+  ExprId array;
+  optional<ExprId> start;
+  optional<ExprId> end;
+  Token bracket;
+};
+
+// i32(x), i64(x) or int(x): x converted to the named width, wrapping
+// when it narrows
+struct ASTConvertExpr {
+  Token type_name;
+  ExprId operand;
+  TypeKind target;
 };
 
-// expression can be primary or binary operation
+// expression can be primary, binary operation, a channel, an array
+// operation or a conversion; `type` is filled in by the TypeChecker
 struct ASTExpr {
-  variant<ASTPrimaryExpr, ASTBinaryExpr> var;
+  variant<ASTPrimaryExpr, ASTBinaryExpr, ASTChannelExpr, ASTReceiveExpr, ASTArrayExpr, ASTLenExpr, ASTIndexExpr,
+          ASTSliceExpr, ASTConvertExpr> var;
+  Type type;
 };
 
-// let statement: let x = expr;
+// declared type of a let: int, i32 or i64, or []T or [N]T for arrays of them
+struct TypeAnnotation {
+  Token name;                // the element type's name, for diagnostics
+  Type type;
+  optional<int64_t> length;  // N of [N]T
+};
+
+// let statement: let x = expr; or let mut x = expr;, either with an
+// optional type as in let x: i32 = expr;
 struct ASTLetStmt {
   Token ident;
-  ASTExpr expr;
+  ExprId expr;
+  bool is_mutable = false;
+  optional<TypeAnnotation> annotation;
+};
+
+// assignment to a mutable variable: x = expr;
+struct ASTAssignStmt {
+  Token ident;
+  ExprId expr;
+};
+
+// element assignment: a[index] = expr; through a let mut binding
+struct ASTStoreStmt {
+  Token array;
+  ExprId index;
+  ExprId expr;
 };
 
 // print statement: print(expr);
 struct ASTPrintStmt {
-  ASTExpr expr;
+  ExprId expr;
 };
 
 // expression statement: just an expression followed by ;
 struct ASTExprStmt {
-  ASTExpr expr;
+  ExprId expr;
 };
 
 // return statement: return expr;
 struct ASTReturnStmt {
-  ASTExpr expr;
+  ExprId expr;
+};
+
+// send statement: ch.send(expr);
+struct ASTSendStmt {
+  Token channel;
+  ExprId expr;
+};
+
+// spawn statement: spawn f(); or spawn { statements }; runs concurrently as a task
+struct ASTSpawnStmt {
+  Token keyword;
+  optional<Token> function;  // spawn f();
+  vector<StmtId> body;       // spawn { ... }; sees the enclosing immutable lets by value
+};
+
+// while loop: while condition { statements }; runs while the condition is non-zero
+struct ASTWhileStmt {
+  ExprId condition;
+  vector<StmtId> body;
 };
 
-// statement can be one of: let, print, expression, or return
+// counted loop: for i in start..end { statements }; i takes each value of
+// the half-open range in turn and is immutable in the body, and end is
+// evaluated once before the first iteration
+struct ASTForStmt {
+  Token ident;
+  ExprId start;
+  ExprId end;
+  vector<StmtId> body;
+};
+
+// statement can be one of: let, assignment, element assignment, print, expression, return, send, spawn or a loop
 struct ASTStmt {
-  variant<ASTLetStmt, ASTPrintStmt, ASTExprStmt, ASTReturnStmt> var;
+  variant<ASTLetStmt, ASTAssignStmt, ASTStoreStmt, ASTPrintStmt, ASTExprStmt, ASTReturnStmt, ASTSendStmt,
+          ASTSpawnStmt, ASTWhileStmt, ASTForStmt> var;
+};
+
+// Owns every expression and statement node of a program. Nodes are
+// appended in place and referred to by index, so building the tree never
+// refcounts or copies a subtree.
+class ASTArena
+{
+public:
+  // every expression consumes at least one token and every statement at
+  // least two, so the token count bounds the arena and nodes never move
+  void reserve(size_t token_count)
+  {
+    m_exprs.reserve(token_count);
+    m_stmts.reserve(token_count / 2);
+  }
+
+  template<typename Node>
+  ExprId add_expr(Node node)
+  {
+    m_exprs.push_back(ASTExpr{.var = std::move(node)});
+    return static_cast<ExprId>(m_exprs.size() - 1);
+  }
+
+  template<typename Node>
+  StmtId add_stmt(Node node)
+  {
+    m_stmts.push_back(ASTStmt{.var = std::move(node)});
+    return static_cast<StmtId>(m_stmts.size() - 1);
+  }
+
+  const ASTExpr& expr(ExprId id) const { return m_exprs[id]; }
+  ASTExpr& expr(ExprId id) { return m_exprs[id]; }
+  const ASTStmt& stmt(StmtId id) const { return m_stmts[id]; }
+
+  size_t expr_count() const { return m_exprs.size(); }
+  size_t stmt_count() const { return m_stmts.size(); }
+
+private:
+  vector<ASTExpr> m_exprs;
+  vector<ASTStmt> m_stmts;
 };
 
 // function definition: fn name() { statements }
 struct ASTFunction {
   Token name;
-  vector<ASTStmt> body;
+  vector<StmtId> body;
+  uint32_t first_token = 0;  // token span [first_token, end_token) of the definition
+  uint32_t end_token = 0;
 };
 
-// program is a list of functions
+// program is a list of functions plus the arena their nodes live in
 struct ASTProgram {
+  ASTArena arena;
   vector<ASTFunction> functions;
+  vector<Token> external_spawns;  // spawn targets defined by another input, checked when the inputs are linked
 };
 
 class Parser
 {
 public:
-  inline explicit Parser(vector<Token> tokens, string source, string filename = "") 
-    : m_tokens(move(tokens)), m_error_reporter(move(source), move(filename))
+  // the token buffer is borrowed and must outlive the parser; with
+  // `single_input` every spawned function must be defined in it
+  inline explicit Parser(const TokenBuffer& tokens, const Interner& interner, const ErrorReporter& error_reporter,
+                         bool single_input = true)
+    : m_tokens(tokens), m_interner(interner), m_error_reporter(error_reporter), m_single_input(single_input)
   {
+    m_arena.reserve(m_tokens.size());
   }
 
 private:
@@ -91,7 +302,7 @@ private:
     if (token.type != expected_type) {
       return llvm::createStringError(
         llvm::inconvertibleErrorCode(),
-        m_error_reporter.format_error(format("Expected {}, got {}", context, token_type_to_string(token.type)), token.line, token.column)
+        m_error_reporter.format_error(format("Expected {}, got {}", context, token_type_to_string(token.type)), token.offset)
       );
     }
     
@@ -124,6 +335,24 @@ private:
       case TokenType::print: return "'print'";
       case TokenType::fn: return "'fn'";
       case TokenType::ret: return "'return'";
+      case TokenType::mut: return "'mut'";
+      case TokenType::spawn: return "'spawn'";
+      case TokenType::channel: return "'channel'";
+      case TokenType::dot: return "'.'";
+      case TokenType::lt: return "'<'";
+      case TokenType::gt: return "'>'";
+      case TokenType::while_: return "'while'";
+      case TokenType::for_: return "'for'";
+      case TokenType::in: return "'in'";
+      case TokenType::eq_eq: return "'=='";
+      case TokenType::not_eq_: return "'!='";
+      case TokenType::lt_eq: return "'<='";
+      case TokenType::gt_eq: return "'>='";
+      case TokenType::dot_dot: return "'..'";
+      case TokenType::open_bracket: return "'['";
+      case TokenType::close_bracket: return "']'";
+      case TokenType::comma: return "','";
+      case TokenType::colon: return "':'";
       case TokenType::plus: return "'+'";
       case TokenType::minus: return "'-'";
       case TokenType::star: return "'*'";
@@ -153,9 +382,51 @@ public:
     return ASTPrintStmt{.expr = *expr};
   }
 
+  auto parse_assign() -> Expected<ASTAssignStmt>
+  {
+    // expect: <ident> = <expr> ; with the lookahead already done by the caller
+    
+    const Token ident = consume();
+    consume();
+    
+    auto expr = parse_expr();
+    if (!expr) {
+      return expr.takeError();
+    }
+    
+    return ASTAssignStmt{.ident = ident, .expr = *expr};
+  }
+
+  auto parse_store(ExprId target) -> Expected<ASTStoreStmt>
+  {
+    // expect: <ident> [ <expr> ] = <expr> ; with the target already parsed by the caller
+    
+    const Token eq = consume();
+    const auto* index = get_if<ASTIndexExpr>(&m_arena.expr(target).var);
+    const auto* array = index ? get_if<ASTPrimaryExpr>(&m_arena.expr(index->array).var) : nullptr;
+    if (!array || !array->ident.has_value()) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        m_error_reporter.format_error("Can only assign to a variable or to an element of one, like a[i]", eq.offset)
+      );
+    }
+    
+    auto expr = parse_expr();
+    if (!expr) {
+      return expr.takeError();
+    }
+    
+    return ASTStoreStmt{.array = *array->ident, .index = index->index, .expr = *expr};
+  }
+
   auto parse_let() -> Expected<ASTLetStmt>
   {
-    // expect: let <ident> = <expr> ;
+    // expect: let [mut] <ident> [: <type>] = <expr> ;
+    
+    const bool is_mutable = peek_type() == TokenType::mut;
+    if (is_mutable) {
+      consume();
+    }
     
     auto ident_result = expect_token(TokenType::ident, "identifier after 'let'");
     if (!ident_result) {
@@ -163,7 +434,17 @@ public:
     }
     Token ident = *ident_result;
     
-    if (auto err = expect_and_consume(TokenType::eq, "'=' after identifier")) {
+    optional<TypeAnnotation> annotation;
+    if (peek_type() == TokenType::colon) {
+      consume();
+      auto type = parse_type_annotation();
+      if (!type) {
+        return type.takeError();
+      }
+      annotation = *type;
+    }
+    
+    if (auto err = expect_and_consume(TokenType::eq, annotation ? "'=' after type" : "'=' after identifier")) {
       return std::move(err);
     }
     
@@ -172,71 +453,474 @@ public:
       return expr.takeError();
     }
     
-    return ASTLetStmt{.ident = ident, .expr = *expr};
+    return ASTLetStmt{.ident = ident, .expr = *expr, .is_mutable = is_mutable, .annotation = annotation};
+  }
+
+  auto parse_type_annotation() -> Expected<TypeAnnotation>
+  {
+    // expect: <name> or [ [<int_lit>] ] <name>, with the ':' already consumed
+    
+    const bool is_array = peek_type() == TokenType::open_bracket;
+    optional<int64_t> length;
+    if (is_array) {
+      consume();
+      if (peek_type() == TokenType::int_lit) {
+        length = consume().value();
+      }
+      if (auto err = expect_and_consume(TokenType::close_bracket, "] in array type")) {
+        return std::move(err);
+      }
+    }
+    
+    auto name = expect_token(TokenType::ident, is_array ? "element type after ']'" : "type after ':'");
+    if (!name) {
+      return name.takeError();
+    }
+    const auto width = integer_type_named(m_interner.name(name->symbol));
+    if (!width) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        m_error_reporter.format_error(format("Unknown type '{}' (expected int, i32 or i64)", m_interner.name(name->symbol)),
+                                      name->offset)
+      );
+    }
+    
+    return TypeAnnotation{.name = *name, .type = is_array ? Type::array_of(*width) : Type::integer(*width), .length = length};
+  }
+
+  auto parse_send() -> Expected<ASTSendStmt>
+  {
+    // expect: <ident> . send ( <expr> ) with the lookahead already done by the caller
+    
+    const Token channel = consume();
+    consume();
+    consume();
+    
+    if (auto err = expect_and_consume(TokenType::open_paren, "( after 'send'")) {
+      return std::move(err);
+    }
+    
+    auto expr = parse_expr();
+    if (!expr) {
+      return expr.takeError();
+    }
+    
+    if (auto err = expect_and_consume(TokenType::close_paren, ")")) {
+      return std::move(err);
+    }
+    
+    return ASTSendStmt{.channel = channel, .expr = *expr};
+  }
+
+  auto parse_spawn(Token keyword) -> Expected<ASTSpawnStmt>
+  {
+    // expect: spawn <ident> ( ) or spawn { statements }
+    
+    if (peek_type() == TokenType::open_curly) {
+      consume();
+      vector<StmtId> body = parse_block();
+      if (auto err = expect_and_consume(TokenType::close_curly, "} to end spawn block")) {
+        return std::move(err);
+      }
+      return ASTSpawnStmt{.keyword = keyword, .body = move(body)};
+    }
+    
+    auto function = expect_token(TokenType::ident, "function name or '{' after 'spawn'");
+    if (!function) {
+      return function.takeError();
+    }
+    
+    if (auto err = expect_and_consume(TokenType::open_paren, "(")) {
+      return std::move(err);
+    }
+    
+    if (auto err = expect_and_consume(TokenType::close_paren, ") (arguments not yet supported)")) {
+      return std::move(err);
+    }
+    
+    return ASTSpawnStmt{.keyword = keyword, .function = *function};
+  }
+
+  auto parse_while() -> Expected<ASTWhileStmt>
+  {
+    // expect: while <expr> { statements }
+    
+    auto condition = parse_expr();
+    if (!condition) {
+      return condition.takeError();
+    }
+    
+    if (auto err = expect_and_consume(TokenType::open_curly, "{ to start loop body")) {
+      return std::move(err);
+    }
+    vector<StmtId> body = parse_block();
+    if (auto err = expect_and_consume(TokenType::close_curly, "} to end loop body")) {
+      return std::move(err);
+    }
+    
+    return ASTWhileStmt{.condition = *condition, .body = move(body)};
+  }
+
+  auto parse_for() -> Expected<ASTForStmt>
+  {
+    // expect: for <ident> in <expr> .. <expr> { statements }
+    
+    auto ident = expect_token(TokenType::ident, "identifier after 'for'");
+    if (!ident) {
+      return ident.takeError();
+    }
+    
+    if (auto err = expect_and_consume(TokenType::in, "'in' after loop variable")) {
+      return std::move(err);
+    }
+    
+    auto start = parse_expr();
+    if (!start) {
+      return start.takeError();
+    }
+    
+    if (auto err = expect_and_consume(TokenType::dot_dot, "'..' in range")) {
+      return std::move(err);
+    }
+    
+    auto end = parse_expr();
+    if (!end) {
+      return end.takeError();
+    }
+    
+    if (auto err = expect_and_consume(TokenType::open_curly, "{ to start loop body")) {
+      return std::move(err);
+    }
+    vector<StmtId> body = parse_block();
+    if (auto err = expect_and_consume(TokenType::close_curly, "} to end loop body")) {
+      return std::move(err);
+    }
+    
+    return ASTForStmt{.ident = *ident, .start = *start, .end = *end, .body = move(body)};
+  }
+
+  // Parse an operand with more to it than a literal or an identifier:
+  // channel<int>(capacity), or an identifier, array literal or conversion
+  // followed by any run of [index], [start..end] and .method(). The caller
+  // has seen its first token, or an identifier and the '.', '[' or '('
+  // after it.
+  auto parse_compound_operand() -> Expected<ExprId>
+  {
+    if (peek_type() == TokenType::channel) {
+      return parse_channel_new();
+    }
+    
+    Expected<ExprId> operand = peek_type() == TokenType::open_bracket  ? parse_array_literal()
+                               : peek_type(1) == TokenType::open_paren ? parse_conversion()
+                                                                       : Expected<ExprId>(m_arena.add_expr(ASTPrimaryExpr{.ident = consume()}));
+    while (operand && (peek_type() == TokenType::open_bracket || peek_type() == TokenType::dot)) {
+      operand = peek_type() == TokenType::open_bracket ? parse_index(*operand) : parse_method_call(*operand);
+    }
+    return operand;
+  }
+
+  // parse i32(x), i64(x) or int(x); the caller has seen the type name and the '('
+  auto parse_conversion() -> Expected<ExprId>
+  {
+    const Token name = consume();
+    const auto width = integer_type_named(m_interner.name(name.symbol));
+    if (!width) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        m_error_reporter.format_error(format("'{}' is not a type; only conversions like i64(x) can be called in an expression",
+                                             m_interner.name(name.symbol)), name.offset)
+      );
+    }
+    consume();
+    
+    auto operand = parse_expr();
+    if (!operand) {
+      return operand.takeError();
+    }
+    if (auto err = expect_and_consume(TokenType::close_paren, ") to end conversion")) {
+      return std::move(err);
+    }
+    return m_arena.add_expr(ASTConvertExpr{.type_name = name, .operand = *operand, .target = *width});
+  }
+
+  // parse .receive() on a channel variable or .len() on an array; the caller has seen the '.'
+  auto parse_method_call(ExprId object) -> Expected<ExprId>
+  {
+    const Token dot = consume();
+    
+    auto method = expect_token(TokenType::ident, "method name after '.'");
+    if (!method) {
+      return method.takeError();
+    }
+    const auto name = m_interner.name(method->symbol);
+    if (name != "receive" && name != "len") {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        m_error_reporter.format_error(name == "send" ? string("'send' is a statement, not an expression")
+                                                     : format("Unknown method '{}' (channels have 'send' and 'receive', arrays 'len')", name),
+                                      method->offset)
+      );
+    }
+    
+    if (auto err = expect_and_consume(TokenType::open_paren, format("( after '{}'", name))) {
+      return std::move(err);
+    }
+    if (auto err = expect_and_consume(TokenType::close_paren, ")")) {
+      return std::move(err);
+    }
+    if (name == "len") {
+      return m_arena.add_expr(ASTLenExpr{.array = object});
+    }
+    
+    const auto* channel = get_if<ASTPrimaryExpr>(&m_arena.expr(object).var);
+    if (!channel || !channel->ident.has_value()) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        m_error_reporter.format_error("Expected a channel variable before '.receive()'", dot.offset)
+      );
+    }
+    return m_arena.add_expr(ASTReceiveExpr{.channel = *channel->ident});
+  }
+
+  // parse channel<int>(capacity); the caller has seen 'channel'
+  auto parse_channel_new() -> Expected<ExprId>
+  {
+    const Token keyword = consume();
+    if (auto err = expect_and_consume(TokenType::lt, "'<' after 'channel'")) {
+      return std::move(err);
+    }
+    
+    auto element = expect_token(TokenType::ident, "element type after 'channel<'");
+    if (!element) {
+      return element.takeError();
+    }
+    if (m_interner.name(element->symbol) != "int") {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        m_error_reporter.format_error(format("Unsupported channel element type '{}' (only 'int')",
+                                             m_interner.name(element->symbol)), element->offset)
+      );
+    }
+    
+    if (auto err = expect_and_consume(TokenType::gt, "'>' after channel element type")) {
+      return std::move(err);
+    }
+    if (auto err = expect_and_consume(TokenType::open_paren, "( after 'channel<int>'")) {
+      return std::move(err);
+    }
+    
+    optional<ExprId> capacity;
+    if (peek_type() != TokenType::close_paren) {
+      auto expr = parse_expr();
+      if (!expr) {
+        return expr.takeError();
+      }
+      capacity = *expr;
+    }
+    
+    if (auto err = expect_and_consume(TokenType::close_paren, ")")) {
+      return std::move(err);
+    }
+    return m_arena.add_expr(ASTChannelExpr{.keyword = keyword, .capacity = capacity});
+  }
+
+  // parse [a, b, c] or [value; count]; the caller has seen the '['
+  auto parse_array_literal() -> Expected<ExprId>
+  {
+    const Token bracket = consume();
+    vector<ExprId> elements;
+    
+    auto first = parse_expr();
+    if (!first) {
+      return first.takeError();
+    }
+    elements.push_back(*first);
+    
+    if (peek_type() == TokenType::semi) {
+      consume();
+      auto count = expect_token(TokenType::int_lit, "element count after ';'");
+      if (!count) {
+        return count.takeError();
+      }
+      if (auto err = expect_and_consume(TokenType::close_bracket, "] to end array literal")) {
+        return std::move(err);
+      }
+      return m_arena.add_expr(ASTArrayExpr{.bracket = bracket, .elements = move(elements), .count = *count});
+    }
+    
+    // a trailing ',' is allowed
+    while (peek_type() == TokenType::comma && peek_type(1) != TokenType::close_bracket) {
+      consume();
+      auto element = parse_expr();
+      if (!element) {
+        return element.takeError();
+      }
+      elements.push_back(*element);
+    }
+    if (peek_type() == TokenType::comma) {
+      consume();
+    }
+    
+    if (auto err = expect_and_consume(TokenType::close_bracket, "] to end array literal")) {
+      return std::move(err);
+    }
+    return m_arena.add_expr(ASTArrayExpr{.bracket = bracket, .elements = move(elements)});
+  }
+
+  // parse [index] or [start..end] after an array operand
+  auto parse_index(ExprId array) -> Expected<ExprId>
+  {
+    const Token bracket = consume();
+    
+    optional<ExprId> start;
+    if (peek_type() != TokenType::dot_dot) {
+      auto index = parse_expr();
+      if (!index) {
+        return index.takeError();
+      }
+      if (peek_type() != TokenType::dot_dot) {
+        if (auto err = expect_and_consume(TokenType::close_bracket, "] to end index")) {
+          return std::move(err);
+        }
+        return m_arena.add_expr(ASTIndexExpr{.array = array, .index = *index, .bracket = bracket});
+      }
+      start = *index;
+    }
+    consume();
+    
+    optional<ExprId> end;
+    if (peek_type() != TokenType::close_bracket) {
+      auto expr = parse_expr();
+      if (!expr) {
+        return expr.takeError();
+      }
+      end = *expr;
+    }
+    
+    if (auto err = expect_and_consume(TokenType::close_bracket, "] to end slice")) {
+      return std::move(err);
+    }
+    return m_arena.add_expr(ASTSliceExpr{.array = array, .start = start, .end = end, .bracket = bracket});
   }
 
   // parse a primary expression (literal or identifier)
   optional<ASTPrimaryExpr> parse_primary()
   {
-    if (peek().has_value() && peek().value().type == TokenType::int_lit)
+    if (peek_type() == TokenType::int_lit)
     {
       return ASTPrimaryExpr{.int_lit = consume()};
     }
-    else if (peek().has_value() && peek().value().type == TokenType::ident)
+    else if (peek_type() == TokenType::ident)
     {
       return ASTPrimaryExpr{.ident = consume()};
     }
     return {};
   }
 
-  // helper to check if token is a binary operator
-  bool is_binary_operator(TokenType type) const
+  // binding strength of an infix operator; 0 for tokens that end an expression
+  static int precedence(TokenType type)
   {
+    if (is_comparison_token(type)) {
+      return 1;
+    }
     switch (type) {
       case TokenType::plus:
       case TokenType::minus:
+        return 2;
       case TokenType::star:
       case TokenType::fslash:
-        return true;
+        return 3;
       default:
-        return false;
+        return 0;
     }
   }
 
-  // parse expression with support for chaining (left-associative)
-  auto parse_expr() -> Expected<ASTExpr>
+  // Parse an expression with precedence climbing: * and / bind tighter than
+  // + and -, all four are left-associative, and parentheses nest. A
+  // comparison binds loosest of all and does not chain: `a < b < c` is an
+  // error, `(a < b) < c` compares the 0 or 1 of the first. The loop
+  // keeps its state on explicit stacks, one level per open parenthesis, so
+  // neither the nesting nor the length of an expression grows the call stack.
+  //
+  // Runs of + and - become a balanced tree of signed terms and runs of * a
+  // balanced product, so `a + b + ... + z` is log2(n) deep instead of n and
+  // the generated adds form independent chains. Integer arithmetic wraps,
+  // so regrouping a run computes the same value. / is not associative and
+  // keeps its left-deep shape. Every node is added after its operands.
+  auto parse_expr() -> Expected<ExprId>
   {
-    // Parse first operand
-    optional<ASTPrimaryExpr> primary = parse_primary();
-    if (!primary.has_value()) {
-      if (peek().has_value()) {
-        Token t = peek().value();
-        return llvm::createStringError(llvm::inconvertibleErrorCode(), m_error_reporter.format_error("Expected expression", t.line, t.column));
+    const size_t base = m_levels.size();
+    m_levels.push_back(ExprLevel{.first_term = m_terms.size(), .first_factor = m_factors.size()});
+
+    while (true) {
+      // operand position: a literal, an identifier, a channel or array
+      // operation, a conversion or a parenthesized expression
+      if (peek_type() == TokenType::open_paren) {
+        consume();
+        m_levels.push_back(ExprLevel{.first_term = m_terms.size(), .first_factor = m_factors.size()});
+        continue;
       }
-      return llvm::createStringError(llvm::inconvertibleErrorCode(), m_error_reporter.format_error("Expected expression"));
-    }
-    
-    // check for operator
-    if (peek().has_value() && is_binary_operator(peek().value().type)) {
-      Token op = consume();
-      
-      // Recursively parse right side (supports chaining: x + y - z)
-      Expected<ASTExpr> rhs = parse_expr();
-      if (!rhs) {
-        return rhs.takeError();
+      if (peek_type() == TokenType::channel || peek_type() == TokenType::open_bracket ||
+          (peek_type() == TokenType::ident && (peek_type(1) == TokenType::dot || peek_type(1) == TokenType::open_bracket ||
+                                               peek_type(1) == TokenType::open_paren))) {
+        auto operand = parse_compound_operand();
+        if (!operand) {
+          drop_levels(base);
+          return operand.takeError();
+        }
+        add_factor(*operand);
       }
-      
-      return ASTExpr{
-        .var = ASTBinaryExpr{
-          .lhs = primary.value(),
-          .op = op,
-          .rhs = make_shared<ASTExpr>(*rhs)
+      else {
+        optional<ASTPrimaryExpr> primary = parse_primary();
+        if (!primary.has_value()) {
+          return expression_error(base, "Expected expression");
+        }
+        add_factor(m_arena.add_expr(primary.value()));
+      }
+
+      // operator position: an operator, a ')' closing a level, or the end
+      while (true) {
+        const TokenType type = peek_type().value_or(TokenType::semi);
+        auto& level = m_levels.back();
+
+        if (type == TokenType::star) {
+          level.factor_offset = consume().offset;
+          break;
+        }
+        if (type == TokenType::fslash) {
+          // everything so far in this term is the dividend
+          const ExprId dividend = end_product(level);
+          m_factors.push_back(Operand{.id = dividend});
+          level.divide = consume();
+          break;
+        }
+        if (type == TokenType::plus || type == TokenType::minus) {
+          end_term(level);
+          level.term_offset = consume().offset;
+          level.negative = type == TokenType::minus;
+          break;
         }
-      };
+        if (is_comparison_token(type)) {
+          if (level.compare.has_value()) {
+            return expression_error(base, "Comparisons do not chain; use parentheses");
+          }
+          // everything so far in this level is the left-hand side
+          end_term(level);
+          level.compare_lhs = end_sum(level);
+          level.compare = consume();
+          level.negative = false;
+          break;
+        }
+        if (m_levels.size() == base + 1) {
+          return end_level();
+        }
+        if (type != TokenType::close_paren) {
+          return expression_error(base, "Expected ')'");
+        }
+        consume();
+        add_factor(end_level());
+      }
     }
-    
-    // no operator, just return primary
-    return ASTExpr{.var = primary.value()};
   }
 
   // helper to expect semicolon after statement
@@ -245,16 +929,13 @@ public:
     return expect_and_consume(TokenType::semi, format("semicolon after {}", context));
   }
 
-  auto parse_statement() -> Expected<ASTStmt>
+  auto parse_statement() -> Expected<StmtId>
   {
-    if (!peek().has_value()) {
+    if (!peek_type().has_value()) {
       return llvm::createStringError(llvm::inconvertibleErrorCode(), m_error_reporter.format_error("Unexpected end of input"));
     }
     
-    Token token = peek().value();
-    TokenType token_type = token.type;
-    
-    switch (token_type) {
+    switch (*peek_type()) {
       case TokenType::let: {
         consume();
         Expected<ASTLetStmt> let_stmt = parse_let();
@@ -265,7 +946,7 @@ public:
         if (auto err = expect_semicolon("let")) {
           return std::move(err);
         }
-        return ASTStmt{.var = *let_stmt};
+        return m_arena.add_stmt(*let_stmt);
       }
       
       case TokenType::print: {
@@ -278,12 +959,12 @@ public:
         if (auto err = expect_semicolon("print")) {
           return std::move(err);
         }
-        return ASTStmt{.var = *print_stmt};
+        return m_arena.add_stmt(*print_stmt);
       }
       
       case TokenType::ret: {
         consume();
-        Expected<ASTExpr> expr = parse_expr();
+        Expected<ExprId> expr = parse_expr();
         if (!expr) {
           return expr.takeError();
         }
@@ -291,22 +972,92 @@ public:
         if (auto err = expect_semicolon("return")) {
           return std::move(err);
         }
-        return ASTStmt{.var = ASTReturnStmt{.expr = *expr}};
+        return m_arena.add_stmt(ASTReturnStmt{.expr = *expr});
       }
       
-      default: {
-        // expression statement
-        Expected<ASTExpr> expr = parse_expr();
-        if (!expr) {
-          return expr.takeError();
+      case TokenType::while_: {
+        consume();
+        Expected<ASTWhileStmt> while_stmt = parse_while();
+        if (!while_stmt) {
+          return while_stmt.takeError();
+        }
+        return m_arena.add_stmt(std::move(*while_stmt));
+      }
+      
+      case TokenType::for_: {
+        consume();
+        Expected<ASTForStmt> for_stmt = parse_for();
+        if (!for_stmt) {
+          return for_stmt.takeError();
+        }
+        return m_arena.add_stmt(std::move(*for_stmt));
+      }
+      
+      case TokenType::spawn: {
+        const Token keyword = consume();
+        Expected<ASTSpawnStmt> spawn_stmt = parse_spawn(keyword);
+        if (!spawn_stmt) {
+          return spawn_stmt.takeError();
+        }
+        
+        if (auto err = expect_semicolon("spawn")) {
+          return std::move(err);
+        }
+        return m_arena.add_stmt(std::move(*spawn_stmt));
+      }
+      
+      case TokenType::ident: {
+        if (peek_type(1) == TokenType::dot && peek_type(2) == TokenType::ident &&
+            m_interner.name(m_tokens[m_index + 2].symbol) == "send") {
+          Expected<ASTSendStmt> send_stmt = parse_send();
+          if (!send_stmt) {
+            return send_stmt.takeError();
+          }
+          
+          if (auto err = expect_semicolon("send")) {
+            return std::move(err);
+          }
+          return m_arena.add_stmt(*send_stmt);
+        }
+        if (peek_type(1) != TokenType::eq) {
+          break;
+        }
+        Expected<ASTAssignStmt> assign_stmt = parse_assign();
+        if (!assign_stmt) {
+          return assign_stmt.takeError();
         }
         
-        if (auto err = expect_semicolon("expression")) {
+        if (auto err = expect_semicolon("assignment")) {
           return std::move(err);
         }
-        return ASTStmt{.var = ASTExprStmt{.expr = *expr}};
+        return m_arena.add_stmt(*assign_stmt);
+      }
+      
+      default:
+        break;
+    }
+    
+    // expression statement, or an element assignment a[i] = expr;
+    Expected<ExprId> expr = parse_expr();
+    if (!expr) {
+      return expr.takeError();
+    }
+    if (peek_type() == TokenType::eq) {
+      Expected<ASTStoreStmt> store_stmt = parse_store(*expr);
+      if (!store_stmt) {
+        return store_stmt.takeError();
+      }
+      
+      if (auto err = expect_semicolon("assignment")) {
+        return std::move(err);
       }
+      return m_arena.add_stmt(*store_stmt);
     }
+    
+    if (auto err = expect_semicolon("expression")) {
+      return std::move(err);
+    }
+    return m_arena.add_stmt(ASTExprStmt{.expr = *expr});
   }
 
   auto parse_function() -> Expected<ASTFunction>
@@ -331,60 +1082,96 @@ public:
       return std::move(err);
     }
     
-    vector<ASTStmt> body;
-    while (peek().has_value() && peek().value().type != TokenType::close_curly) {
-      auto stmt = parse_statement();
-      if (!stmt) {
-        return stmt.takeError();
-      }
-      body.push_back(*stmt);
-    }
+    vector<StmtId> body = parse_block();
     
     if (auto err = expect_and_consume(TokenType::close_curly, "} to end function body")) {
       return std::move(err);
     }
     
-    return ASTFunction{.name = name, .body = body};
+    return ASTFunction{.name = name, .body = move(body), .end_token = static_cast<uint32_t>(m_index)};
   }
 
-  // helper to check if program has a main function
+  // Parse statements up to the '}' that ends a block, which is left for the
+  // caller. A statement that fails is reported and skipped; a 'fn' means
+  // the '}' is missing.
+  auto parse_block() -> vector<StmtId>
+  {
+    vector<StmtId> body;
+    while (peek_type().has_value() && peek_type() != TokenType::close_curly && peek_type() != TokenType::fn &&
+           !too_many_errors()) {
+      const size_t start = m_index;
+      auto stmt = parse_statement();
+      if (!stmt) {
+        report(stmt.takeError());
+        synchronize_statement(start);
+        continue;
+      }
+      body.push_back(*stmt);
+    }
+    return body;
+  }
+
+  // helper to check if program has a main function; the driver requires
+  // one among the inputs it links
   bool has_main_function(const ASTProgram& program) const
   {
     return any_of(program.functions.begin(), program.functions.end(),
-                  [](const ASTFunction& func) { 
-                    return func.name.value == "main"; 
+                  [this](const ASTFunction& func) { 
+                    return m_interner.name(func.name.symbol) == "main"; 
                   });
   }
 
+  // Parse the whole program. Errors are reported to the error reporter and
+  // parsing resumes after them (see synchronize_statement), so one pass
+  // finds every mistake; if there were any, lexical ones included, they
+  // come back together as a single error.
   auto parse() -> Expected<ASTProgram>
   {
     ASTProgram program;
+    llvm::DenseSet<uint32_t> function_names;
     
-    while (peek().has_value()) {
-      if (peek().value().type == TokenType::fn) {
+    while (peek_type().has_value() && !too_many_errors()) {
+      if (peek_type() == TokenType::fn) {
+        const auto first_token = static_cast<uint32_t>(m_index);
         consume();
         auto func = parse_function();
         if (!func) {
-          return func.takeError();
+          report(func.takeError());
+          synchronize_function();
+          continue;
+        }
+        if (!function_names.insert(func->name.symbol).second) {
+          m_error_reporter.report(format("Function '{}' is already defined", m_interner.name(func->name.symbol)), func->name.offset);
+          continue;
         }
-        program.functions.push_back(*func);
+        func->first_token = first_token;
+        program.functions.push_back(move(*func));
       } else {
-        Token t = peek().value();
-        return llvm::createStringError(
-          llvm::inconvertibleErrorCode(), 
-          m_error_reporter.format_error("Expected function definition (top-level statements not allowed)", t.line, t.column)
-        );
+        m_error_reporter.report("Expected function definition (top-level statements not allowed)", peek().value().offset);
+        synchronize_function();
       }
     }
-    
-    if (!has_main_function(program)) {
-      return llvm::createStringError(
-        llvm::inconvertibleErrorCode(), 
-        m_error_reporter.format_error("Program must have a 'main' function")
-      );
+
+    // every spawn f(); names a function of this input, or of another input
+    // when there are several, which the driver checks as it links them
+    for (size_t i = 0; i < m_arena.stmt_count(); ++i) {
+      const auto* spawn = get_if<ASTSpawnStmt>(&m_arena.stmt(static_cast<StmtId>(i)).var);
+      if (!spawn || !spawn->function || function_names.contains(spawn->function->symbol)) {
+        continue;
+      }
+      if (m_single_input) {
+        m_error_reporter.report(format("Spawned function '{}' is not defined", m_interner.name(spawn->function->symbol)),
+                                spawn->function->offset);
+      } else {
+        program.external_spawns.push_back(*spawn->function);
+      }
     }
     
     m_index = 0;
+    if (m_error_reporter.error_count() > 0) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), m_error_reporter.diagnostics());
+    }
+    program.arena = move(m_arena);
     return program;
   }
 
@@ -398,16 +1185,205 @@ private:
     }
     else
     {
-      return m_tokens.at(m_index);
+      return m_tokens[m_index];
+    }
+  }
+
+  // type of the next token, read from the dense type array alone
+  [[nodiscard]] inline optional<TokenType> peek_type(size_t ahead = 0) const
+  {
+    if (m_index + ahead >= m_tokens.size()) {
+      return {};
     }
+    return m_tokens.type(m_index + ahead);
   }
 
   inline Token consume()
   {
-    return m_tokens.at(m_index++);
+    return m_tokens[m_index++];
+  }
+
+  // an operand of a + / - run or of a * run
+  struct Operand {
+    ExprId id;
+    bool negative = false;  // a term that is subtracted
+    uint32_t offset = 0;    // offset of the operator in front of it
+  };
+
+  // one parenthesis level of the expression being parsed; its terms and
+  // factors live on the shared stacks from first_term and first_factor on
+  struct ExprLevel {
+    size_t first_term;
+    size_t first_factor;
+    bool negative = false;       // the next term follows a '-'
+    uint32_t term_offset = 0;    // offset of the operator before the next term
+    uint32_t factor_offset = 0;  // offset of the '*' before the next factor
+    optional<Token> divide;      // a '/' waiting for its divisor
+    optional<Token> compare;     // a comparison waiting for its right-hand side
+    ExprId compare_lhs = 0;
+  };
+
+  // helper to add an operand to the innermost level's current term
+  void add_factor(ExprId id)
+  {
+    auto& level = m_levels.back();
+    if (level.divide.has_value()) {
+      auto& dividend = m_factors.back();
+      dividend.id = m_arena.add_expr(ASTBinaryExpr{.lhs = dividend.id, .op = *level.divide, .rhs = id, .kind = BinaryOp::div});
+      level.divide.reset();
+      return;
+    }
+    m_factors.push_back(Operand{.id = id, .offset = level.factor_offset});
+  }
+
+  // helper to close the current term: its product becomes the next signed term
+  void end_term(ExprLevel& level)
+  {
+    const ExprId product = end_product(level);
+    m_terms.push_back(Operand{.id = product, .negative = level.negative, .offset = level.term_offset});
+  }
+
+  // helper to build the balanced product of the current term's factors
+  ExprId end_product(const ExprLevel& level)
+  {
+    return combine_pairs(m_factors, level.first_factor, [this](Operand lhs, Operand rhs) {
+      return Operand{.id = add_binary(lhs.id, TokenType::star, rhs.offset, rhs.id), .offset = lhs.offset};
+    });
+  }
+
+  // helper to build the balanced sum of a level's signed terms; the first
+  // term is never negative, so neither is the result
+  ExprId end_sum(const ExprLevel& level)
+  {
+    return combine_pairs(m_terms, level.first_term, [this](Operand lhs, Operand rhs) {
+      if (lhs.negative == rhs.negative) {  // a + b, or -(a + b)
+        return Operand{.id = add_binary(lhs.id, TokenType::plus, rhs.offset, rhs.id), .negative = lhs.negative, .offset = lhs.offset};
+      }
+      if (rhs.negative) {  // a - b
+        return Operand{.id = add_binary(lhs.id, TokenType::minus, rhs.offset, rhs.id), .offset = lhs.offset};
+      }
+      // -a + b as (0 - a) + b: b - a would evaluate b first, and operands
+      // such as receives have side effects
+      const ExprId zero = m_arena.add_expr(ASTPrimaryExpr{.int_lit = Token::int_lit(0, lhs.offset)});
+      const ExprId negated = add_binary(zero, TokenType::minus, lhs.offset, lhs.id);
+      return Operand{.id = add_binary(negated, TokenType::plus, rhs.offset, rhs.id), .offset = lhs.offset};
+    });
+  }
+
+  // helper to finish the innermost level and pop it
+  ExprId end_level()
+  {
+    auto& level = m_levels.back();
+    end_term(level);
+    ExprId value = end_sum(level);
+    if (level.compare.has_value()) {
+      value = m_arena.add_expr(ASTBinaryExpr{.lhs = level.compare_lhs, .op = *level.compare, .rhs = value,
+                                             .kind = binary_op_for(level.compare->type)});
+    }
+    m_levels.pop_back();
+    return value;
+  }
+
+  // helper to reduce a stack's operands from `first` on into one balanced
+  // tree by combining neighbours pairwise, round after round
+  template<typename Combine>
+  static ExprId combine_pairs(vector<Operand>& operands, size_t first, Combine combine)
+  {
+    size_t end = operands.size();
+    while (end - first > 1) {
+      size_t out = first;
+      for (size_t i = first; i < end; i += 2) {
+        operands[out++] = i + 1 < end ? combine(operands[i], operands[i + 1]) : operands[i];
+      }
+      end = out;
+    }
+    const ExprId root = operands[first].id;
+    operands.resize(first);
+    return root;
+  }
+
+  ExprId add_binary(ExprId lhs, TokenType type, uint32_t offset, ExprId rhs)
+  {
+    const Token op{.type = type, .offset = offset, .length = 1};
+    return m_arena.add_expr(ASTBinaryExpr{.lhs = lhs, .op = op, .rhs = rhs, .kind = binary_op_for(type)});
+  }
+
+  // helper to collect a parse error; it points at the token the parser stopped on
+  void report(llvm::Error error)
+  {
+    const auto offset = peek().has_value() ? peek().value().offset : ErrorReporter::Diagnostic().offset;
+    m_error_reporter.report({.offset = offset, .text = llvm::toString(std::move(error))});
+  }
+
+  bool too_many_errors() const
+  {
+    return m_error_reporter.error_count() >= MAX_ERRORS;
+  }
+
+  // Panic-mode recovery after a failed statement that started at `start`:
+  // skip to just past the next ';' or past the '}' of a block the statement
+  // opened (a loop whose header failed), or up to the '}' or 'fn' that ends
+  // the enclosing block, and always past at least one token so parsing
+  // moves on.
+  void synchronize_statement(size_t start)
+  {
+    int depth = 0;  // blocks opened since `start` and not yet closed
+    for (size_t i = start; i < m_index; ++i) {
+      depth += m_tokens.type(i) == TokenType::open_curly;
+      depth -= m_tokens.type(i) == TokenType::close_curly;
+    }
+    depth = max(depth, 0);
+    while (peek_type().has_value()) {
+      const auto type = *peek_type();
+      if (type == TokenType::fn || (type == TokenType::close_curly && depth == 0)) {
+        return;
+      }
+      consume();
+      if (type == TokenType::open_curly) {
+        ++depth;
+      } else if (type == TokenType::close_curly) {
+        if (--depth == 0) {
+          return;
+        }
+      } else if (type == TokenType::semi && depth == 0) {
+        return;
+      }
+    }
+  }
+
+  // recovery after a failed function header or a stray top-level token: skip to the next 'fn'
+  void synchronize_function()
+  {
+    while (peek_type().has_value() && peek_type() != TokenType::fn) {
+      consume();
+    }
+  }
+
+  // helper to drop the levels of a failed expression from `base` on
+  void drop_levels(size_t base)
+  {
+    m_terms.resize(m_levels[base].first_term);
+    m_factors.resize(m_levels[base].first_factor);
+    m_levels.resize(base);
+  }
+
+  // helper to drop the levels of a failed expression and report where it stopped
+  llvm::Error expression_error(size_t base, string_view message)
+  {
+    drop_levels(base);
+    if (peek().has_value()) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), m_error_reporter.format_error(message, peek().value().offset));
+    }
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), m_error_reporter.format_error(message));
   }
 
-  const vector<Token> m_tokens;
+  const TokenBuffer& m_tokens;
+  const Interner& m_interner;
+  ASTArena m_arena;
   size_t m_index = 0;
-  ErrorReporter m_error_reporter;
+  const ErrorReporter& m_error_reporter;
+  bool m_single_input;
+  vector<ExprLevel> m_levels;  // expression parser stacks, kept for their capacity
+  vector<Operand> m_terms;
+  vector<Operand> m_factors;
 };
@@ -2,69 +2,248 @@
 
 #include <format>
 #include <print>
-#include <map>
 #include <string_view>
 #include <algorithm>
+#include <numeric>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/CFG.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Value.h>
 #include "ast.hpp"
+#include "symbol_table.hpp"
 
 using namespace std;
 
+// capacity of channel<int>() when none is given
+inline constexpr int64_t DEFAULT_CHANNEL_CAPACITY = 64;
+
+// array literals up to this size get a stack slot, larger ones a heap
+// block, so a function's frame stays small enough for a task's stack
+inline constexpr uint64_t MAX_INLINE_ARRAY_BYTES = 4096;
+
 class CodeGen
 {
 public:
-  CodeGen()
-    : context(make_unique<llvm::LLVMContext>()),
+  explicit CodeGen(const Interner& interner)
+    : interner(interner),
+      context(make_unique<llvm::LLVMContext>()),
       module(make_unique<llvm::Module>("Husk", *context)),
       builder(make_unique<llvm::IRBuilder<>>(*context))
   {
   }
 
 private:
-  // helper to create integer constant
-  llvm::ConstantInt* createInt32(int value) const
+  // helper to create an integer constant of an integer type
+  static llvm::ConstantInt* createInteger(llvm::Type* type, int64_t value)
+  {
+    return llvm::ConstantInt::get(llvm::cast<llvm::IntegerType>(type), value, /*IsSigned=*/true);
+  }
+  
+  // helper to get the LLVM type of a width the TypeChecker resolved; i64
+  // for anything it left unresolved, which CodeGen then reports
+  llvm::IntegerType* getIntegerType(TypeKind width) const
+  {
+    return width == TypeKind::i32 ? llvm::Type::getInt32Ty(*context) : llvm::Type::getInt64Ty(*context);
+  }
+  
+  // the width of lengths, indices and channel values
+  llvm::IntegerType* getLengthType() const
+  {
+    return llvm::Type::getInt64Ty(*context);
+  }
+  
+  // channels, task environments and task entries are opaque pointers
+  llvm::PointerType* getPointerType() const
+  {
+    return llvm::PointerType::getUnqual(*context);
+  }
+  
+  // arrays and slices are both { ptr data, i64 length } values
+  llvm::StructType* getSliceType() const
+  {
+    return llvm::StructType::get(*context, {getPointerType(), getLengthType()});
+  }
+  
+  // helper to name a value's type in diagnostics
+  static string describeType(const llvm::Type* type)
+  {
+    if (type->isPointerTy()) {
+      return "a channel";
+    }
+    return type->isStructTy() ? "an array" : format("i{}", type->getIntegerBitWidth());
+  }
+  
+  // helper to check for an integer where arithmetic, print or an index needs one
+  static auto expectInteger(const llvm::Value* value, string_view what) -> llvm::Error
+  {
+    if (value->getType()->isIntegerTy()) {
+      return llvm::Error::success();
+    }
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   format("Expected an integer {}, got {}", what, describeType(value->getType())));
+  }
+  
+  // helper to check for a value of exactly `type`, like the i64 a channel carries
+  static auto expectType(const llvm::Value* value, const llvm::Type* type, string_view what) -> llvm::Error
+  {
+    if (value->getType() == type) {
+      return llvm::Error::success();
+    }
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   format("Expected {} {}, got {}", describeType(type), what, describeType(value->getType())));
+  }
+  
+  // helper to widen an index, bound or capacity to the i64 of lengths; an
+  // i32 is sign-extended, so a negative one stays out of range
+  llvm::Value* widenToLength(llvm::Value* value)
+  {
+    return builder->CreateSExt(value, getLengthType(), "wide");
+  }
+  
+  // helper to check for an array or slice where indexing needs one
+  static auto expectArray(const llvm::Value* value, string_view what) -> llvm::Error
+  {
+    if (value->getType()->isStructTy()) {
+      return llvm::Error::success();
+    }
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   format("Expected an array {}, got {}", what, describeType(value->getType())));
+  }
+  
+  // helper to pair a data pointer and a length into a slice value
+  llvm::Value* createSlice(llvm::Value* data, llvm::Value* length)
+  {
+    llvm::Value* slice = builder->CreateInsertValue(llvm::PoisonValue::get(getSliceType()), data, 0);
+    return builder->CreateInsertValue(slice, length, 1, "array");
+  }
+  
+  // Helpers to read a slice's fields. Where the slice was built in view,
+  // the inserted value is used directly, so a literal's length stays a
+  // constant that bounds checks fold against.
+  llvm::Value* getArrayData(llvm::Value* array)
+  {
+    if (auto* data = llvm::FindInsertedValue(array, 0)) {
+      return data;
+    }
+    return builder->CreateExtractValue(array, 0, "data");
+  }
+  
+  llvm::Value* getArrayLength(llvm::Value* array)
   {
-    return llvm::ConstantInt::get(*context, llvm::APInt(32, value));
+    if (auto* length = llvm::FindInsertedValue(array, 1)) {
+      return length;
+    }
+    return builder->CreateExtractValue(array, 1, "len");
   }
   
-  // helper to get int32 type
-  llvm::Type* getInt32Type() const
+  // helper to create a mutable variable's alloca at the top of the entry
+  // block, where mem2reg promotes it whatever block declares the variable
+  llvm::AllocaInst* createVariableAlloca(string_view name, llvm::Type* type)
   {
-    return llvm::Type::getInt32Ty(*context);
+    auto& entry = builder->GetInsertBlock()->getParent()->getEntryBlock();
+    llvm::IRBuilder<> entryBuilder(&entry, entry.begin());
+    return entryBuilder.CreateAlloca(type, nullptr, llvm::StringRef(name.data(), name.size()));
   }
   
-  // helper to create alloca for variable
-  llvm::AllocaInst* createVariableAlloca(const string& name)
+  // helper to check the operands of a binary operation: two integers of
+  // the same width, which the TypeChecker has made sure of
+  static auto expectOperands(const llvm::Value* lhs, const llvm::Value* rhs) -> llvm::Error
   {
-    return builder->CreateAlloca(getInt32Type(), nullptr, name.c_str());
+    if (auto err = expectInteger(lhs, "operand")) {
+      return err;
+    }
+    if (auto err = expectInteger(rhs, "operand")) {
+      return err;
+    }
+    return expectType(rhs, lhs->getType(), "operand");
   }
   
-  // helper to generate binary operation
-  auto generateBinaryOp(llvm::Value* lhs, llvm::Value* rhs, TokenType op) -> Expected<llvm::Value*>
+  // helper to generate binary operation; a comparison's 1 or 0 has type `type`
+  auto generateBinaryOp(llvm::Value* lhs, llvm::Value* rhs, BinaryOp op, llvm::Type* type) -> Expected<llvm::Value*>
   {
+    if (auto err = expectOperands(lhs, rhs)) {
+      return std::move(err);
+    }
     switch (op) {
-      case TokenType::plus:
+      case BinaryOp::add:
         return builder->CreateAdd(lhs, rhs, "addtmp");
-      case TokenType::minus:
+      case BinaryOp::sub:
         return builder->CreateSub(lhs, rhs, "subtmp");
-      case TokenType::star:
+      case BinaryOp::mul:
         return builder->CreateMul(lhs, rhs, "multmp");
-      case TokenType::fslash:
+      case BinaryOp::div:
         return builder->CreateSDiv(lhs, rhs, "divtmp");
-      default:
-        return llvm::createStringError(llvm::inconvertibleErrorCode(), "Unsupported binary operator");
+      case BinaryOp::shl:
+        return builder->CreateShl(lhs, rhs, "shltmp");
+      case BinaryOp::div_pow2:
+        return generateDivPow2(lhs, llvm::cast<llvm::ConstantInt>(rhs)->getZExtValue());
+      case BinaryOp::lt:
+      case BinaryOp::le:
+      case BinaryOp::gt:
+      case BinaryOp::ge:
+      case BinaryOp::eq:
+      case BinaryOp::ne:
+        return builder->CreateZExt(builder->CreateICmp(getPredicate(op), lhs, rhs, "cmptmp"), type, "booltmp");
     }
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "Unsupported binary operator");
   }
   
-  // helper to check if variable exists
-  bool variableExists(const string& name) const
+  // helper to map a comparison onto its signed icmp predicate
+  static llvm::CmpInst::Predicate getPredicate(BinaryOp op)
   {
-    return variables.contains(name);
+    switch (op) {
+      case BinaryOp::lt: return llvm::CmpInst::ICMP_SLT;
+      case BinaryOp::le: return llvm::CmpInst::ICMP_SLE;
+      case BinaryOp::gt: return llvm::CmpInst::ICMP_SGT;
+      case BinaryOp::ge: return llvm::CmpInst::ICMP_SGE;
+      case BinaryOp::eq: return llvm::CmpInst::ICMP_EQ;
+      default: return llvm::CmpInst::ICMP_NE;
+    }
   }
-
+  
+  // helper to generate a loop condition as an i1: a comparison at the root
+  // gives its icmp directly, any other value is tested against zero
+  auto generateCondition(ExprId id) -> Expected<llvm::Value*>
+  {
+    const auto* compare = get_if<ASTBinaryExpr>(&arena->expr(id).var);
+    if (compare && is_comparison(compare->kind)) {
+      auto lhs = generateExpr(arena->expr(compare->lhs));
+      if (!lhs) {
+        return lhs.takeError();
+      }
+      auto rhs = generateExpr(arena->expr(compare->rhs));
+      if (!rhs) {
+        return rhs.takeError();
+      }
+      if (auto err = expectOperands(*lhs, *rhs)) {
+        return std::move(err);
+      }
+      return builder->CreateICmp(getPredicate(compare->kind), *lhs, *rhs, "cond");
+    }
+    
+    auto value = generateExpr(arena->expr(id));
+    if (!value) {
+      return value.takeError();
+    }
+    if (auto err = expectInteger(*value, "condition")) {
+      return std::move(err);
+    }
+    return builder->CreateICmpNE(*value, createInteger((*value)->getType(), 0), "cond");
+  }
+  
+  // signed x / 2^k rounding toward zero: add 2^k - 1 to negative x, then shift
+  llvm::Value* generateDivPow2(llvm::Value* lhs, uint64_t shift)
+  {
+    auto* type = lhs->getType();
+    const auto bits = static_cast<int64_t>(type->getIntegerBitWidth());
+    auto* sign = builder->CreateAShr(lhs, createInteger(type, bits - 1), "signtmp");
+    auto* bias = builder->CreateLShr(sign, createInteger(type, bits - static_cast<int64_t>(shift)), "biastmp");
+    auto* biased = builder->CreateAdd(lhs, bias, "biasedtmp");
+    return builder->CreateAShr(biased, createInteger(type, static_cast<int64_t>(shift)), "divtmp");
+  }
+  
 public:
   auto generate_statement(const ASTStmt& stmt) -> llvm::Error
   {
@@ -74,6 +253,12 @@ public:
       if constexpr (is_same_v<T, ASTLetStmt>) {
         return generateLetStatement(arg);
       }
+      else if constexpr (is_same_v<T, ASTAssignStmt>) {
+        return generateAssignStatement(arg);
+      }
+      else if constexpr (is_same_v<T, ASTStoreStmt>) {
+        return generateStoreStatement(arg);
+      }
       else if constexpr (is_same_v<T, ASTPrintStmt>) {
         return generatePrintStatement(arg);
       }
@@ -83,44 +268,143 @@ public:
       else if constexpr (is_same_v<T, ASTReturnStmt>) {
         return generateReturnStatement(arg);
       }
+      else if constexpr (is_same_v<T, ASTSendStmt>) {
+        return generateSendStatement(arg);
+      }
+      else if constexpr (is_same_v<T, ASTSpawnStmt>) {
+        return generateSpawnStatement(arg);
+      }
+      else if constexpr (is_same_v<T, ASTWhileStmt>) {
+        return generateWhileStatement(arg);
+      }
+      else if constexpr (is_same_v<T, ASTForStmt>) {
+        return generateForStatement(arg);
+      }
       
       return llvm::createStringError(llvm::inconvertibleErrorCode(), "Unknown statement type");
     }, stmt.var);
   }
 
 private:
-  // Generate let statement: let x = expr;
+  // Generate let statement: let x = expr; binds x to the value itself, and
+  // only let mut x = expr; gets a stack slot
   auto generateLetStatement(const ASTLetStmt& stmt) -> llvm::Error
   {
-    const auto varName = stmt.ident.value.value_or("");
+    const auto varName = interner.name(stmt.ident.symbol);
     
     // Check if variable already exists in current scope
-    if (variableExists(varName)) {
+    if (variables.declared_in_current_scope(stmt.ident.symbol)) {
       return llvm::createStringError(
         llvm::inconvertibleErrorCode(), 
         format("Variable '{}' is already declared in this scope", varName)
       );
     }
     
-    auto* alloca = createVariableAlloca(varName);
-    variables[varName] = alloca;
-    
-    auto initValue = generateExpr(stmt.expr);
+    // the initializer still sees any binding the new one shadows
+    auto initValue = generateExpr(arena->expr(stmt.expr));
     if (!initValue) {
       return initValue.takeError();
     }
     
+    if (!stmt.is_mutable) {
+      variables.declare(stmt.ident.symbol, Variable{.value = *initValue});
+      return llvm::Error::success();
+    }
+    
+    auto* alloca = createVariableAlloca(varName, (*initValue)->getType());
     builder->CreateStore(*initValue, alloca);
+    variables.declare(stmt.ident.symbol, Variable{.slot = alloca});
+    return llvm::Error::success();
+  }
+  
+  // Generate assignment: x = expr; to a variable declared with let mut
+  auto generateAssignStatement(const ASTAssignStmt& stmt) -> llvm::Error
+  {
+    const auto varName = interner.name(stmt.ident.symbol);
+    
+    const auto* variable = variables.lookup(stmt.ident.symbol);
+    if (!variable) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Undefined variable: {}", varName));
+    }
+    if (!variable->slot) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(), 
+        format("Cannot assign to immutable variable '{}' (declare it with 'let mut')", varName)
+      );
+    }
+    if (outsideSpawnBlock(stmt.ident.symbol)) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        format("Cannot assign to '{}' from a spawn block (tasks get copies of immutable lets)", varName)
+      );
+    }
+    
+    auto value = generateExpr(arena->expr(stmt.expr));
+    if (!value) {
+      return value.takeError();
+    }
+    if ((*value)->getType() != variable->slot->getAllocatedType()) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        format("Cannot assign {} to '{}', which holds {}", describeType((*value)->getType()), varName,
+               describeType(variable->slot->getAllocatedType()))
+      );
+    }
+    
+    builder->CreateStore(*value, variable->slot);
+    return llvm::Error::success();
+  }
+  
+  // Generate element assignment: a[index] = expr; where a is a let mut binding
+  auto generateStoreStatement(const ASTStoreStmt& stmt) -> llvm::Error
+  {
+    const auto varName = interner.name(stmt.array.symbol);
+    
+    const auto* variable = variables.lookup(stmt.array.symbol);
+    if (!variable) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Undefined variable: {}", varName));
+    }
+    if (!variable->slot) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        format("Cannot assign to an element of immutable variable '{}' (declare it with 'let mut')", varName)
+      );
+    }
+    
+    auto array = generateVariableAccess(stmt.array);
+    if (!array) {
+      return array.takeError();
+    }
+    auto index = generateExpr(arena->expr(stmt.index));
+    if (!index) {
+      return index.takeError();
+    }
+    auto value = generateExpr(arena->expr(stmt.expr));
+    if (!value) {
+      return value.takeError();
+    }
+    if (auto err = expectInteger(*value, "to store")) {
+      return err;
+    }
+    
+    auto address = generateElementAddress(*array, *index, (*value)->getType());
+    if (!address) {
+      return address.takeError();
+    }
+    builder->CreateStore(*value, *address);
     return llvm::Error::success();
   }
   
   // Generate print statement: print(expr);
   auto generatePrintStatement(const ASTPrintStmt& stmt) -> llvm::Error
   {
-    auto result = generateExpr(stmt.expr);
+    auto result = generateExpr(arena->expr(stmt.expr));
     if (!result) {
       return result.takeError();
     }
+    if (auto err = expectInteger(*result, "to print")) {
+      return err;
+    }
     
     createPrintFunction(*result);
     return llvm::Error::success();
@@ -129,7 +413,7 @@ private:
   // Generate expression statement: expr;
   auto generateExpressionStatement(const ASTExprStmt& stmt) -> llvm::Error
   {
-    auto result = generateExpr(stmt.expr);
+    auto result = generateExpr(arena->expr(stmt.expr));
     if (!result) {
       return result.takeError();
     }
@@ -139,37 +423,277 @@ private:
   // Generate return statement: return expr;
   auto generateReturnStatement(const ASTReturnStmt& stmt) -> llvm::Error
   {
-    auto result = generateExpr(stmt.expr);
+    if (!spawnFrames.empty()) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), "'return' is not allowed in a spawn block");
+    }
+    
+    auto result = generateExpr(arena->expr(stmt.expr));
     if (!result) {
       return result.takeError();
     }
+    if (auto err = expectType(*result, builder->GetInsertBlock()->getParent()->getReturnType(), "return value")) {
+      return err;
+    }
     
     builder->CreateRet(*result);
+    // whatever follows is unreachable and goes into a block of its own
+    builder->SetInsertPoint(llvm::BasicBlock::Create(*context, "after.return", builder->GetInsertBlock()->getParent()));
+    return llvm::Error::success();
+  }
+  
+  // helper to generate a nested block's statements in a scope of their own
+  auto generateBlock(const vector<StmtId>& body) -> llvm::Error
+  {
+    variables.push_scope();
+    auto result = [&]() -> llvm::Error {
+      for (const StmtId id : body) {
+        if (auto err = generate_statement(arena->stmt(id))) {
+          return err;
+        }
+      }
+      return llvm::Error::success();
+    }();
+    variables.pop_scope();
+    return result;
+  }
+  
+  // Loops are generated in the canonical shape LLVM's loop passes expect,
+  // so the vectorizer and the unroller apply at -O2 without rotation: a
+  // guard tests the condition once, a preheader enters the loop, and one
+  // latch at the end of the body tests it again and branches back.
+  
+  // Generate while loop: while condition { statements }
+  auto generateWhileStatement(const ASTWhileStmt& stmt) -> llvm::Error
+  {
+    auto* function = builder->GetInsertBlock()->getParent();
+    auto entered = generateCondition(stmt.condition);
+    if (!entered) {
+      return entered.takeError();
+    }
+    
+    auto* preheader = llvm::BasicBlock::Create(*context, "while.preheader", function);
+    auto* body = llvm::BasicBlock::Create(*context, "while.body", function);
+    auto* latch = llvm::BasicBlock::Create(*context, "while.latch", function);
+    auto* exit = llvm::BasicBlock::Create(*context, "while.end", function);
+    builder->CreateCondBr(*entered, preheader, exit);
+    builder->SetInsertPoint(preheader);
+    builder->CreateBr(body);
+    
+    builder->SetInsertPoint(body);
+    const bool carries = assignsArray(stmt.body);
+    carryingLoops += carries;
+    auto result = generateBlock(stmt.body);
+    carryingLoops -= carries;
+    if (result) {
+      return result;
+    }
+    builder->CreateBr(latch);
+    
+    // blocks of nested loops come before the latch
+    latch->moveAfter(builder->GetInsertBlock());
+    builder->SetInsertPoint(latch);
+    auto again = generateCondition(stmt.condition);
+    if (!again) {
+      return again.takeError();
+    }
+    builder->CreateCondBr(*again, body, exit);
+    
+    exit->moveAfter(latch);
+    builder->SetInsertPoint(exit);
+    return llvm::Error::success();
+  }
+  
+  // Generate counted loop: for i in start..end { statements }. i is an SSA
+  // phi with one increment in the latch, which a loop that runs while
+  // i < end cannot overflow, so it carries nsw and the trip count is
+  // computable. User arithmetic wraps and stays without the flag.
+  auto generateForStatement(const ASTForStmt& stmt) -> llvm::Error
+  {
+    const auto varName = interner.name(stmt.ident.symbol);
+    const auto name = llvm::StringRef(varName.data(), varName.size());
+    
+    auto start = generateExpr(arena->expr(stmt.start));
+    if (!start) {
+      return start.takeError();
+    }
+    auto end = generateExpr(arena->expr(stmt.end));
+    if (!end) {
+      return end.takeError();
+    }
+    if (auto err = expectInteger(*start, "range bound")) {
+      return err;
+    }
+    if (auto err = expectType(*end, (*start)->getType(), "range bound")) {
+      return err;
+    }
+    
+    auto* function = builder->GetInsertBlock()->getParent();
+    auto* preheader = llvm::BasicBlock::Create(*context, "for.preheader", function);
+    auto* body = llvm::BasicBlock::Create(*context, "for.body", function);
+    auto* latch = llvm::BasicBlock::Create(*context, "for.latch", function);
+    auto* exit = llvm::BasicBlock::Create(*context, "for.end", function);
+    builder->CreateCondBr(builder->CreateICmpSLT(*start, *end, "for.enter"), preheader, exit);
+    builder->SetInsertPoint(preheader);
+    builder->CreateBr(body);
+    
+    builder->SetInsertPoint(body);
+    auto* index = builder->CreatePHI((*start)->getType(), 2, name);
+    index->addIncoming(*start, preheader);
+    variables.push_scope();
+    variables.declare(stmt.ident.symbol, Variable{.value = index});
+    const bool carries = assignsArray(stmt.body);
+    carryingLoops += carries;
+    auto result = generateBlock(stmt.body);
+    carryingLoops -= carries;
+    variables.pop_scope();
+    if (result) {
+      return result;
+    }
+    builder->CreateBr(latch);
+    
+    latch->moveAfter(builder->GetInsertBlock());
+    builder->SetInsertPoint(latch);
+    auto* next = builder->CreateNSWAdd(index, createInteger(index->getType(), 1), name + ".next");
+    index->addIncoming(next, latch);
+    builder->CreateCondBr(builder->CreateICmpSLT(next, *end, "for.again"), body, exit);
+    
+    exit->moveAfter(latch);
+    builder->SetInsertPoint(exit);
+    return llvm::Error::success();
+  }
+  
+  // helper to tell whether a loop body assigns arrays, through which a
+  // let mut can carry an array literal's value into a later iteration;
+  // spawn blocks assign only their own variables
+  bool assignsArray(const vector<StmtId>& body) const
+  {
+    return ranges::any_of(body, [this](StmtId id) {
+      return visit([this](const auto& stmt) {
+        using T = decay_t<decltype(stmt)>;
+        if constexpr (is_same_v<T, ASTAssignStmt>) {
+          return arena->expr(stmt.expr).type.kind == TypeKind::array;
+        }
+        else if constexpr (is_same_v<T, ASTWhileStmt> || is_same_v<T, ASTForStmt>) {
+          return assignsArray(stmt.body);
+        }
+        return false;
+      }, arena->stmt(id).var);
+    });
+  }
+  
+  // Generate send statement: ch.send(expr);
+  auto generateSendStatement(const ASTSendStmt& stmt) -> llvm::Error
+  {
+    auto channel = generateChannelAccess(stmt.channel);
+    if (!channel) {
+      return channel.takeError();
+    }
+    
+    auto value = generateExpr(arena->expr(stmt.expr));
+    if (!value) {
+      return value.takeError();
+    }
+    if (auto err = expectType(*value, getLengthType(), "to send")) {
+      return err;
+    }
+    
+    builder->CreateCall(getRuntimeFunction("husk_channel_send", builder->getVoidTy(), {getPointerType(), getLengthType()}),
+                        {*channel, *value});
+    return llvm::Error::success();
+  }
+  
+  // Generate spawn statement. spawn f(); starts f through a small entry
+  // function; a spawn { ... } block becomes a function of its own, whose
+  // environment carries a copy of each enclosing let it uses, one 8-byte
+  // slot per value (an integer or a channel), so the loads can be generated
+  // before the block's last capture is known.
+  auto generateSpawnStatement(const ASTSpawnStmt& stmt) -> llvm::Error
+  {
+    // the size_t of husk_spawn is 64 bits on the targets this compiler builds for
+    auto spawn = getRuntimeFunction("husk_spawn", builder->getVoidTy(), {getPointerType(), getPointerType(), builder->getInt64Ty()});
+    auto* null = llvm::ConstantPointerNull::get(getPointerType());
+    
+    if (stmt.function.has_value()) {
+      auto* entry = getOrCreateTaskEntry(string(interner.name(stmt.function->symbol)));
+      builder->CreateCall(spawn, {entry, null, builder->getInt64(0)});
+      return llvm::Error::success();
+    }
+    
+    auto* parent = builder->GetInsertBlock()->getParent();
+    auto* task = llvm::Function::Create(getTaskType(), llvm::Function::InternalLinkage, parent->getName() + ".spawn", module.get());
+    auto* entry = llvm::BasicBlock::Create(*context, "entry", task);
+    auto* body = llvm::BasicBlock::Create(*context, "body", task);
+    
+    const auto resume = builder->saveIP();
+    spawnFrames.push_back(SpawnFrame{.env = task->getArg(0), .entry = entry, .depth = variables.depth()});
+    builder->SetInsertPoint(body);
+    auto outerHeapArrays = std::exchange(heapArrays, {});
+    auto* outerArrayChain = std::exchange(arrayChain, nullptr);
+    const unsigned outerCarryingLoops = std::exchange(carryingLoops, 0);
+    auto result = generateBlock(stmt.body);
+    if (!result) {
+      builder->CreateRetVoid();
+      freeHeapArrays(task);
+    }
+    heapArrays = std::move(outerHeapArrays);
+    arrayChain = outerArrayChain;
+    carryingLoops = outerCarryingLoops;
+    SpawnFrame frame = std::move(spawnFrames.back());
+    spawnFrames.pop_back();
+    builder->restoreIP(resume);
+    if (result) {
+      task->eraseFromParent();
+      return result;
+    }
+    
+    llvm::IRBuilder<>(entry).CreateBr(body);
+    
+    if (frame.captures.empty()) {
+      builder->CreateCall(spawn, {task, null, builder->getInt64(0)});
+      return llvm::Error::success();
+    }
+    // husk_spawn copies the environment, so one slot serves every spawn it runs
+    auto* envType = llvm::ArrayType::get(builder->getInt64Ty(), frame.captures.size());
+    auto& parentEntry = parent->getEntryBlock();
+    auto* env = llvm::IRBuilder<>(&parentEntry, parentEntry.begin()).CreateAlloca(envType, nullptr, "env");
+    for (unsigned index = 0; index < frame.captures.size(); ++index) {
+      builder->CreateStore(frame.captures[index], builder->CreateConstInBoundsGEP1_32(builder->getInt64Ty(), env, index));
+    }
+    builder->CreateCall(spawn, {task, env, builder->getInt64(8 * frame.captures.size())});
     return llvm::Error::success();
   }
 
 public:
   auto generate_function(const ASTFunction& func) -> llvm::Error
   {
-    auto funcName = func.name.value.value_or("unknown");
-    auto* llvmFunc = createFunction(funcName);
+    auto funcName = string(interner.name(func.name.symbol));
+    auto* llvmFunc = module->getFunction(funcName);
+    if (!llvmFunc) {
+      llvmFunc = createFunction(funcName);
+    }
     
     setupFunctionBody(llvmFunc);
     
+    heapArrays.clear();
+    arrayChain = nullptr;
+    carryingLoops = 0;
+    variables.push_scope();
     auto result = generateFunctionBody(func.body, funcName);
+    variables.pop_scope();
     if (result) {
       return result;
     }
     
-    addDefaultReturnIfNeeded(func.body);
+    addDefaultReturnIfNeeded();
+    freeHeapArrays(llvmFunc);
     return llvm::Error::success();
   }
 
 private:
-  // create function declaration
+  // create function declaration; its result type follows from the name alone
   llvm::Function* createFunction(const string& name)
   {
-    auto* funcType = llvm::FunctionType::get(getInt32Type(), false);
+    auto* funcType = llvm::FunctionType::get(getIntegerType(function_return_type(name)), false);
     return llvm::Function::Create(
       funcType,
       llvm::Function::ExternalLinkage,
@@ -178,19 +702,41 @@ private:
     );
   }
   
+  // tasks start at a void(ptr env) function
+  llvm::FunctionType* getTaskType() const
+  {
+    return llvm::FunctionType::get(llvm::Type::getVoidTy(*context), {getPointerType()}, false);
+  }
+  
+  // helper to get the entry of spawn f();, a task that calls f, defined once per module
+  llvm::Function* getOrCreateTaskEntry(const string& name)
+  {
+    if (auto* existing = module->getFunction(name + ".task")) {
+      return existing;
+    }
+    auto* callee = module->getFunction(name);
+    if (!callee) {
+      callee = createFunction(name);
+    }
+    auto* entry = llvm::Function::Create(getTaskType(), llvm::Function::InternalLinkage, name + ".task", module.get());
+    llvm::IRBuilder<> entryBuilder(llvm::BasicBlock::Create(*context, "entry", entry));
+    entryBuilder.CreateCall(callee);
+    entryBuilder.CreateRetVoid();
+    return entry;
+  }
+  
   // setup function entry block
   void setupFunctionBody(llvm::Function* func)
   {
     auto* entry = llvm::BasicBlock::Create(*context, "entry", func);
     builder->SetInsertPoint(entry);
-    variables.clear(); // Clear variables for new function scope
   }
   
   // generate function body statements
-  auto generateFunctionBody(const vector<ASTStmt>& body, const string& funcName) -> llvm::Error
+  auto generateFunctionBody(const vector<StmtId>& body, const string& funcName) -> llvm::Error
   {
-    for (const auto& stmt : body) {
-      auto result = generate_statement(stmt);
+    for (const StmtId stmt : body) {
+      auto result = generate_statement(arena->stmt(stmt));
       if (result) {
         return llvm::createStringError(
           llvm::inconvertibleErrorCode(), 
@@ -201,25 +747,60 @@ private:
     return llvm::Error::success();
   }
   
-  // add default return 0 if no explicit return
-  void addDefaultReturnIfNeeded(const vector<ASTStmt>& body)
+  // helper to free the function's heap arrays ahead of each of its returns
+  void freeHeapArrays(llvm::Function* function)
   {
-    bool has_return = any_of(body.begin(), body.end(),
-                            [](const ASTStmt& stmt) {
-                              return holds_alternative<ASTReturnStmt>(stmt.var);
-                            });
-    
-    if (!has_return) {
-      builder->CreateRet(createInt32(0));
+    if (heapArrays.empty() && !arrayChain) {
+      return;
+    }
+    for (auto& block : *function) {
+      if (auto* ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator())) {
+        llvm::IRBuilder<> exitBuilder(ret);
+        for (auto* data : heapArrays) {
+          exitBuilder.CreateCall(getRuntimeFunction("husk_array_free", builder->getVoidTy(), {getPointerType()}), {data});
+        }
+        if (arrayChain) {
+          auto freeChain = getRuntimeFunction("husk_array_free_chain", builder->getVoidTy(), {getPointerType()});
+          exitBuilder.CreateCall(freeChain, {exitBuilder.CreateLoad(getPointerType(), arrayChain, "array.chain")});
+        }
+      }
+    }
+  }
+  
+  // add default return 0 where the body falls off its end; after a return
+  // the insert block is unreachable, and is dropped when empty
+  void addDefaultReturnIfNeeded()
+  {
+    auto* block = builder->GetInsertBlock();
+    if (block != &block->getParent()->getEntryBlock() && llvm::pred_empty(block)) {
+      if (block->empty()) {
+        block->eraseFromParent();
+      } else {
+        builder->CreateUnreachable();
+      }
+      return;
     }
+    builder->CreateRet(createInteger(block->getParent()->getReturnType(), 0));
   }
 
 public:
   auto generate(const ASTProgram& program) -> llvm::Error
   {
+    vector<uint32_t> all_functions(program.functions.size());
+    iota(all_functions.begin(), all_functions.end(), 0);
+    return generate(program, all_functions);
+  }
+
+  // Generate only the given functions. Only the functions a module defines
+  // are declared in it (names are already unique after parsing), so the cost
+  // of a module stays proportional to its own functions.
+  auto generate(const ASTProgram& program, const vector<uint32_t>& function_indices) -> llvm::Error
+  {
+    arena = &program.arena;
+    
     // generate each function
-    for (const auto& func : program.functions) {
-      auto result = generate_function(func);
+    for (const uint32_t index : function_indices) {
+      auto result = generate_function(program.functions[index]);
       if (result) {
         return result;
       }
@@ -233,12 +814,18 @@ public:
     return move(module);
   }
 
+  // hand the context over together with the module (e.g. to the JIT)
+  unique_ptr<llvm::LLVMContext> getContext()
+  {
+    return move(context);
+  }
+
 private:
-  // generate code for primary expression
-  auto generatePrimary(const ASTPrimaryExpr& primary) -> Expected<llvm::Value*>
+  // generate code for primary expression of type `type`
+  auto generatePrimary(const ASTPrimaryExpr& primary, Type type) -> Expected<llvm::Value*>
   {
     if (primary.int_lit.has_value()) {
-      return generateIntegerLiteral(primary.int_lit.value());
+      return generateIntegerLiteral(primary.int_lit.value(), type);
     }
     
     if (primary.ident.has_value()) {
@@ -248,84 +835,498 @@ private:
     return llvm::createStringError(llvm::inconvertibleErrorCode(), "Invalid primary expression");
   }
   
-  // generate integer literal
-  llvm::Value* generateIntegerLiteral(const Token& token)
+  // generate integer literal; the lexer already parsed its value, and the TypeChecker found its width
+  llvm::Value* generateIntegerLiteral(const Token& token, Type type)
   {
-    const int val = stoi(token.value.value_or("0"));
-    return createInt32(val);
+    return createInteger(getIntegerType(type.kind), token.value());
   }
   
-  // generate variable access
+  // generate variable access: the bound value, or a load for let mut;
+  // inside a spawn block, a binding from outside it is captured
   auto generateVariableAccess(const Token& token) -> Expected<llvm::Value*>
   {
-    const auto varName = token.value.value_or("");
+    const auto varName = interner.name(token.symbol);
     
-    if (!variableExists(varName)) {
+    const auto* variable = variables.lookup(token.symbol);
+    if (!variable) {
       return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Undefined variable: {}", varName));
     }
+    if (outsideSpawnBlock(token.symbol)) {
+      return captureVariable(token.symbol, spawnFrames.size() - 1);
+    }
+    if (!variable->slot) {
+      return variable->value;
+    }
+    
+    return builder->CreateLoad(variable->slot->getAllocatedType(), variable->slot, llvm::StringRef(varName.data(), varName.size()));
+  }
+  
+  // whether a symbol is bound outside the spawn block being generated
+  bool outsideSpawnBlock(uint32_t symbol) const
+  {
+    return !spawnFrames.empty() && variables.depth_of(symbol) <= spawnFrames.back().depth;
+  }
+  
+  // Helper to read an enclosing binding inside spawn frame `index`: the
+  // first use adds it to the frame's environment and loads it in the task's
+  // entry block. The value comes from the enclosing frame in turn when the
+  // binding is outside that one too.
+  auto captureVariable(uint32_t symbol, size_t index) -> Expected<llvm::Value*>
+  {
+    auto& frame = spawnFrames[index];
+    if (auto it = frame.loaded.find(symbol); it != frame.loaded.end()) {
+      return it->second;
+    }
+    const auto varName = interner.name(symbol);
+    const auto* variable = variables.lookup(symbol);
+    if (variable->slot) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        format("Cannot use mutable variable '{}' in a spawn block (tasks get copies of immutable lets)", varName)
+      );
+    }
     
-    return builder->CreateLoad(getInt32Type(), variables[varName], varName.c_str());
+    if (variable->value->getType()->isStructTy()) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        format("Cannot use array '{}' in a spawn block (its storage belongs to the enclosing function)", varName)
+      );
+    }
+    
+    llvm::Value* outer = variable->value;
+    if (index > 0 && variables.depth_of(symbol) <= spawnFrames[index - 1].depth) {
+      auto captured = captureVariable(symbol, index - 1);
+      if (!captured) {
+        return captured.takeError();
+      }
+      outer = *captured;
+    }
+    
+    const auto field = static_cast<unsigned>(frame.captures.size());
+    frame.captures.push_back(outer);
+    llvm::IRBuilder<> entryBuilder(frame.entry);
+    auto* slot = entryBuilder.CreateConstInBoundsGEP1_32(entryBuilder.getInt64Ty(), frame.env, field);
+    auto* value = entryBuilder.CreateLoad(outer->getType(), slot,
+                                          llvm::StringRef(varName.data(), varName.size()));
+    frame.loaded[symbol] = value;
+    return value;
+  }
+  
+  // helper to read a variable that must hold a channel
+  auto generateChannelAccess(const Token& token) -> Expected<llvm::Value*>
+  {
+    auto channel = generateVariableAccess(token);
+    if (!channel) {
+      return channel.takeError();
+    }
+    if (!(*channel)->getType()->isPointerTy()) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), format("'{}' is not a channel", interner.name(token.symbol)));
+    }
+    return *channel;
   }
 
-  // Generate code for expression (handles recursion)
-  auto generateExpr(const ASTExpr& expr) -> Expected<llvm::Value*>
+  // Storage for an array literal, set up in the entry block so it happens
+  // once per call however often the literal runs: a stack slot up to
+  // MAX_INLINE_ARRAY_BYTES, otherwise a heap block freed on return. In a
+  // loop whose body assigns arrays, a let mut can still hold an earlier
+  // run's array, so each run gets a chained heap block, freed on return.
+  llvm::Value* createArrayStorage(uint64_t count, llvm::IntegerType* element)
   {
-    return visit([this](auto&& arg) -> Expected<llvm::Value*> {
-      using T = decay_t<decltype(arg)>;
-      
-      if constexpr (is_same_v<T, ASTPrimaryExpr>) {
-        return generatePrimary(arg);
+    auto* function = builder->GetInsertBlock()->getParent();
+    auto& entry = function->getEntryBlock();
+    llvm::IRBuilder<> entryBuilder(&entry, entry.begin());
+    const uint64_t size = count * (element->getBitWidth() / 8);
+    if (carryingLoops > 0) {
+      if (!arrayChain) {
+        arrayChain = entryBuilder.CreateAlloca(getPointerType(), nullptr, "array.chain");
+        entryBuilder.CreateStore(llvm::ConstantPointerNull::get(getPointerType()), arrayChain);
+      }
+      auto allocate = getRuntimeFunction("husk_array_alloc_chained", getPointerType(), {getPointerType(), builder->getInt64Ty()});
+      return builder->CreateCall(allocate, {arrayChain, builder->getInt64(size)}, "array.data");
+    }
+    if (size <= MAX_INLINE_ARRAY_BYTES) {
+      return entryBuilder.CreateAlloca(llvm::ArrayType::get(element, count), nullptr, "array.data");
+    }
+    auto allocate = getRuntimeFunction("husk_array_alloc", getPointerType(), {builder->getInt64Ty()});
+    auto* data = entryBuilder.CreateCall(allocate, {entryBuilder.getInt64(size)}, "array.data");
+    heapArrays.push_back(data);
+    return data;
+  }
+  
+  // Generate an array literal of type `type`; its element values are the
+  // top entries of the operand stack, and are popped
+  auto generateArrayLiteral(const ASTArrayExpr& array, Type type) -> Expected<llvm::Value*>
+  {
+    auto* element = getIntegerType(type.element);
+    const size_t first = values.size() - array.elements.size();
+    for (size_t i = first; i < values.size(); ++i) {
+      if (auto err = expectInteger(values[i], "array element")) {
+        return std::move(err);
       }
-      else if constexpr (is_same_v<T, ASTBinaryExpr>) {
-        return generateBinaryExpression(arg);
+      if (auto err = expectType(values[i], element, "array element")) {
+        return std::move(err);
       }
-      
-      return llvm::createStringError(llvm::inconvertibleErrorCode(), "Invalid expression type");
-    }, expr.var);
+    }
+    
+    const uint64_t count = array.count.has_value() ? static_cast<uint64_t>(array.count->value()) : array.elements.size();
+    auto* data = createArrayStorage(count, element);
+    if (array.count.has_value()) {
+      generateFill(data, values[first], count);
+    }
+    else {
+      for (uint64_t i = 0; i < count; ++i) {
+        builder->CreateStore(values[first + i], builder->CreateConstInBoundsGEP1_64(element, data, i));
+      }
+    }
+    values.resize(first);
+    return createSlice(data, createInteger(getLengthType(), static_cast<int64_t>(count)));
+  }
+  
+  // helper to store `value` into `count` elements: a memset for zero,
+  // otherwise a counted loop that the optimizer widens
+  void generateFill(llvm::Value* data, llvm::Value* value, uint64_t count)
+  {
+    if (count == 0) {
+      return;
+    }
+    auto* element = value->getType();
+    const uint64_t bytes = element->getIntegerBitWidth() / 8;
+    if (auto* constant = llvm::dyn_cast<llvm::ConstantInt>(value); constant && constant->isZero()) {
+      builder->CreateMemSet(data, builder->getInt8(0), count * bytes, llvm::MaybeAlign(bytes));
+      return;
+    }
+    
+    auto* function = builder->GetInsertBlock()->getParent();
+    auto* preheader = builder->GetInsertBlock();
+    auto* body = llvm::BasicBlock::Create(*context, "fill.body", function);
+    auto* exit = llvm::BasicBlock::Create(*context, "fill.end", function);
+    builder->CreateBr(body);
+    builder->SetInsertPoint(body);
+    auto* index = builder->CreatePHI(builder->getInt64Ty(), 2, "fill.index");
+    index->addIncoming(builder->getInt64(0), preheader);
+    builder->CreateStore(value, builder->CreateInBoundsGEP(element, data, index));
+    auto* next = builder->CreateAdd(index, builder->getInt64(1), "fill.next", /*HasNUW=*/true, /*HasNSW=*/true);
+    index->addIncoming(next, body);
+    builder->CreateCondBr(builder->CreateICmpULT(next, builder->getInt64(count)), body, exit);
+    builder->SetInsertPoint(exit);
   }
   
-  // Generate binary expression
-  auto generateBinaryExpression(const ASTBinaryExpr& bin) -> Expected<llvm::Value*>
+  // Helper to address a[index], an element of type `element`, after
+  // checking 0 <= index < length, which is one unsigned compare: a
+  // negative index wraps to a large one.
+  auto generateElementAddress(llvm::Value* array, llvm::Value* index, llvm::Type* element) -> Expected<llvm::Value*>
   {
-    auto lhs = generatePrimary(bin.lhs);
-    if (!lhs) {
-      return lhs.takeError();
+    if (auto err = expectArray(array, "to index")) {
+      return std::move(err);
+    }
+    if (auto err = expectInteger(index, "index")) {
+      return std::move(err);
     }
     
-    auto rhs = generateExpr(*bin.rhs);
-    if (!rhs) {
-      return rhs.takeError();
+    index = widenToLength(index);
+    auto* length = getArrayLength(array);
+    auto* inBounds = builder->CreateICmpULT(index, length, "inbounds");
+    if (isKnownFalse(inBounds)) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        format("Index {} is out of bounds for an array of length {}", constantValue(index), constantValue(length))
+      );
+    }
+    createBoundsCheck(inBounds, "husk_index_fail", {index, length});
+    return builder->CreateInBoundsGEP(element, getArrayData(array), index, "element.ptr");
+  }
+  
+  // Generate a[start..end] over elements of type `element`: a view of
+  // [start, end) after checking start <= end <= length, again as unsigned
+  // compares
+  auto generateSlice(llvm::Value* array, llvm::Value* start, llvm::Value* end, llvm::Type* element) -> Expected<llvm::Value*>
+  {
+    if (auto err = expectArray(array, "to slice")) {
+      return std::move(err);
+    }
+    for (auto* bound : {&start, &end}) {
+      if (*bound) {
+        if (auto err = expectInteger(*bound, "slice bound")) {
+          return std::move(err);
+        }
+        *bound = widenToLength(*bound);
+      }
+    }
+    
+    auto* length = getArrayLength(array);
+    llvm::Value* inBounds = nullptr;
+    auto require = [&](llvm::Value* condition) {
+      inBounds = inBounds ? builder->CreateAnd(inBounds, condition, "inbounds") : condition;
+    };
+    // an omitted bound cannot be out of range
+    if (start) {
+      require(builder->CreateICmpULE(start, end ? end : length, "inbounds"));
+    }
+    if (end) {
+      require(builder->CreateICmpULE(end, length, "inbounds"));
+    }
+    start = start ? start : createInteger(getLengthType(), 0);
+    end = end ? end : length;
+    
+    if (inBounds) {
+      if (isKnownFalse(inBounds)) {
+        return llvm::createStringError(
+          llvm::inconvertibleErrorCode(),
+          format("Slice [{}..{}] is out of bounds for an array of length {}", constantValue(start), constantValue(end),
+                 constantValue(length))
+        );
+      }
+      createBoundsCheck(inBounds, "husk_slice_fail", {start, end, length});
+    }
+    auto* data = builder->CreateInBoundsGEP(element, getArrayData(array), start, "slice.data");
+    return createSlice(data, builder->CreateSub(end, start, "slice.len", /*HasNUW=*/true, /*HasNSW=*/true));
+  }
+  
+  // Helper to branch to a cold runtime handler that does not return when a
+  // bounds check fails. The check stays a plain compare of the index with
+  // the length, the form IndVarSimplify folds when the loop bounds prove it
+  // and IRCE (see Optimizer) lifts out of a loop over the induction
+  // variable. A check known to pass emits nothing.
+  void createBoundsCheck(llvm::Value* inBounds, llvm::StringRef handler, llvm::ArrayRef<llvm::Value*> operands)
+  {
+    if (llvm::isa<llvm::ConstantInt>(inBounds)) {
+      return;
     }
+    auto* function = builder->GetInsertBlock()->getParent();
+    auto* ok = llvm::BasicBlock::Create(*context, "bounds.ok", function);
+    auto* fail = llvm::BasicBlock::Create(*context, "bounds.fail", function);
+    builder->CreateCondBr(inBounds, ok, fail);
     
-    return generateBinaryOp(*lhs, *rhs, bin.op.type);
+    builder->SetInsertPoint(fail);
+    auto callee = getRuntimeFunction(handler, builder->getVoidTy(), vector<llvm::Type*>(operands.size(), getLengthType()));
+    if (auto* declaration = llvm::dyn_cast<llvm::Function>(callee.getCallee())) {
+      declaration->setDoesNotReturn();
+      declaration->addFnAttr(llvm::Attribute::Cold);
+    }
+    builder->CreateCall(callee, operands);
+    builder->CreateUnreachable();
+    builder->SetInsertPoint(ok);
+  }
+  
+  static bool isKnownFalse(const llvm::Value* condition)
+  {
+    const auto* constant = llvm::dyn_cast<llvm::ConstantInt>(condition);
+    return constant && constant->isZero();
+  }
+  
+  // the value of an operand of a check that folded, for its diagnostic
+  static int64_t constantValue(const llvm::Value* value)
+  {
+    return llvm::cast<llvm::ConstantInt>(value)->getSExtValue();
+  }
+
+  // Generate code for an expression. The tree is walked with explicit
+  // stacks rather than recursion so deep trees (long chains of '/', deeply
+  // nested parentheses) cannot overflow the call stack. Left operands are
+  // generated before right ones, as in the source.
+  auto generateExpr(const ASTExpr& expr) -> Expected<llvm::Value*>
+  {
+    pending.clear();
+    values.clear();
+    pending.push_back({&expr, false});
+    while (!pending.empty()) {
+      const auto [node, operands_done] = pending.back();
+      pending.pop_back();
+
+      if (const auto* primary = get_if<ASTPrimaryExpr>(&node->var)) {
+        auto value = generatePrimary(*primary, node->type);
+        if (!value) {
+          return value.takeError();
+        }
+        values.push_back(*value);
+        continue;
+      }
+
+      if (const auto* receive = get_if<ASTReceiveExpr>(&node->var)) {
+        auto channel = generateChannelAccess(receive->channel);
+        if (!channel) {
+          return channel.takeError();
+        }
+        values.push_back(builder->CreateCall(
+          getRuntimeFunction("husk_channel_receive", getLengthType(), {getPointerType()}), {*channel}, "received"));
+        continue;
+      }
+
+      if (const auto* channel = get_if<ASTChannelExpr>(&node->var)) {
+        if (channel->capacity.has_value() && !operands_done) {
+          pending.push_back({node, true});
+          pending.push_back({&arena->expr(*channel->capacity), false});
+          continue;
+        }
+        llvm::Value* capacity = createInteger(getLengthType(), DEFAULT_CHANNEL_CAPACITY);
+        if (channel->capacity.has_value()) {
+          capacity = values.back();
+          values.pop_back();
+          if (auto err = expectInteger(capacity, "channel capacity")) {
+            return std::move(err);
+          }
+          capacity = widenToLength(capacity);
+        }
+        values.push_back(builder->CreateCall(
+          getRuntimeFunction("husk_channel_new", getPointerType(), {getLengthType()}), {capacity}, "channel"));
+        continue;
+      }
+
+      if (const auto* array = get_if<ASTArrayExpr>(&node->var)) {
+        if (!operands_done) {
+          pending.push_back({node, true});
+          for (auto it = array->elements.rbegin(); it != array->elements.rend(); ++it) {
+            pending.push_back({&arena->expr(*it), false});
+          }
+          continue;
+        }
+        auto literal = generateArrayLiteral(*array, node->type);
+        if (!literal) {
+          return literal.takeError();
+        }
+        values.push_back(*literal);
+        continue;
+      }
+
+      if (const auto* len = get_if<ASTLenExpr>(&node->var)) {
+        if (!operands_done) {
+          pending.push_back({node, true});
+          pending.push_back({&arena->expr(len->array), false});
+          continue;
+        }
+        if (auto err = expectArray(values.back(), "before '.len()'")) {
+          return std::move(err);
+        }
+        values.back() = getArrayLength(values.back());
+        continue;
+      }
+
+      if (const auto* index = get_if<ASTIndexExpr>(&node->var)) {
+        if (!operands_done) {
+          pending.push_back({node, true});
+          pending.push_back({&arena->expr(index->index), false});
+          pending.push_back({&arena->expr(index->array), false});
+          continue;
+        }
+        llvm::Value* position = values.back();
+        values.pop_back();
+        auto* element = getIntegerType(node->type.kind);
+        auto address = generateElementAddress(values.back(), position, element);
+        if (!address) {
+          return address.takeError();
+        }
+        values.back() = builder->CreateLoad(element, *address, "element");
+        continue;
+      }
+
+      if (const auto* slice = get_if<ASTSliceExpr>(&node->var)) {
+        if (!operands_done) {
+          pending.push_back({node, true});
+          if (slice->end.has_value()) {
+            pending.push_back({&arena->expr(*slice->end), false});
+          }
+          if (slice->start.has_value()) {
+            pending.push_back({&arena->expr(*slice->start), false});
+          }
+          pending.push_back({&arena->expr(slice->array), false});
+          continue;
+        }
+        llvm::Value* end = nullptr;
+        llvm::Value* start = nullptr;
+        if (slice->end.has_value()) {
+          end = values.back();
+          values.pop_back();
+        }
+        if (slice->start.has_value()) {
+          start = values.back();
+          values.pop_back();
+        }
+        auto view = generateSlice(values.back(), start, end, getIntegerType(node->type.element));
+        if (!view) {
+          return view.takeError();
+        }
+        values.back() = *view;
+        continue;
+      }
+
+      if (const auto* convert = get_if<ASTConvertExpr>(&node->var)) {
+        if (!operands_done) {
+          pending.push_back({node, true});
+          pending.push_back({&arena->expr(convert->operand), false});
+          continue;
+        }
+        if (auto err = expectInteger(values.back(), "to convert")) {
+          return std::move(err);
+        }
+        // nothing at all when the operand already has the width
+        values.back() = builder->CreateSExtOrTrunc(values.back(), getIntegerType(convert->target), "convtmp");
+        continue;
+      }
+
+      const auto& bin = get<ASTBinaryExpr>(node->var);
+      if (!operands_done) {
+        pending.push_back({node, true});
+        pending.push_back({&arena->expr(bin.rhs), false});
+        pending.push_back({&arena->expr(bin.lhs), false});
+        continue;
+      }
+      llvm::Value* rhs = values.back();
+      values.pop_back();
+      auto result = generateBinaryOp(values.back(), rhs, bin.kind, getIntegerType(node->type.kind));
+      if (!result) {
+        return result.takeError();
+      }
+      values.back() = *result;
+    }
+    return values.back();
   }
 
+  // print(expr) is a call into the runtime's buffered writer
   void createPrintFunction(llvm::Value* value)
   {
-    llvm::FunctionCallee printfFunc = getOrCreatePrintfFunction();
-    llvm::Value* formatStr = createFormatString();
-    builder->CreateCall(printfFunc, {formatStr, value});
+    builder->CreateCall(getOrCreatePrintFunction(value->getType()), {value});
   }
   
-  // Get or create printf function declaration
-  llvm::FunctionCallee getOrCreatePrintfFunction()
+  // Get or create the declaration of husk_print_i32 or husk_print_i64
+  // (runtime/husk_runtime.h), whichever prints `type`
+  llvm::FunctionCallee getOrCreatePrintFunction(llvm::Type* type)
   {
-    auto* printfType = llvm::FunctionType::get(
-      getInt32Type(),
-      llvm::PointerType::get(*context, 0),
-      true  // vararg
-    );
-    return module->getOrInsertFunction("printf", printfType);
+    const auto name = type->getIntegerBitWidth() == 32 ? "husk_print_i32" : "husk_print_i64";
+    return getRuntimeFunction(name, llvm::Type::getVoidTy(*context), {type});
   }
-  
-  // Create format string for printf
-  llvm::Value* createFormatString()
+
+  // helper to get or create the declaration of a runtime entry point
+  llvm::FunctionCallee getRuntimeFunction(llvm::StringRef name, llvm::Type* result, llvm::ArrayRef<llvm::Type*> params)
   {
-    return builder->CreateGlobalString("%d\n");
+    return module->getOrInsertFunction(name, llvm::FunctionType::get(result, params, false));
   }
 
+  // what a name is bound to: the SSA value of an immutable let, or the
+  // entry-block slot of a let mut
+  struct Variable {
+    llvm::Value* value = nullptr;
+    llvm::AllocaInst* slot = nullptr;
+  };
+
+  // a spawn block being generated as a task function of its own
+  struct SpawnFrame {
+    llvm::Value* env;                 // the task's environment argument
+    llvm::BasicBlock* entry;          // loads of the captures, ahead of the body
+    uint32_t depth;                   // bindings at or above this scope depth are outside the block
+    vector<llvm::Value*> captures;    // enclosing values, in environment order
+    llvm::DenseMap<uint32_t, llvm::Value*> loaded{};  // symbol to its value inside the block
+  };
+
+  const Interner& interner;  // symbol names from the lexer
+  const ASTArena* arena = nullptr;  // nodes of the program being generated
   unique_ptr<llvm::LLVMContext> context;
   unique_ptr<llvm::Module> module;
   unique_ptr<llvm::IRBuilder<>> builder;
-  map<string, llvm::AllocaInst*> variables;  // Symbol table
+  ScopedSymbolTable<Variable> variables;  // Symbol table keyed by interned name
+  vector<SpawnFrame> spawnFrames;         // spawn blocks being generated, innermost last
+  vector<llvm::Value*> heapArrays;        // heap storage of the function being generated
+  llvm::Value* arrayChain = nullptr;      // its chain of per-run array blocks, once a literal needs one
+  unsigned carryingLoops = 0;             // enclosing loops whose body assigns arrays
+  vector<pair<const ASTExpr*, bool>> pending;  // generateExpr work stack: node, operands generated
+  vector<llvm::Value*> values;                 // generateExpr operand stack
 };
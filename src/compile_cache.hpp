@@ -0,0 +1,226 @@
+#pragma once
+
+#include <format>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/BLAKE3.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include "ast.hpp"
+#include "instrumentation.hpp"
+#include "options.hpp"
+#include "parallel_codegen.hpp"
+
+using namespace std;
+
+// Incremental compilation cache (--cache). Every function's optimized
+// bitcode is stored as <dir>/<key>.bc, where the key hashes the function's
+// token stream together with everything else that affects its code: the
+// compiler and LLVM versions, the optimization level and the target.
+// Editing one function therefore only recompiles that function. Entries
+// also stay in memory once loaded or stored, which pays off when a
+// `husk --server` keeps the cache across requests.
+class CompileCache
+{
+public:
+  CompileCache(fs::path dir, string config)
+    : m_dir(move(dir)), m_config(move(config))
+  {
+  }
+
+  // the configuration part of every key
+  static string config_for(const CompileOptions& options, const llvm::TargetMachine& machine)
+  {
+    return format("husk {} llvm {} -O{} {} {} {}{}", HUSK_VERSION, LLVM_VERSION_STRING, options.opt_level,
+                  machine.getTargetTriple().str(), machine.getTargetCPU().str(),
+                  machine.getTargetFeatureString().str(), profile_config(options.profile));
+  }
+
+  // helper to describe PGO in the configuration; a profile in use counts
+  // by its contents, so collecting a new one invalidates the entries
+  static string profile_config(const ProfileConfig& profile)
+  {
+    if (!profile.generate.empty()) {
+      return format(" profile-generate {}", profile.generate.string());
+    }
+    if (profile.use.empty()) {
+      return "";
+    }
+    auto buffer = llvm::MemoryBuffer::getFile(profile.use.string());
+    if (!buffer) {
+      return format(" profile-use {}", profile.use.string());  // the optimizer reports it
+    }
+    const auto contents = (*buffer)->getBuffer();
+    const auto digest = llvm::BLAKE3::hash(llvm::ArrayRef(reinterpret_cast<const uint8_t*>(contents.data()), contents.size()));
+    return format(" profile-use {}", llvm::toHex(digest, /*LowerCase=*/true));
+  }
+
+  // create the cache directory
+  static auto open(const fs::path& dir, string config) -> Expected<unique_ptr<CompileCache>>
+  {
+    if (auto ec = llvm::sys::fs::create_directories(dir.string())) {
+      return llvm::createStringError(ec, format("Could not create cache directory '{}': {}", dir.string(), ec.message()));
+    }
+    return make_unique<CompileCache>(dir, move(config));
+  }
+
+  // key of a function: hash of the configuration and its tokens' kinds, names and values
+  string key(const ASTFunction& func, const TokenBuffer& tokens, const Interner& interner) const
+  {
+    llvm::BLAKE3 hasher;
+    hasher.update(m_config);
+
+    for (uint32_t i = func.first_token; i < func.end_token; ++i) {
+      const Token token = tokens[i];
+      const auto type = static_cast<uint8_t>(token.type);
+      hasher.update(llvm::ArrayRef(&type, 1));
+      if (token.type == TokenType::int_lit) {
+        const auto value = token.value();
+        hasher.update(llvm::ArrayRef(reinterpret_cast<const uint8_t*>(&value), sizeof(value)));
+      }
+      else if (token.symbol != no_symbol) {
+        // length prefix keeps adjacent spellings from running together
+        const auto name = interner.name(token.symbol);
+        const auto length = static_cast<uint32_t>(name.size());
+        hasher.update(llvm::ArrayRef(reinterpret_cast<const uint8_t*>(&length), sizeof(length)));
+        hasher.update(llvm::StringRef(name.data(), name.size()));
+      }
+    }
+
+    const auto digest = hasher.final();
+    return llvm::toHex(digest, /*LowerCase=*/true);
+  }
+
+  // cached bitcode for a key, or nullopt on a miss; the buffer lives as long as the cache
+  optional<llvm::MemoryBufferRef> load(const string& key)
+  {
+    {
+      lock_guard lock(m_mutex);
+      if (auto it = m_memory.find(key); it != m_memory.end()) {
+        return it->second->getMemBufferRef();
+      }
+    }
+
+    auto buffer = llvm::MemoryBuffer::getFile(entry_path(key).string(), /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if (!buffer) {
+      return nullopt;
+    }
+    return remember(key, std::move(*buffer));
+  }
+
+  // keep an entry in memory, then write it to a temporary file and rename
+  // it into place, so a concurrent or interrupted compile never sees a
+  // partial entry
+  auto store(const string& key, llvm::ArrayRef<char> bitcode) -> llvm::Error
+  {
+    remember(key, llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(bitcode.data(), bitcode.size()), key));
+
+    auto temp = llvm::sys::fs::TempFile::create((m_dir / (key + "-%%%%%%.tmp")).string());
+    if (!temp) {
+      return temp.takeError();
+    }
+
+    {
+      llvm::raw_fd_ostream os(temp->FD, /*shouldClose=*/false);
+      os.write(bitcode.data(), bitcode.size());
+      os.flush();
+      if (os.has_error()) {
+        os.clear_error();
+        return llvm::joinErrors(
+          llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not write cache entry {}", key)),
+          temp->discard()
+        );
+      }
+    }
+    return temp->keep(entry_path(key).string());
+  }
+
+  // drop the in-memory entries; only safe while no compile uses the cache
+  void forget()
+  {
+    lock_guard lock(m_mutex);
+    m_memory.clear();
+    m_memory_bytes = 0;
+  }
+
+  size_t memory_bytes() const
+  {
+    lock_guard lock(m_mutex);
+    return m_memory_bytes;
+  }
+
+private:
+  fs::path entry_path(const string& key) const
+  {
+    return m_dir / (key + ".bc");
+  }
+
+  // helper to keep an entry in memory; the first buffer stored for a key wins
+  llvm::MemoryBufferRef remember(const string& key, unique_ptr<llvm::MemoryBuffer> buffer)
+  {
+    lock_guard lock(m_mutex);
+    auto [it, inserted] = m_memory.try_emplace(key, std::move(buffer));
+    if (inserted) {
+      m_memory_bytes += it->second->getBufferSize();
+    }
+    return it->second->getMemBufferRef();
+  }
+
+  fs::path m_dir;
+  string m_config;
+  mutable mutex m_mutex;  // multi-file builds share the cache between tasks
+  llvm::StringMap<unique_ptr<llvm::MemoryBuffer>> m_memory;
+  size_t m_memory_bytes = 0;
+};
+
+// Build the optimized module for the whole program through the cache.
+// Cached functions are loaded from disk; the rest are generated and
+// optimized one function per module on the pool and stored.
+// All of them are then linked, in source order, into a module in `context`.
+inline auto compile_cached(ThreadPool& pool, Backends& backends, const ASTProgram& program,
+                           const TokenBuffer& tokens, const Interner& interner, CompileCache& cache,
+                           llvm::LLVMContext& context, const llvm::TargetMachine& machine, CompileStats& stats)
+  -> Expected<unique_ptr<llvm::Module>>
+{
+  vector<string> keys;
+  vector<llvm::MemoryBufferRef> buffers(program.functions.size());
+  vector<vector<uint32_t>> missing;
+
+  for (uint32_t i = 0; i < program.functions.size(); ++i) {
+    keys.push_back(cache.key(program.functions[i], tokens, interner));
+    if (auto cached = cache.load(keys.back())) {
+      buffers[i] = *cached;
+    }
+    else {
+      missing.push_back({i});
+    }
+  }
+  stats.cache_hits = program.functions.size() - missing.size();
+  stats.cache_misses = missing.size();
+
+  auto compiled = run_partitions(pool, backends, program, interner, missing, /*emit_objects=*/false);
+  if (!compiled) {
+    return compiled.takeError();
+  }
+
+  for (size_t m = 0; m < missing.size(); ++m) {
+    const uint32_t index = missing[m].front();
+    const auto& bitcode = (*compiled)[m].bitcode;
+    if (auto err = cache.store(keys[index], bitcode)) {
+      return err;
+    }
+    buffers[index] = llvm::MemoryBufferRef(llvm::StringRef(bitcode.data(), bitcode.size()), keys[index]);
+  }
+  return link_bitcode(buffers, context, machine);
+}
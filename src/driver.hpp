@@ -0,0 +1,504 @@
+#pragma once
+
+#include <format>
+#include <iostream>
+#include <print>
+#include <string>
+#include <vector>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include "ast.hpp"
+#include "codegen.hpp"
+#include "compile_cache.hpp"
+#include "emitter.hpp"
+#include "fold.hpp"
+#include "instrumentation.hpp"
+#include "jit.hpp"
+#include "lexer.hpp"
+#include "optimizer.hpp"
+#include "options.hpp"
+#include "parallel_codegen.hpp"
+#include "parallel_lexer.hpp"
+#include "source.hpp"
+#include "session.hpp"
+#include "thin_lto.hpp"
+#include "thread_pool.hpp"
+#include "typecheck.hpp"
+
+using namespace std;
+
+// a spawn target one input of several does not define, checked against
+// the others when they are linked
+struct ExternalSpawn {
+  string name;
+  string diagnostic;  // formatted against the spawning input's source
+};
+
+// one input after the middle end: an optimized module, or the objects its
+// -j partitions already emitted (with --thinlto, their summarized bitcode)
+struct CompiledFile {
+  unique_ptr<llvm::LLVMContext> context;
+  unique_ptr<llvm::Module> module;  // null when `objects` holds the code
+  vector<PartitionResult> objects;  // temporary objects, removed by the caller, or thin-link bitcode
+  bool defines_main = false;
+  vector<string> functions;         // names the input defines
+  vector<ExternalSpawn> external_spawns;
+};
+
+// helper to turn a message into an llvm::Error
+inline llvm::Error make_driver_error(string message)
+{
+  return llvm::createStringError(llvm::inconvertibleErrorCode(), message);
+}
+
+// helper to optimize a whole module: with the slot's reused pipeline, or a
+// fresh one that reports per-pass timings for --time-report
+inline auto optimize(llvm::Module& module, const CompileOptions& options, Backends& backends,
+                     llvm::TargetMachine& machine) -> llvm::Error
+{
+  if (options.time_report) {
+    return Optimizer(options.opt_level, &machine, /*time_passes=*/true, options.profile).run(module);
+  }
+  auto optimizer = backends.optimizer();
+  if (!optimizer) {
+    return optimizer.takeError();
+  }
+  return (*optimizer)->run(module);
+}
+
+// Read, lex, parse, generate and optimize one input with its own Interner,
+// CodeGen and LLVMContext. Phases are timed on `timers` and counted on
+// `stats`, which belong to the calling task. `emit_objects` lets -j
+// partitions emit native objects directly instead of being linked back.
+inline auto compile_file(const fs::path& input, const CompileOptions& options, bool emit_objects, bool require_main,
+                         Session& session, PhaseTimers& timers, CompileStats& stats) -> Expected<CompiledFile>
+{
+  auto& backends = session.backends(options.opt_level, options.profile);
+  auto machine = backends.machine();
+  if (!machine) {
+    return make_driver_error(format("Error: {}", llvm::toString(machine.takeError())));
+  }
+
+  // Read source file
+  timers.enter(Phase::read);
+  auto source_result = SourceFile::open(input);
+  if (!source_result) {
+    return make_driver_error(format("Error: {}", llvm::toString(source_result.takeError())));
+  }
+  const auto& source = *source_result;
+  stats.source_bytes = source.size();
+
+  // Tokenize; with -j large sources are lexed in chunks on the pool
+  timers.enter(Phase::lex);
+  auto interner = Interner();
+  const auto error_reporter = ErrorReporter(source.text(), source.filename());
+  auto tokens_result = options.jobs > 1 ? tokenize_parallel(source, interner, error_reporter, session.pool())
+                                        : Lexer(source, interner, error_reporter).tokenize();
+  if (!tokens_result) {
+    return tokens_result.takeError();
+  }
+  const auto tokens = std::move(*tokens_result);
+  stats.tokens = size(tokens);
+
+  // Parse
+  timers.enter(Phase::parse);
+  auto parser = Parser(tokens, interner, error_reporter, options.inputs.size() == 1);
+  auto program_result = parser.parse();
+  if (!program_result) {
+    return program_result.takeError();
+  }
+  auto program = std::move(*program_result);
+  stats.record_program(program);
+
+  CompiledFile compiled;
+  compiled.defines_main = parser.has_main_function(program);
+  for (const auto& function : program.functions) {
+    compiled.functions.emplace_back(interner.name(function.name.symbol));
+  }
+  for (const auto& target : program.external_spawns) {
+    const auto name = string(interner.name(target.symbol));
+    compiled.external_spawns.push_back(ExternalSpawn{
+      .name = name,
+      .diagnostic = error_reporter.format_error(format("Spawned function '{}' is not defined in any input", name),
+                                                target.offset),
+    });
+  }
+  if (require_main && !compiled.defines_main) {
+    return make_driver_error(error_reporter.format_error("Program must have a 'main' function"));
+  }
+
+  // Resolve the type of every expression
+  timers.enter(Phase::check);
+  if (auto result = TypeChecker::check(program, interner, error_reporter)) {
+    return result;
+  }
+
+  // Fold constants and simplify expressions, at every -O level
+  timers.enter(Phase::fold);
+  stats.folded_exprs = Folder::fold(program);
+
+  // Generate LLVM IR
+  timers.enter(Phase::codegen);
+  if (!options.cache_dir.empty()) {
+    // Reuse the optimized bitcode of unchanged functions and compile only
+    // the rest, one module per function; timed as codegen like -j
+    auto cache = session.cache(options.cache_dir, options, **machine);
+    if (!cache) {
+      return make_driver_error(format("Error: {}", llvm::toString(cache.takeError())));
+    }
+
+    compiled.context = make_unique<llvm::LLVMContext>();
+    auto module = compile_cached(session.pool(), backends, program, tokens, interner, **cache, *compiled.context,
+                                 **machine, stats);
+    if (!module) {
+      return module.takeError();
+    }
+    compiled.module = std::move(*module);
+  }
+  else if (options.jobs > 1) {
+    // Generate and optimize partitions of the program as pool tasks;
+    // executables are emitted per partition too and linked directly, or
+    // with --thinlto kept as summarized bitcode for a ThinLTO link. The
+    // whole parallel backend is timed as codegen.
+    const bool thin = emit_objects && options.thinlto;
+    auto partitions = compile_partitions(session.pool(), backends, program, interner, options, emit_objects && !thin,
+                                         thin);
+    if (!partitions) {
+      return partitions.takeError();
+    }
+    if (emit_objects) {
+      compiled.objects = std::move(*partitions);
+      return compiled;
+    }
+
+    compiled.context = make_unique<llvm::LLVMContext>();
+    auto module = link_partitions(*partitions, *compiled.context, **machine);
+    if (!module) {
+      return make_driver_error(format("Error: {}", llvm::toString(module.takeError())));
+    }
+    compiled.module = std::move(*module);
+  }
+  else {
+    auto codegen = CodeGen(interner);
+    if (auto result = codegen.generate(program)) {
+      return make_driver_error(format("Code generation error: {}", llvm::toString(std::move(result))));
+    }
+
+    // Optimize
+    timers.enter(Phase::optimize);
+    compiled.module = codegen.getModule();
+    compiled.context = codegen.getContext();
+    configure_module(*compiled.module, **machine);
+    if (auto result = optimize(*compiled.module, options, backends, **machine)) {
+      return make_driver_error(format("Optimization error: {}", llvm::toString(std::move(result))));
+    }
+  }
+
+  stats.record_module(*compiled.module);
+  return compiled;
+}
+
+// helper to collect the object paths of emitted partitions
+inline vector<string> object_paths(const vector<PartitionResult>& objects)
+{
+  vector<string> paths;
+  for (const auto& object : objects) {
+    paths.push_back(object.object_path);
+  }
+  return paths;
+}
+
+// Compile a single input and run, emit or link it; returns the exit code
+inline auto compile_single_input(const CompileOptions& options, Session& session, PhaseTimers& timers,
+                                 CompileStats& stats) -> Expected<int>
+{
+  const bool links = options.run || options.emit == EmitKind::exe;
+  auto compiled = compile_file(options.inputs.front(), options, !options.run && options.emit == EmitKind::exe, links,
+                               session, timers, stats);
+  if (!compiled) {
+    return compiled.takeError();
+  }
+
+  timers.enter(Phase::emit);
+  if (!compiled->module && options.thinlto) {
+    // the thin link tells modules apart by name
+    vector<string> names;
+    for (size_t i = 0; i < compiled->objects.size(); ++i) {
+      names.push_back(format("{}.partition{}", options.inputs.front().string(), i));
+    }
+    vector<llvm::MemoryBufferRef> buffers;
+    for (size_t i = 0; i < compiled->objects.size(); ++i) {
+      const auto& bitcode = compiled->objects[i].bitcode;
+      buffers.emplace_back(llvm::StringRef(bitcode.data(), bitcode.size()), names[i]);
+    }
+    auto objects = thin_link(buffers, options.opt_level, options.jobs);
+    if (!objects) {
+      return make_driver_error(format("Error: {}", llvm::toString(objects.takeError())));
+    }
+    auto result = link_executable(*objects, options.output, !options.profile.generate.empty());
+    for (const auto& object : *objects) {
+      llvm::sys::fs::remove(object);
+    }
+    if (result) {
+      return make_driver_error(format("Error: {}", llvm::toString(std::move(result))));
+    }
+    return EXIT_SUCCESS;
+  }
+  if (!compiled->module) {
+    auto result = link_executable(object_paths(compiled->objects), options.output, !options.profile.generate.empty());
+    remove_partition_objects(compiled->objects);
+    if (result) {
+      return make_driver_error(format("Error: {}", llvm::toString(std::move(result))));
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // Run in process instead of writing output
+  if (options.run) {
+    auto exit_code = run_jit(std::move(compiled->module), std::move(compiled->context), options.lazy, session.resident());
+    if (!exit_code) {
+      return make_driver_error(format("JIT error: {}", llvm::toString(exit_code.takeError())));
+    }
+    return *exit_code;
+  }
+
+  // Write output
+  auto machine = session.backends(options.opt_level, options.profile).machine();
+  if (!machine) {
+    return machine.takeError();
+  }
+  if (auto result = emit_module(*compiled->module, **machine, options.emit, options.output, options.thinlto,
+                                !options.profile.generate.empty())) {
+    return make_driver_error(format("Error: {}", llvm::toString(std::move(result))));
+  }
+  return EXIT_SUCCESS;
+}
+
+// what one input of a multi-file build leaves for the final step
+struct InputResult {
+  string error;                        // empty on success
+  llvm::SmallVector<char, 0> bitcode;  // husk run: linked and JIT-compiled; --thinlto: thin-linked
+  string object_path;                  // --emit=exe: temporary object to link
+  bool defines_main = false;
+  vector<string> functions;
+  vector<ExternalSpawn> external_spawns;
+  CompileStats stats;
+};
+
+// Compile several inputs as pool tasks, one file each with its own
+// Interner, CodeGen and LLVMContext. Without linking every input gets its
+// own output next to the working directory; with --emit=exe the objects are
+// linked into options.output, and `husk run` links their bitcode into one
+// module for the JIT. `--emit=exe --thinlto` keeps summarized bitcode and
+// runs a ThinLTO link before the native one. The parallel part is timed as
+// codegen, the final link or JIT as emit.
+inline auto compile_multiple_inputs(const CompileOptions& options, Session& session, PhaseTimers& timers,
+                                    CompileStats& stats) -> Expected<int>
+{
+  const bool links = options.run || options.emit == EmitKind::exe;
+  auto& pool = session.pool();
+  auto& backends = session.backends(options.opt_level, options.profile);
+
+  // the files themselves are the parallelism, so each is compiled serially,
+  // and concurrent per-pass reports would only interleave
+  auto file_options = options;
+  file_options.jobs = 1;
+  file_options.time_report = false;
+
+  timers.enter(Phase::codegen);
+  vector<InputResult> results(options.inputs.size());
+  TaskGroup group;
+  for (size_t i = 0; i < options.inputs.size(); ++i) {
+    pool.submit(group, [&, i] {
+      auto& result = results[i];
+      auto file_timers = PhaseTimers(false);
+      auto compiled = compile_file(options.inputs[i], file_options, false, false, session, file_timers, result.stats);
+      if (!compiled) {
+        result.error = llvm::toString(compiled.takeError());
+        return;
+      }
+      result.defines_main = compiled->defines_main;
+      result.functions = std::move(compiled->functions);
+      result.external_spawns = std::move(compiled->external_spawns);
+
+      if (options.run || (links && options.thinlto)) {
+        llvm::raw_svector_ostream os(result.bitcode);
+        write_bitcode_to(*compiled->module, os, options.thinlto);
+        return;
+      }
+
+      auto machine = backends.machine();
+      if (!machine) {
+        result.error = llvm::toString(machine.takeError());
+        return;
+      }
+      if (!links) {
+        const auto output = per_input_output_path(options.inputs[i], options.emit);
+        if (auto err = emit_module(*compiled->module, **machine, options.emit, output, options.thinlto)) {
+          result.error = format("Error: {}", llvm::toString(std::move(err)));
+        }
+        return;
+      }
+
+      llvm::SmallString<128> object_path;
+      if (auto ec = llvm::sys::fs::createTemporaryFile("husk", "o", object_path)) {
+        result.error = format("Error: Could not create temporary object: {}", ec.message());
+        return;
+      }
+      result.object_path = object_path.str().str();
+      if (auto err = write_native(*compiled->module, **machine, result.object_path, llvm::CodeGenFileType::ObjectFile)) {
+        result.error = format("Error: {}", llvm::toString(std::move(err)));
+      }
+    });
+  }
+  pool.wait(group);
+
+  // helper to delete the temporary objects once linked or on failure
+  const auto remove_objects = [&] {
+    for (const auto& result : results) {
+      if (!result.object_path.empty()) {
+        llvm::sys::fs::remove(result.object_path);
+      }
+    }
+  };
+
+  // report every failing input, not just the first
+  string errors;
+  for (const auto& result : results) {
+    if (!result.error.empty()) {
+      errors += errors.empty() ? result.error : "\n" + result.error;
+    }
+  }
+  if (!errors.empty()) {
+    remove_objects();
+    return make_driver_error(errors);
+  }
+
+  // a spawn target may be defined by any of the inputs
+  llvm::StringSet<> functions;
+  for (const auto& result : results) {
+    for (const auto& name : result.functions) {
+      functions.insert(name);
+    }
+  }
+  for (const auto& result : results) {
+    for (const auto& spawn : result.external_spawns) {
+      if (!functions.contains(spawn.name)) {
+        errors += errors.empty() ? spawn.diagnostic : "\n" + spawn.diagnostic;
+      }
+    }
+  }
+  if (!errors.empty()) {
+    remove_objects();
+    return make_driver_error(errors);
+  }
+
+  for (const auto& result : results) {
+    stats.merge(result.stats);
+  }
+  if (!links) {
+    return EXIT_SUCCESS;
+  }
+
+  if (none_of(results.begin(), results.end(), [](const InputResult& result) { return result.defines_main; })) {
+    remove_objects();
+    return make_driver_error("Error: None of the inputs defines a 'main' function");
+  }
+
+  timers.enter(Phase::emit);
+  vector<llvm::MemoryBufferRef> buffers;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& bitcode = results[i].bitcode;
+    buffers.emplace_back(llvm::StringRef(bitcode.data(), bitcode.size()), options.inputs[i].native());
+  }
+
+  if (options.run) {
+    auto machine = backends.machine();
+    if (!machine) {
+      return machine.takeError();
+    }
+
+    auto context = make_unique<llvm::LLVMContext>();
+    auto module = link_bitcode(buffers, *context, **machine);
+    if (!module) {
+      return make_driver_error(format("Error: {}", llvm::toString(module.takeError())));
+    }
+
+    auto exit_code = run_jit(std::move(*module), std::move(context), options.lazy, session.resident());
+    if (!exit_code) {
+      return make_driver_error(format("JIT error: {}", llvm::toString(exit_code.takeError())));
+    }
+    return *exit_code;
+  }
+
+  vector<string> objects;
+  if (options.thinlto) {
+    auto thin_objects = thin_link(buffers, options.opt_level, options.jobs);
+    if (!thin_objects) {
+      return make_driver_error(format("Error: {}", llvm::toString(thin_objects.takeError())));
+    }
+    objects = std::move(*thin_objects);
+  }
+  else {
+    for (const auto& result : results) {
+      objects.push_back(result.object_path);
+    }
+  }
+  auto result = link_executable(objects, options.output, !options.profile.generate.empty());
+  remove_objects();
+  if (options.thinlto) {
+    for (const auto& object : objects) {
+      llvm::sys::fs::remove(object);
+    }
+  }
+  if (result) {
+    return make_driver_error(format("Error: {}", llvm::toString(std::move(result))));
+  }
+  return EXIT_SUCCESS;
+}
+
+// Compile every input of the invocation on the session's pool; returns
+// the process exit code
+inline auto run_driver(const CompileOptions& options, Session& session, PhaseTimers& timers, CompileStats& stats)
+  -> Expected<int>
+{
+  if (options.inputs.size() == 1) {
+    return compile_single_input(options, session, timers, stats);
+  }
+  return compile_multiple_inputs(options, session, timers, stats);
+}
+
+// print whatever --time-report / --stats asked for
+inline void print_reports(const CompileOptions& options, PhaseTimers& timers, const CompileStats& stats)
+{
+  timers.stop();
+  if (options.time_report) {
+    timers.print(llvm::errs());
+  }
+  if (options.stats) {
+    stats.print(llvm::errs(), timers);
+  }
+}
+
+// One compiler invocation from parsed options to exit code, with errors
+// and reports written to stderr. Shared by main() and the compile server.
+inline int run_invocation(const CompileOptions& options, Session& session)
+{
+  auto timers = PhaseTimers(options.time_report);
+  auto stats = CompileStats();
+
+  // Compile, then emit, link or run every input
+  auto exit_code = run_driver(options, session, timers, stats);
+  if (!exit_code) {
+    println(cerr, "{}", llvm::toString(exit_code.takeError()));
+    return EXIT_FAILURE;
+  }
+  print_reports(options, timers, stats);
+  return *exit_code;
+}
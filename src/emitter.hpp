@@ -0,0 +1,245 @@
+#pragma once
+
+#include <format>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <llvm/Analysis/ModuleSummaryAnalysis.h>
+#include <llvm/Analysis/ProfileSummaryInfo.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FileUtilities.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/TargetParser/Host.h>
+#include "options.hpp"
+
+using namespace std;
+
+// helper to map -O<n> onto the backend's optimization levels
+inline llvm::CodeGenOptLevel codegen_opt_level(unsigned opt_level)
+{
+  switch (opt_level) {
+    case 0: return llvm::CodeGenOptLevel::None;
+    case 1: return llvm::CodeGenOptLevel::Less;
+    case 2: return llvm::CodeGenOptLevel::Default;
+    default: return llvm::CodeGenOptLevel::Aggressive;
+  }
+}
+
+// Create a target machine for the host
+inline auto create_target_machine(unsigned opt_level) -> Expected<unique_ptr<llvm::TargetMachine>>
+{
+  const auto triple = llvm::sys::getDefaultTargetTriple();
+
+  string error;
+  const auto* target = llvm::TargetRegistry::lookupTarget(triple, error);
+  if (!target) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not find target: {}", error));
+  }
+
+  auto* machine = target->createTargetMachine(
+#if LLVM_VERSION_MAJOR >= 21
+    llvm::Triple(triple),
+#else
+    triple,
+#endif
+    llvm::sys::getHostCPUName(),
+    "",
+    llvm::TargetOptions(),
+    llvm::Reloc::PIC_,
+    nullopt,
+    codegen_opt_level(opt_level)
+  );
+  if (!machine) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not create target machine for {}", triple));
+  }
+
+  return unique_ptr<llvm::TargetMachine>(machine);
+}
+
+// Stamp the module with the machine's triple and data layout so the
+// optimizer and backend agree on type sizes
+inline void configure_module(llvm::Module& module, const llvm::TargetMachine& machine)
+{
+#if LLVM_VERSION_MAJOR >= 21
+  module.setTargetTriple(machine.getTargetTriple());
+#else
+  module.setTargetTriple(machine.getTargetTriple().str());
+#endif
+  module.setDataLayout(machine.createDataLayout());
+}
+
+// helper to open an output file
+inline auto open_output(const fs::path& path, llvm::sys::fs::OpenFlags flags)
+    -> Expected<unique_ptr<llvm::raw_fd_ostream>>
+{
+  error_code ec;
+  auto dest = make_unique<llvm::raw_fd_ostream>(path.string(), ec, flags);
+  if (ec) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not open {}: {}", path.string(), ec.message()));
+  }
+  return dest;
+}
+
+// helper to close an output file and turn a failed write (e.g. a full
+// disk) into an error; left set, the stream's destructor would abort
+inline auto close_output(llvm::raw_fd_ostream& dest, const fs::path& path) -> llvm::Error
+{
+  dest.close();
+  if (dest.has_error()) {
+    const auto message = dest.error().message();
+    dest.clear_error();
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not write {}: {}", path.string(), message));
+  }
+  return llvm::Error::success();
+}
+
+// Write LLVM IR to file
+inline auto write_llvm_ir(llvm::Module& module, const fs::path& output_path) -> llvm::Error
+{
+  auto dest = open_output(output_path, llvm::sys::fs::OF_Text);
+  if (!dest) {
+    return dest.takeError();
+  }
+
+  module.print(**dest, nullptr);
+  return close_output(**dest, output_path);
+}
+
+// helper to write bitcode, with the module summary a ThinLTO link reads
+// instead of the IR when `summary` is set
+inline void write_bitcode_to(llvm::Module& module, llvm::raw_ostream& os, bool summary)
+{
+  if (!summary) {
+    llvm::WriteBitcodeToFile(module, os);
+    return;
+  }
+  llvm::ProfileSummaryInfo profile(module);
+  const auto index = llvm::buildModuleSummaryIndex(module, nullptr, &profile);
+  llvm::WriteBitcodeToFile(module, os, /*ShouldPreserveUseListOrder=*/false, &index);
+}
+
+// Write LLVM bitcode to file
+inline auto write_bitcode(llvm::Module& module, const fs::path& output_path, bool summary = false) -> llvm::Error
+{
+  auto dest = open_output(output_path, llvm::sys::fs::OF_None);
+  if (!dest) {
+    return dest.takeError();
+  }
+
+  write_bitcode_to(module, **dest, summary);
+  return close_output(**dest, output_path);
+}
+
+// Run the backend over the in-memory module to produce assembly or an object file
+inline auto write_native(llvm::Module& module, llvm::TargetMachine& machine, const fs::path& output_path,
+                         llvm::CodeGenFileType file_type) -> llvm::Error
+{
+  const auto flags = file_type == llvm::CodeGenFileType::AssemblyFile ? llvm::sys::fs::OF_Text : llvm::sys::fs::OF_None;
+  auto dest = open_output(output_path, flags);
+  if (!dest) {
+    return dest.takeError();
+  }
+
+  llvm::legacy::PassManager pass_manager;
+  if (machine.addPassesToEmitFile(pass_manager, **dest, nullptr, file_type)) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "Target machine cannot emit this file type");
+  }
+
+  pass_manager.run(module);
+  return close_output(**dest, output_path);
+}
+
+// The runtime library (runtime/husk_runtime.c) every executable links.
+// The build puts it next to the husk binary, which is where it is looked up.
+inline auto runtime_library_path() -> Expected<string>
+{
+  const auto self = llvm::sys::fs::getMainExecutable(nullptr, reinterpret_cast<void*>(&runtime_library_path));
+  const auto path = fs::path(self).parent_path() / "libhusk_runtime.a";
+  error_code ec;
+  if (self.empty() || !fs::exists(path, ec)) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not find the Husk runtime library '{}'", path.string()));
+  }
+  return path.string();
+}
+
+// Link object files and the runtime into an executable with the system C
+// compiler driver. Objects built with --profile-generate also need the
+// compiler-rt profile runtime; only clang's -fprofile-generate links it
+// (gcc's links gcov, and the program would write no profile).
+inline auto link_executable(const vector<string>& objects, const fs::path& output_path, bool profile_runtime = false)
+    -> llvm::Error
+{
+  const auto driver_name = profile_runtime ? "clang" : "cc";
+  auto driver = llvm::sys::findProgramByName(driver_name);
+  if (!driver) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not find '{}' to link the executable", driver_name));
+  }
+  auto runtime = runtime_library_path();
+  if (!runtime) {
+    return runtime.takeError();
+  }
+
+  vector<llvm::StringRef> args = {*driver};
+  for (const auto& object : objects) {
+    args.push_back(object);
+  }
+  args.push_back(*runtime);
+  args.push_back("-pthread");  // the runtime's scheduler threads
+  if (profile_runtime) {
+    args.push_back("-fprofile-generate");
+  }
+  const auto output = output_path.string();
+  args.push_back("-o");
+  args.push_back(output);
+
+  string error;
+  const int status = llvm::sys::ExecuteAndWait(*driver, args, nullopt, {}, 0, 0, &error);
+  if (status != 0) {
+    return llvm::createStringError(
+      llvm::inconvertibleErrorCode(),
+      error.empty() ? format("Linker exited with status {}", status) : format("Linker failed: {}", error)
+    );
+  }
+  return llvm::Error::success();
+}
+
+// Emit the module in the requested form; `thinlto` adds a summary to
+// bitcode and `profile_runtime` links an instrumented executable
+inline auto emit_module(llvm::Module& module, llvm::TargetMachine& machine, EmitKind emit, const fs::path& output_path,
+                        bool thinlto = false, bool profile_runtime = false) -> llvm::Error
+{
+  switch (emit) {
+    case EmitKind::ll:
+      return write_llvm_ir(module, output_path);
+    case EmitKind::bc:
+      return write_bitcode(module, output_path, thinlto);
+    case EmitKind::asm_:
+      return write_native(module, machine, output_path, llvm::CodeGenFileType::AssemblyFile);
+    case EmitKind::obj:
+      return write_native(module, machine, output_path, llvm::CodeGenFileType::ObjectFile);
+    case EmitKind::exe: {
+      // the object only lives long enough to be linked
+      llvm::SmallString<128> object_path;
+      if (auto ec = llvm::sys::fs::createTemporaryFile("husk", "o", object_path)) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not create temporary object: {}", ec.message()));
+      }
+      llvm::FileRemover remover(object_path);
+
+      if (auto err = write_native(module, machine, object_path.str().str(), llvm::CodeGenFileType::ObjectFile)) {
+        return err;
+      }
+      return link_executable({object_path.str().str()}, output_path, profile_runtime);
+    }
+  }
+  return llvm::createStringError(llvm::inconvertibleErrorCode(), "Unknown emit kind");
+}
@@ -1,10 +1,14 @@
 #pragma once
 
+#include <cstdint>
+#include <limits>
 #include <string>
 #include <string_view>
 #include <format>
 #include <vector>
-#include <sstream>
+#include <algorithm>
+#include <mutex>
+#include "simd_scan.hpp"
 
 using namespace std;
 
@@ -15,18 +19,33 @@ namespace Color {
   constexpr string_view RESET = "\033[0m";
 }
 
+// parsing stops after this many errors; the rest are likely fallout
+inline constexpr size_t MAX_ERRORS = 100;
+
+// Formats diagnostics against a borrowed source buffer. The line index is
+// only built when the first located diagnostic is formatted, so compiles
+// without errors never scan the source for it. One reporter is shared by
+// every phase of a compile.
+//
+// Phases that recover from errors report them here instead of returning
+// the first one; the parser turns the collection into a single error at
+// the end. Reporting is thread safe, like the lazily built line index.
 class ErrorReporter {
 public:
-  explicit ErrorReporter(string source, string filename = "") 
-    : m_source(move(source)), m_filename(move(filename)) {
-    // Split source into lines for easy access
-    stringstream ss(m_source);
-    string line;
-    while (getline(ss, line)) {
-      m_lines.push_back(line);
-    }
+  // a formatted error and the source offset it points at, for ordering
+  struct Diagnostic {
+    uint32_t offset = numeric_limits<uint32_t>::max();  // max for errors without location
+    string text;
+  };
+
+  // source is borrowed and must outlive the reporter
+  explicit ErrorReporter(string_view source, string filename = "") 
+    : m_source(source), m_filename(move(filename)) {
   }
 
+  ErrorReporter(const ErrorReporter&) = delete;
+  ErrorReporter& operator=(const ErrorReporter&) = delete;
+
   // Format error with source line and caret pointing to the error
   string format_error(string_view message, size_t line, size_t column) const {
     string result;
@@ -37,15 +56,14 @@ public:
       Color::BOLD, Color::RED, Color::RESET, message, location_info);
     
     // Show context: previous line (if available) and the error line
-    if (line > 0 && line <= m_lines.size()) {
+    if (line > 0 && line <= line_count()) {
       // Show previous line for context (if it exists)
       if (line > 1) {
-        const auto& prev_line = m_lines[line - 2];
-        result += format("  {} | {}\n", line - 1, prev_line);
+        result += format("  {} | {}\n", line - 1, line_text(line - 1));
       }
       
       // Show the line where the error occurred
-      const auto& source_line = m_lines[line - 1];
+      const auto source_line = line_text(line);
       result += format("  {} | {}\n", line, source_line);
       
       // Add caret pointing to the column - ensure column is within bounds
@@ -59,15 +77,84 @@ public:
     return result;
   }
 
+  // Format error at a byte offset into the source
+  string format_error(string_view message, uint32_t offset) const {
+    const auto& starts = line_starts();
+    // the line is the last one starting at or before the offset
+    const auto it = upper_bound(starts.begin(), starts.end(), offset);
+    const size_t line = static_cast<size_t>(it - starts.begin());
+    return format_error(message, line, offset - starts[line - 1] + 1);
+  }
+
   // Format error without location info
   string format_error(string_view message) const {
     return format("{}{}Error:{} {}", 
       Color::BOLD, Color::RED, Color::RESET, message);
   }
 
+  // Collect a diagnostic
+  void report(Diagnostic diagnostic) const {
+    lock_guard lock(m_diagnostics_mutex);
+    m_diagnostics.push_back(move(diagnostic));
+  }
+
+  // Collect an error at a byte offset into the source
+  void report(string_view message, uint32_t offset) const {
+    report(Diagnostic{.offset = offset, .text = format_error(message, offset)});
+  }
+
+  size_t error_count() const {
+    lock_guard lock(m_diagnostics_mutex);
+    return m_diagnostics.size();
+  }
+
+  // every collected diagnostic in source order, those without location last
+  string diagnostics() const {
+    lock_guard lock(m_diagnostics_mutex);
+    auto sorted = m_diagnostics;
+    stable_sort(sorted.begin(), sorted.end(), [](const Diagnostic& a, const Diagnostic& b) { return a.offset < b.offset; });
+
+    string result;
+    for (const auto& diagnostic : sorted) {
+      result += result.empty() ? diagnostic.text : "\n" + diagnostic.text;
+    }
+    if (sorted.size() >= MAX_ERRORS) {
+      result += format("\n{}{}Error:{} Too many errors, stopping after {}", Color::BOLD, Color::RED, Color::RESET, sorted.size());
+    }
+    return result;
+  }
+
 private:
-  string m_source;
+  // byte offset of the first character of every line, built on first use
+  const vector<uint32_t>& line_starts() const {
+    call_once(m_line_starts_once, [this] {
+      m_line_starts.reserve(simd_scan::count_newlines(m_source) + 1);
+      m_line_starts.push_back(0);
+      simd_scan::for_each_newline(m_source, [this](size_t offset) {
+        m_line_starts.push_back(static_cast<uint32_t>(offset + 1));
+      });
+    });
+    return m_line_starts;
+  }
+
+  // number of lines, not counting the empty one after a trailing newline
+  size_t line_count() const {
+    const auto& starts = line_starts();
+    return m_source.empty() || m_source.back() == '\n' ? starts.size() - 1 : starts.size();
+  }
+
+  // text of a 1-based line without its newline
+  string_view line_text(size_t line) const {
+    const auto& starts = line_starts();
+    const size_t begin = starts[line - 1];
+    const size_t end = line < starts.size() ? starts[line] - 1 : m_source.length();
+    return m_source.substr(begin, end - begin);
+  }
+
+  string_view m_source;
   string m_filename;
-  vector<string> m_lines;
+  mutable once_flag m_line_starts_once;
+  mutable vector<uint32_t> m_line_starts;
+  mutable mutex m_diagnostics_mutex;
+  mutable vector<Diagnostic> m_diagnostics;
 };
-
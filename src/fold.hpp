@@ -0,0 +1,167 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <variant>
+#include "ast.hpp"
+
+using namespace std;
+
+// AST folding and simplification, run on every program after type
+// checking and before IR generation so even -O0 emits no instructions for
+// work known at compile time. Nodes are rewritten in place in the arena
+// and keep the type the TypeChecker gave them:
+//   - operations on two literals become a literal (arithmetic wraps at the
+//     node's width like the IR, a comparison gives 1 or 0)
+//   - x + 0, 0 + x, x - 0, x * 1, 1 * x and x / 1 become x
+//   - x * 2^k and 2^k * x become a shift, x / 2^k a signed shift sequence
+// Division by zero and the minimum value divided by -1 are left for run time.
+class Folder
+{
+public:
+  explicit Folder(ASTArena& arena)
+    : m_arena(arena)
+  {
+  }
+
+  // Fold every expression of the program; returns how many were
+  // simplified. The parser adds every node after its operands, so one pass
+  // in arena order visits operands first without recursing down the tree.
+  static size_t fold(ASTProgram& program)
+  {
+    auto folder = Folder(program.arena);
+    for (ExprId id = 0; id < program.arena.expr_count(); ++id) {
+      folder.fold_node(id);
+    }
+    return folder.m_folded;
+  }
+
+  // fold one node whose operands are already folded
+  void fold_node(ExprId id)
+  {
+    // nothing is added to the arena while folding, so this stays valid
+    auto* bin = get_if<ASTBinaryExpr>(&m_arena.expr(id).var);
+    if (!bin) {
+      return;
+    }
+
+    const auto lhs = literal(bin->lhs);
+    const auto rhs = literal(bin->rhs);
+
+    const Type type = m_arena.expr(id).type;
+    if (lhs && rhs) {
+      if (auto value = evaluate(bin->kind, *lhs, *rhs, type.bits())) {
+        m_arena.expr(id) = ASTExpr{.var = ASTPrimaryExpr{.int_lit = Token::int_lit(*value, bin->op.offset)}, .type = type};
+        ++m_folded;
+        return;
+      }
+    }
+
+    if (rhs && is_right_identity(bin->kind, *rhs)) {
+      replace(id, bin->lhs);
+      return;
+    }
+    if (lhs && is_left_identity(bin->kind, *lhs)) {
+      replace(id, bin->rhs);
+      return;
+    }
+
+    // strength reduction; a power of two on the left of * moves to the right
+    if (bin->kind == BinaryOp::mul && lhs && is_power_of_two(*lhs) && !rhs) {
+      swap(bin->lhs, bin->rhs);
+      reduce(*bin, BinaryOp::shl, *lhs);
+    }
+    else if (bin->kind == BinaryOp::mul && rhs && is_power_of_two(*rhs)) {
+      reduce(*bin, BinaryOp::shl, *rhs);
+    }
+    else if (bin->kind == BinaryOp::div && rhs && is_power_of_two(*rhs)) {
+      reduce(*bin, BinaryOp::div_pow2, *rhs);
+    }
+  }
+
+private:
+  // helper to read a node's value if it is a literal
+  optional<int64_t> literal(ExprId id) const
+  {
+    const auto* primary = get_if<ASTPrimaryExpr>(&m_arena.expr(id).var);
+    if (!primary || !primary->int_lit) {
+      return nullopt;
+    }
+    return primary->int_lit->value();
+  }
+
+  // Arithmetic as the generated IR performs it on operands of `bits` bits,
+  // which the operands already fit; nullopt where that traps or is
+  // undefined. A comparison's width is that of its 1 or 0, not of its
+  // operands, and does not matter here.
+  static optional<int64_t> evaluate(BinaryOp kind, int64_t lhs, int64_t rhs, unsigned bits)
+  {
+    const auto a = static_cast<uint64_t>(lhs);
+    const auto b = static_cast<uint64_t>(rhs);
+    const auto wrap = [bits](uint64_t value) {
+      return bits == 32 ? static_cast<int32_t>(static_cast<uint32_t>(value)) : static_cast<int64_t>(value);
+    };
+    switch (kind) {
+      case BinaryOp::add: return wrap(a + b);
+      case BinaryOp::sub: return wrap(a - b);
+      case BinaryOp::mul: return wrap(a * b);
+      case BinaryOp::shl:
+        if (b >= bits) {
+          return nullopt;
+        }
+        return wrap(a << b);
+      case BinaryOp::div: {
+        const int64_t min = bits == 32 ? INT32_MIN : INT64_MIN;
+        if (rhs == 0 || (lhs == min && rhs == -1)) {
+          return nullopt;
+        }
+        return lhs / rhs;
+      }
+      case BinaryOp::div_pow2: return lhs / (int64_t{1} << b);
+      case BinaryOp::lt: return lhs < rhs;
+      case BinaryOp::le: return lhs <= rhs;
+      case BinaryOp::gt: return lhs > rhs;
+      case BinaryOp::ge: return lhs >= rhs;
+      case BinaryOp::eq: return lhs == rhs;
+      case BinaryOp::ne: return lhs != rhs;
+    }
+    return nullopt;
+  }
+
+  static bool is_right_identity(BinaryOp kind, int64_t value)
+  {
+    return ((kind == BinaryOp::add || kind == BinaryOp::sub) && value == 0)
+        || ((kind == BinaryOp::mul || kind == BinaryOp::div) && value == 1);
+  }
+
+  static bool is_left_identity(BinaryOp kind, int64_t value)
+  {
+    return (kind == BinaryOp::add && value == 0) || (kind == BinaryOp::mul && value == 1);
+  }
+
+  // 2^k for k >= 1; a literal is positive and fits its width, so k stays below the sign bit
+  static bool is_power_of_two(int64_t value)
+  {
+    return value > 1 && has_single_bit(static_cast<uint64_t>(value));
+  }
+
+  // helper to turn the node into a shift whose amount replaces the literal on the right
+  void reduce(ASTBinaryExpr& bin, BinaryOp kind, int64_t power)
+  {
+    auto& amount = *get<ASTPrimaryExpr>(m_arena.expr(bin.rhs).var).int_lit;
+    amount = Token::int_lit(countr_zero(static_cast<uint64_t>(power)), amount.offset);
+    bin.kind = kind;
+    ++m_folded;
+  }
+
+  // helper to replace a node by one of its operands
+  void replace(ExprId id, ExprId operand)
+  {
+    m_arena.expr(id) = ASTExpr(m_arena.expr(operand));
+    ++m_folded;
+  }
+
+  ASTArena& m_arena;
+  size_t m_folded = 0;
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Timer.h>
+#include <llvm/Support/raw_ostream.h>
+#include "ast.hpp"
+
+using namespace std;
+
+// compiler phases in pipeline order
+enum class Phase
+{
+  read,
+  lex,
+  parse,
+  check,
+  fold,
+  codegen,
+  optimize,
+  emit,
+  count
+};
+
+inline constexpr array<string_view, static_cast<size_t>(Phase::count)> PHASE_NAMES = {
+  "read", "lex", "parse", "check", "fold", "codegen", "optimize", "emit"
+};
+
+inline constexpr array<string_view, static_cast<size_t>(Phase::count)> PHASE_DESCRIPTIONS = {
+  "Read source", "Lexing", "Parsing", "Type checking", "AST folding", "IR generation", "Optimization", "Emission or JIT execution"
+};
+
+// helper to read the process's peak resident set size in bytes
+inline uint64_t peak_rss_bytes()
+{
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return static_cast<uint64_t>(usage.ru_maxrss);         // bytes on macOS
+#else
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;  // kilobytes on Linux
+#endif
+}
+
+// Times the compiler's phases one after another. Wall-clock durations are
+// always kept (they are two clock reads per phase) so --stats can report
+// throughput; the llvm::TimerGroup with wall/user/system time and malloc
+// deltas only runs for --time-report.
+class PhaseTimers
+{
+public:
+  explicit PhaseTimers(bool enabled)
+    : m_enabled(enabled), m_group("husk", "Husk compilation phases")
+  {
+    for (size_t i = 0; i < m_timers.size(); ++i) {
+      m_timers[i].init(PHASE_NAMES[i], PHASE_DESCRIPTIONS[i], m_group);
+    }
+  }
+
+  ~PhaseTimers()
+  {
+    stop();
+  }
+
+  // stop the running phase (if any) and start timing the next one
+  void enter(Phase phase)
+  {
+    stop();
+    m_current = phase;
+    m_started = chrono::steady_clock::now();
+    if (m_enabled) {
+      timer(phase).startTimer();
+    }
+  }
+
+  void stop()
+  {
+    if (!m_current) {
+      return;
+    }
+
+    const auto phase = *m_current;
+    m_current.reset();
+    m_wall[index(phase)] += chrono::duration<double>(chrono::steady_clock::now() - m_started).count();
+    m_peak_rss[index(phase)] = peak_rss_bytes();
+    if (m_enabled) {
+      timer(phase).stopTimer();
+    }
+  }
+
+  double wall_seconds(Phase phase) const
+  {
+    return m_wall[index(phase)];
+  }
+
+  // print the phase table followed by the peak RSS reached in each phase
+  void print(llvm::raw_ostream& os)
+  {
+    stop();
+    if (!m_enabled) {
+      return;
+    }
+
+    m_group.print(os, /*ResetAfterPrint=*/true);
+    os << "Peak resident set size at the end of each phase:\n";
+    for (size_t i = 0; i < m_peak_rss.size(); ++i) {
+      if (m_peak_rss[i] != 0) {
+        os << format("  {:<10} {:>10.2f} MiB\n", PHASE_NAMES[i], static_cast<double>(m_peak_rss[i]) / (1024.0 * 1024.0));
+      }
+    }
+  }
+
+private:
+  static size_t index(Phase phase)
+  {
+    return static_cast<size_t>(phase);
+  }
+
+  llvm::Timer& timer(Phase phase)
+  {
+    return m_timers[index(phase)];
+  }
+
+  bool m_enabled;
+  llvm::TimerGroup m_group;
+  array<llvm::Timer, static_cast<size_t>(Phase::count)> m_timers;
+  array<double, static_cast<size_t>(Phase::count)> m_wall{};
+  array<uint64_t, static_cast<size_t>(Phase::count)> m_peak_rss{};
+  optional<Phase> m_current;
+  chrono::steady_clock::time_point m_started;
+};
+
+// Counters reported by --stats
+struct CompileStats {
+  size_t source_bytes = 0;
+  size_t tokens = 0;
+  size_t ast_nodes = 0;
+  size_t folded_exprs = 0;  // expressions the fold pass simplified
+  vector<pair<string, unsigned>> instructions_per_function;
+  size_t cache_hits = 0;    // functions loaded from the --cache directory
+  size_t cache_misses = 0;  // functions compiled and stored there
+
+  void record_program(const ASTProgram& program)
+  {
+    ast_nodes = program.arena.expr_count() + program.arena.stmt_count() + program.functions.size();
+  }
+
+  void record_module(const llvm::Module& module)
+  {
+    instructions_per_function.clear();
+    for (const auto& function : module) {
+      if (!function.isDeclaration()) {
+        instructions_per_function.emplace_back(function.getName().str(), function.getInstructionCount());
+      }
+    }
+  }
+
+  // add the counters of another input of a multi-file build
+  void merge(const CompileStats& other)
+  {
+    source_bytes += other.source_bytes;
+    tokens += other.tokens;
+    ast_nodes += other.ast_nodes;
+    folded_exprs += other.folded_exprs;
+    cache_hits += other.cache_hits;
+    cache_misses += other.cache_misses;
+    instructions_per_function.insert(instructions_per_function.end(), other.instructions_per_function.begin(),
+                                     other.instructions_per_function.end());
+  }
+
+  void print(llvm::raw_ostream& os, const PhaseTimers& timers) const
+  {
+    const double lex_seconds = timers.wall_seconds(Phase::lex);
+    const double tokens_per_second = lex_seconds > 0 ? static_cast<double>(tokens) / lex_seconds : 0.0;
+
+    os << "Husk statistics:\n";
+    os << format("  {:<24} {}\n", "source bytes", source_bytes);
+    os << format("  {:<24} {}\n", "tokens", tokens);
+    os << format("  {:<24} {:.0f}\n", "tokens/sec", tokens_per_second);
+    os << format("  {:<24} {}\n", "AST nodes", ast_nodes);
+    os << format("  {:<24} {}\n", "folded expressions", folded_exprs);
+    if (cache_hits + cache_misses > 0) {
+      os << format("  {:<24} {}\n", "cache hits", cache_hits);
+      os << format("  {:<24} {}\n", "cache misses", cache_misses);
+    }
+    os << "  IR instructions per function:\n";
+    for (const auto& [name, count] : instructions_per_function) {
+      os << format("    {:<22} {}\n", name, count);
+    }
+  }
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
+
+// Maps identifier and literal spellings to dense 32-bit symbol IDs.
+// Spellings are views into the source buffer, so the interner must not
+// outlive the buffer it was filled from.
+class Interner
+{
+public:
+  std::uint32_t intern(std::string_view text)
+  {
+    auto [it, inserted] = m_ids.try_emplace(llvm::StringRef(text.data(), text.size()),
+                                            static_cast<std::uint32_t>(m_names.size()));
+    if (inserted) {
+      m_names.push_back(text);
+    }
+    return it->second;
+  }
+
+  std::string_view name(std::uint32_t symbol) const
+  {
+    return m_names[symbol];
+  }
+
+  std::size_t size() const
+  {
+    return m_names.size();
+  }
+
+private:
+  llvm::DenseMap<llvm::StringRef, std::uint32_t> m_ids;
+  std::vector<std::string_view> m_names;
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/raw_ostream.h>
+#include "husk_runtime.h"
+
+using namespace std;
+
+template<typename T>
+using Expected = llvm::Expected<T>;
+
+// helper to make host process symbols (libc, ...) visible to jitted code
+inline auto link_process_symbols(llvm::orc::LLJIT& jit) -> llvm::Error
+{
+  auto generator = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+    jit.getDataLayout().getGlobalPrefix()
+  );
+  if (!generator) {
+    return generator.takeError();
+  }
+  jit.getMainJITDylib().addGenerator(std::move(*generator));
+  return llvm::Error::success();
+}
+
+// Helper to define the runtime library's entry points for jitted code. The
+// compiler links the runtime itself, so its own copies are used.
+inline auto link_runtime_symbols(llvm::orc::LLJIT& jit) -> llvm::Error
+{
+  const auto flags = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+  llvm::orc::SymbolMap symbols;
+  symbols[jit.mangleAndIntern("husk_print_i32")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_print_i32), flags};
+  symbols[jit.mangleAndIntern("husk_print_i64")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_print_i64), flags};
+  symbols[jit.mangleAndIntern("husk_flush")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_flush), flags};
+  symbols[jit.mangleAndIntern("husk_channel_new")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_channel_new), flags};
+  symbols[jit.mangleAndIntern("husk_channel_send")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_channel_send), flags};
+  symbols[jit.mangleAndIntern("husk_channel_receive")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_channel_receive), flags};
+  symbols[jit.mangleAndIntern("husk_spawn")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_spawn), flags};
+  symbols[jit.mangleAndIntern("husk_array_alloc")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_array_alloc), flags};
+  symbols[jit.mangleAndIntern("husk_array_free")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_array_free), flags};
+  symbols[jit.mangleAndIntern("husk_array_alloc_chained")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_array_alloc_chained), flags};
+  symbols[jit.mangleAndIntern("husk_array_free_chain")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_array_free_chain), flags};
+  symbols[jit.mangleAndIntern("husk_index_fail")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_index_fail), flags};
+  symbols[jit.mangleAndIntern("husk_slice_fail")] = {llvm::orc::ExecutorAddr::fromPtr(&husk_slice_fail), flags};
+  return jit.getMainJITDylib().define(llvm::orc::absoluteSymbols(std::move(symbols)));
+}
+
+// helper to build an eager or lazy (compile-on-demand) JIT holding the module
+inline auto create_jit(llvm::orc::ThreadSafeModule module, bool lazy) -> Expected<unique_ptr<llvm::orc::LLJIT>>
+{
+  if (lazy) {
+    // LLLazyJIT routes the module through a CompileOnDemandLayer, so each
+    // function is only compiled the first time it is called
+    auto jit = llvm::orc::LLLazyJITBuilder().create();
+    if (!jit) {
+      return jit.takeError();
+    }
+    if (auto err = link_process_symbols(**jit)) {
+      return std::move(err);
+    }
+    if (auto err = link_runtime_symbols(**jit)) {
+      return std::move(err);
+    }
+    if (auto err = (*jit)->addLazyIRModule(std::move(module))) {
+      return std::move(err);
+    }
+    return unique_ptr<llvm::orc::LLJIT>(std::move(*jit));
+  }
+
+  auto jit = llvm::orc::LLJITBuilder().create();
+  if (!jit) {
+    return jit.takeError();
+  }
+  if (auto err = link_process_symbols(**jit)) {
+    return std::move(err);
+  }
+  if (auto err = link_runtime_symbols(**jit)) {
+    return std::move(err);
+  }
+  if (auto err = (*jit)->addIRModule(std::move(module))) {
+    return std::move(err);
+  }
+  return std::move(*jit);
+}
+
+// what running main() came to
+struct RunOutcome {
+  int exit_code = EXIT_FAILURE;
+  long blocked = 0;  // tasks, main included, left blocked on channels forever
+};
+
+// helper to call main() and wait for the tasks it spawned
+inline RunOutcome run_main(int (*main_fn)())
+{
+  RunOutcome outcome;
+  outcome.exit_code = husk_run_main(main_fn);
+  outcome.blocked = husk_shutdown();
+  return outcome;
+}
+
+// Run main() in a forked child, for the compile server: a failed bounds
+// check exits the program (with status 2), which must not take the server
+// with it. The child sends its outcome back through a pipe; one that
+// exits without sending it exited through the runtime.
+inline auto run_main_isolated(int (*main_fn)()) -> Expected<RunOutcome>
+{
+  int fds[2];
+  if (::pipe(fds) < 0) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   format("Could not create a pipe to run the program: {}", strerror(errno)));
+  }
+  fflush(stdout);
+  fflush(stderr);
+  llvm::outs().flush();
+  llvm::errs().flush();
+
+  const pid_t child = ::fork();
+  if (child < 0) {
+    const int error = errno;
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   format("Could not start the program: {}", strerror(error)));
+  }
+  if (child == 0) {
+    ::close(fds[0]);
+    const auto outcome = run_main(main_fn);
+    [[maybe_unused]] const auto written = ::write(fds[1], &outcome, sizeof(outcome));
+    _exit(EXIT_SUCCESS);
+  }
+
+  ::close(fds[1]);
+  RunOutcome outcome;
+  ssize_t received;
+  do {
+    received = ::read(fds[0], &outcome, sizeof(outcome));
+  } while (received < 0 && errno == EINTR);
+  ::close(fds[0]);
+  int status = 0;
+  while (::waitpid(child, &status, 0) < 0 && errno == EINTR) {
+  }
+
+  if (received == sizeof(outcome)) {
+    return outcome;
+  }
+  if (WIFEXITED(status)) {
+    return RunOutcome{.exit_code = WEXITSTATUS(status)};
+  }
+  return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                 format("The program was killed by signal {}", WTERMSIG(status)));
+}
+
+// Run the module's main() and return its exit code: in process, or in a
+// child process when `isolated`
+inline auto run_jit(unique_ptr<llvm::Module> module, unique_ptr<llvm::LLVMContext> context, bool lazy, bool isolated)
+    -> Expected<int>
+{
+  auto jit = create_jit(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)), lazy);
+  if (!jit) {
+    return jit.takeError();
+  }
+
+  auto main_symbol = (*jit)->lookup("main");
+  if (!main_symbol) {
+    return main_symbol.takeError();
+  }
+
+  // Spawned tasks may still be running on the scheduler's threads and the
+  // program's output is buffered in this process: wait for the tasks and
+  // write it all before husk prints anything else or frees the code.
+  auto* main_fn = main_symbol->toPtr<int (*)()>();
+  auto outcome = isolated ? run_main_isolated(main_fn) : Expected<RunOutcome>(run_main(main_fn));
+  if (!outcome) {
+    return outcome.takeError();
+  }
+  if (outcome->blocked > 0) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   format("Deadlock: {} {} blocked on channels forever", outcome->blocked,
+                                          outcome->blocked == 1 ? "task is" : "tasks are"));
+  }
+  return outcome->exit_code;
+}
@@ -1,11 +1,17 @@
 #pragma once
 
+#include <algorithm>
+#include <charconv>
 #include <format>
 #include <string>
+#include <utility>
 #include <vector>
-#include <cctype>
 #include <llvm/Support/Error.h>
 #include "error_reporting.hpp"
+#include "interner.hpp"
+#include "simd_scan.hpp"
+#include "source.hpp"
+#include "token_buffer.hpp"
 #include "tokens.hpp"
 
 template<typename T>
@@ -16,90 +22,183 @@ using namespace std;
 class Lexer
 {
 public:
-  inline explicit Lexer(string src, string filename = "") 
-    : m_src(src), m_error_reporter(move(src), move(filename))
+  // the source must outlive the tokens and the interner's entries
+  inline explicit Lexer(const SourceFile& source, Interner& interner, const ErrorReporter& error_reporter) 
+    : m_src(source.text()), m_interner(interner), m_error_reporter(error_reporter)
   {
   }
   
-  auto tokenize() -> Expected<vector<Token>>
+  // Produce the next token on demand; nullopt once the input is exhausted.
+  // Lexical errors go to the error reporter.
+  auto next() -> Expected<optional<Token>>
   {
-    vector<Token> tokens;
-    size_t index = 0;
-    size_t line = 1;
-    size_t column = 1;
+    if (auto err = check_size()) {
+      return std::move(err);
+    }
     
-    while (index < m_src.length()) {
-      // Skip whitespace
-      if (skip_whitespace(index, line, column)) {
-        continue;
-      }
-      
-      // Try to lex a token using registered parsers
-      auto token_result = parse_next_token(index, line, column);
-      if (!token_result) {
-        return token_result.takeError();
+    optional<Token> token;
+    while (!token) {
+      skip_whitespace();
+      if (m_index >= m_src.length()) {
+        break;
       }
-      
-      tokens.push_back(*token_result);
+      token = parse_next_token(m_index);
     }
-    
+    report_diagnostics();
+    return token;
+  }
+  
+  // Lex the whole input up front. Lexical errors go to the error reporter
+  // and lexing goes on after them; only a source too large to lex fails.
+  auto tokenize() -> Expected<TokenBuffer>
+  {
+    TokenBuffer tokens;
+    auto end = tokenize_range(0, m_src.length(), tokens);
+    if (!end) {
+      return end.takeError();
+    }
+    report_diagnostics();
     return tokens;
   }
+  
+  // Append the tokens that start in [begin, end) to `tokens`. Returns where
+  // lexing resumes: the start of the next token, or the end of the input.
+  // A token may run past `end`; parallel lexing relies on the return value
+  // to notice that. Lexical errors are kept for take_diagnostics().
+  auto tokenize_range(size_t begin, size_t end, TokenBuffer& tokens) -> Expected<size_t>
+  {
+    if (auto err = check_size()) {
+      return std::move(err);
+    }
+    
+    m_index = begin;
+    end = min(end, m_src.length());
+    while (true) {
+      skip_whitespace();
+      if (m_index >= end) {
+        return m_index;
+      }
+      if (auto token = parse_next_token(m_index)) {
+        tokens.push_back(*token);
+      }
+    }
+  }
+
+  // the lexical errors found so far, in source order
+  auto take_diagnostics() -> vector<ErrorReporter::Diagnostic>
+  {
+    return exchange(m_diagnostics, {});
+  }
 
 private:
-  // Skip whitespace and update line/column tracking
-  bool skip_whitespace(size_t& index, size_t& line, size_t& column)
+  // Lex the next token, dispatching on its first byte; nullopt after
+  // skipping bytes no token starts with
+  auto parse_next_token(size_t& index) -> optional<Token>
   {
-    if (index >= m_src.length()) {
-      return false;
+    const auto offset = static_cast<uint32_t>(index);
+    const char current = m_src[index];
+    switch (char_table[current]) {
+      case CharClass::digit:
+        return lex_int_lit(index);
+      case CharClass::alpha:
+        return lex_word(index);
+      case CharClass::op: {
+        const auto byte = static_cast<unsigned char>(current);
+        if (char_table.pair_second[byte] != 0 && index + 1 < m_src.length() && m_src[index + 1] == char_table.pair_second[byte]) {
+          index += 2;
+          return Token{.type = char_table.pair_types[byte], .offset = offset, .length = 2};
+        }
+        index++;
+        if (char_table.single_op[byte]) {
+          return Token{.type = char_table.op_types[byte], .offset = offset, .length = 1};
+        }
+        // the first half of a two-character operator on its own, like '!'
+        add_diagnostic(format("Unexpected character '{}'", current), offset);
+        return nullopt;
+      }
+      default:
+        break;
     }
     
-    char current = m_src[index];
-    if (!isspace(current)) {
-      return false;
+    // No token starts with this byte: one error for the whole run of them
+    add_diagnostic(format("Unexpected character '{}'", current), offset);
+    while (index < m_src.length() && char_table[m_src[index]] == CharClass::invalid) {
+      index++;
     }
-    
-    if (current == '\n') {
-      line++;
-      column = 1;
-    } else {
-      column++;
+    return nullopt;
+  }
+
+  void add_diagnostic(string_view message, uint32_t offset)
+  {
+    m_diagnostics.push_back({.offset = offset, .text = m_error_reporter.format_error(message, offset)});
+  }
+
+  // helper to hand the collected errors to the reporter
+  void report_diagnostics()
+  {
+    for (auto& diagnostic : take_diagnostics()) {
+      m_error_reporter.report(std::move(diagnostic));
     }
-    
-    index++;
-    return true;
   }
-  
-  // Lex the next token using registered parsers
-  auto parse_next_token(size_t& index, size_t line, size_t column) -> Expected<Token>
+
+  // token offsets are 32-bit
+  auto check_size() const -> llvm::Error
   {
-    if (index >= m_src.length()) {
-      return llvm::createStringError(
-        llvm::inconvertibleErrorCode(),
-        m_error_reporter.format_error("Unexpected end of input", line, column)
-      );
+    if (m_src.length() > UINT32_MAX) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), m_error_reporter.format_error("Source file is larger than 4 GiB"));
     }
+    return llvm::Error::success();
+  }
+
+  void skip_whitespace()
+  {
+    m_index = simd_scan::skip_whitespace(m_src, m_index);
+  }
+
+  // integer literal: [0-9]+, parsed here once into its value; one that
+  // does not fit in 64 bits is reported and lexed as 0 so parsing can go
+  // on. Whether it fits the width it gets is up to the TypeChecker.
+  Token lex_int_lit(size_t& index)
+  {
+    const size_t start = index;
+    index = simd_scan::digits_end(m_src, index);
     
-    // Try each registered parser in order
-    const auto& parsers = TokenRegistry::get_parsers();
-    for (const auto& parser : parsers) {
-      if (parser->matches(m_src, index)) {
-        auto result = parser->parse(m_src, index, line, column);
-        if (result) {
-          return result;
-        }
-        // If parsing failed, try next parser
-      }
+    const auto spelling = m_src.substr(start, index - start);
+    int64_t value = 0;
+    const auto [end, ec] = from_chars(spelling.data(), spelling.data() + spelling.size(), value);
+    if (ec != errc()) {
+      add_diagnostic(format("Integer literal '{}' does not fit in 64 bits", spelling), static_cast<uint32_t>(start));
+      value = 0;
     }
+    return Token::int_lit(value, static_cast<uint32_t>(start));
+  }
+
+  // identifier or keyword: [a-zA-Z][a-zA-Z0-9]*
+  Token lex_word(size_t& index)
+  {
+    const size_t start = index;
+    index = simd_scan::ident_end(m_src, index);
     
-    // No parser matched - unexpected character
-    char current = m_src[index];
-    return llvm::createStringError(
-      llvm::inconvertibleErrorCode(),
-      m_error_reporter.format_error(format("Unexpected character '{}'", current), line, column)
-    );
+    const auto word = m_src.substr(start, index - start);
+    if (auto keyword = keyword_table.find(word)) {
+      return make_token(*keyword, start, word.length());
+    }
+    return make_token(TokenType::ident, start, word.length(), m_interner.intern(word));
+  }
+
+  static Token make_token(TokenType type, size_t offset, size_t length, uint32_t symbol = no_symbol)
+  {
+    return Token{
+      .type = type,
+      .offset = static_cast<uint32_t>(offset),
+      .length = static_cast<uint32_t>(length),
+      .symbol = symbol
+    };
   }
 
-  const string m_src;
-  ErrorReporter m_error_reporter;
+  const string_view m_src;
+  size_t m_index = 0;
+  Interner& m_interner;
+  const ErrorReporter& m_error_reporter;
+  vector<ErrorReporter::Diagnostic> m_diagnostics;
 };
\ No newline at end of file
@@ -1,38 +1,11 @@
 #include <print>
 #include <iostream>
-#include <fstream>
-#include <sstream>
-#include <string_view>
-#include <filesystem>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_ostream.h>
-#include "lexer.hpp"
-#include "ast.hpp"
-#include "codegen.hpp"
-
-namespace fs = filesystem;
-
-// Simple debug logger using C++23 println
-class DebugLog {
-  ofstream file;
-public:
-  explicit DebugLog(string_view filename) : file(filename.data()) {}
-  
-  template<typename... Args>
-  void printline(format_string<Args...> fmt, Args&&... args) {
-    println(file, fmt, forward<Args>(args)...);
-  }
-};
-
-// Helper to read entire file into string
-auto read_file(const fs::path& path) -> Expected<string> {
-  if (auto file = ifstream(path); file) {
-    stringstream buffer;
-    buffer << file.rdbuf();
-    return buffer.str();
-  }
-  return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not open file: {}", path.string()));
-}
+#include "driver.hpp"
+#include "options.hpp"
+#include "server.hpp"
+#include "session.hpp"
 
 // Initialize LLVM targets
 void init_llvm_targets() {
@@ -41,83 +14,45 @@ void init_llvm_targets() {
   llvm::InitializeNativeTargetAsmParser();
 }
 
-// Write LLVM IR to file
-auto write_llvm_ir(llvm::Module* module, string_view output_path) 
-    -> llvm::Error {
-  error_code ec;
-  llvm::raw_fd_ostream dest(output_path.data(), ec);
-  
-  if (ec) {
-    return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not write IR: {}", ec.message()));
-  }
-  
-  module->print(dest, nullptr);
-  dest.flush();
-  return llvm::Error::success();
-}
-
 int main(int argc, char* argv[]) try {
-  auto log = DebugLog("DEBUG.txt");
-  log.printline("Starting compiler...");
-  
   // Validate arguments
-  if (argc != 2) {
-    println(cerr, "Usage: husk <input.hsk>");
+  auto options_result = parse_options(argc, argv);
+  if (!options_result) {
+    println(cerr, "Error: {}", llvm::toString(options_result.takeError()));
+    println(cerr, "{}", USAGE);
     return EXIT_FAILURE;
   }
-  log.printline("Args OK");
+  const auto options = *options_result;
 
-  // Read source file
-  const auto input_path = fs::path(argv[1]);
-  log.printline("Opening file: {}", input_path.string());
-  
-  auto contents_result = read_file(input_path);
-  if (!contents_result) {
-    println(cerr, "Error: {}", llvm::toString(contents_result.takeError()));
+  if (options.shutdown && !options.connect) {
+    println(cerr, "Error: '--shutdown' only applies to '--connect'");
     return EXIT_FAILURE;
   }
-  const auto& contents = *contents_result;
-  
-  log.printline("File size: {} bytes", size(contents));
-  log.printline("File contents: [{}]", contents);
 
-  // Tokenize
-  auto tokens_result = Lexer(contents, input_path.filename().string()).tokenize();
-  if (!tokens_result) {
-    println(cerr, "{}", llvm::toString(tokens_result.takeError()));
-    return EXIT_FAILURE;
-  }
-  auto tokens = *tokens_result;
-  log.printline("Token count: {}", size(tokens));
-  
-  // Parse
-  auto program_result = Parser(move(tokens), contents, input_path.filename().string()).parse();
-  if (!program_result) {
-    println(cerr, "{}", llvm::toString(program_result.takeError()));
-    return EXIT_FAILURE;
+  // Hand the invocation to a running server; skips LLVM setup entirely
+  if (options.connect) {
+    auto exit_code = run_client(options, argc, argv);
+    if (!exit_code) {
+      println(cerr, "Error: {}", llvm::toString(exit_code.takeError()));
+      return EXIT_FAILURE;
+    }
+    return *exit_code;
   }
-  auto program = *program_result;
-  log.printline("Function count: {}", size(program.functions));
 
-  // Generate LLVM IR
   init_llvm_targets();
-  log.printline("Generating LLVM IR...");
-  
-  auto codegen = CodeGen();
-  if (auto result = codegen.generate(program)) {
-    println(cerr, "Code generation error: {}", llvm::toString(std::move(result)));
-    return EXIT_FAILURE;
-  }
-  log.printline("Generated LLVM IR");
-  
-  // Write output
-  if (auto result = write_llvm_ir(codegen.getModule().get(), "out.ll")) {
-    println(cerr, "Error: {}", llvm::toString(std::move(result)));
-    return EXIT_FAILURE;
+
+  // Stay resident and compile for --connect clients
+  if (options.server) {
+    auto exit_code = run_server(options);
+    if (!exit_code) {
+      println(cerr, "Error: {}", llvm::toString(exit_code.takeError()));
+      return EXIT_FAILURE;
+    }
+    return *exit_code;
   }
-  log.printline("Done!");
 
-  return EXIT_SUCCESS;
+  auto session = Session(options.jobs);
+  return run_invocation(options, session);
 }
 catch (const exception& e) {
   println(cerr, "Error: {}", e.what());
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <format>
+#include <memory>
+#include <string>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/OptimizationLevel.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/ProfileData/InstrProfReader.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/PGOOptions.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Scalar/InductiveRangeCheckElimination.h>
+#include "options.hpp"
+
+using namespace std;
+
+// Runs the new pass manager's default pipeline over a generated module.
+// -O1 and up get SROA/mem2reg, instcombine, GVN and the inliner from
+// PassBuilder's per-module pipeline; -O0 only verifies the module. The
+// pipeline is built on the first run and reused for every later module,
+// so an optimizer kept per thread (see Backends) builds it once.
+//
+// With a ProfileConfig the pass builder adds IR-level PGO at every -O
+// level: --profile-generate instruments each function with edge counters
+// whose values the program writes to the raw profile at exit, and
+// --profile-use reads an indexed profile back and attaches entry counts
+// and branch weights to the functions before the passes that use them.
+//
+// Inductive range check elimination, which the default pipeline leaves
+// out, splits a loop whose array bounds checks test its induction variable
+// into the iterations where every check passes, which then run without
+// them, and the rest. It runs with the early instcombines, while the
+// checks are still the compares CodeGen emits; IndVarSimplify rewrites
+// them into forms IRCE does not recognize. A loop it split is marked and
+// not split again.
+class Optimizer
+{
+public:
+  explicit Optimizer(unsigned opt_level, llvm::TargetMachine* machine = nullptr, bool time_passes = false,
+                     ProfileConfig profile = {})
+    : m_opt_level(opt_level), m_machine(machine), m_time_passes(time_passes), m_profile(std::move(profile))
+  {
+  }
+
+  auto run(llvm::Module& module) -> llvm::Error
+  {
+    if (auto err = verify(module)) {
+      return err;
+    }
+
+    if (m_opt_level == 0 && m_profile == ProfileConfig()) {
+      return llvm::Error::success();
+    }
+    if (auto err = check_profile()) {
+      return err;
+    }
+
+    if (!m_pipeline) {
+      m_pipeline = make_unique<Pipeline>(m_machine, m_time_passes, optimization_level(), pgo_options());
+    }
+
+    // analysis managers must be declared in this order so they are torn down correctly
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+
+    auto& pass_builder = m_pipeline->pass_builder;
+    pass_builder.registerModuleAnalyses(mam);
+    pass_builder.registerCGSCCAnalyses(cgam);
+    pass_builder.registerFunctionAnalyses(fam);
+    pass_builder.registerLoopAnalyses(lam);
+    pass_builder.crossRegisterProxies(lam, fam, cgam, mam);
+
+    m_pipeline->passes.run(module, mam);
+    if (m_time_passes) {
+      m_pipeline->time_passes.print();
+    }
+    return llvm::Error::success();
+  }
+
+private:
+  // catch malformed IR before the passes trip over it
+  auto verify(llvm::Module& module) const -> llvm::Error
+  {
+    string message;
+    llvm::raw_string_ostream os(message);
+    if (llvm::verifyModule(module, &os)) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Invalid module: {}", os.str()));
+    }
+    return llvm::Error::success();
+  }
+
+  // The profile-use pass reports an unreadable profile as an error
+  // diagnostic, which the context's default handler answers with exit(1).
+  // Check it here so the driver reports it like any other error.
+  auto check_profile() const -> llvm::Error
+  {
+    if (m_profile.use.empty()) {
+      return llvm::Error::success();
+    }
+    auto buffer = llvm::MemoryBuffer::getFile(m_profile.use.string());
+    if (!buffer) {
+      return llvm::createStringError(buffer.getError(),
+                                     format("Could not read profile '{}': {}", m_profile.use.string(), buffer.getError().message()));
+    }
+    if (!llvm::IndexedInstrProfReader::hasFormat(**buffer)) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                     format("'{}' is not an indexed profile; merge raw profiles with 'llvm-profdata merge'",
+                                            m_profile.use.string()));
+    }
+    return llvm::Error::success();
+  }
+
+  // map the profile flags onto the pass builder's IR-level PGO
+  optional<llvm::PGOOptions> pgo_options() const
+  {
+    if (!m_profile.generate.empty()) {
+      return llvm::PGOOptions(m_profile.generate.string(), "", "", "", llvm::vfs::getRealFileSystem(), llvm::PGOOptions::IRInstr);
+    }
+    if (!m_profile.use.empty()) {
+      return llvm::PGOOptions(m_profile.use.string(), "", "", "", llvm::vfs::getRealFileSystem(), llvm::PGOOptions::IRUse);
+    }
+    return nullopt;
+  }
+
+  // map -O<n> onto the pass builder's levels
+  llvm::OptimizationLevel optimization_level() const
+  {
+    switch (m_opt_level) {
+      case 0: return llvm::OptimizationLevel::O0;
+      case 1: return llvm::OptimizationLevel::O1;
+      case 2: return llvm::OptimizationLevel::O2;
+      default: return llvm::OptimizationLevel::O3;
+    }
+  }
+
+  // the pass builder and the module pipeline it built, kept between runs
+  struct Pipeline {
+    Pipeline(llvm::TargetMachine* machine, bool time_passes_enabled, llvm::OptimizationLevel level,
+             optional<llvm::PGOOptions> pgo)
+      : time_passes(time_passes_enabled),
+        pass_builder(machine, llvm::PipelineTuningOptions(), std::move(pgo), &instrumentation)
+    {
+      // --time-report: per-pass timings, printed after every run
+      time_passes.registerCallbacks(instrumentation);
+      if (level != llvm::OptimizationLevel::O0) {
+        pass_builder.registerPeepholeEPCallback([](llvm::FunctionPassManager& passes, llvm::OptimizationLevel) {
+          passes.addPass(llvm::IRCEPass());
+        });
+      }
+      // -O0 only gets here for PGO, whose passes the O0 pipeline adds too
+      passes = level == llvm::OptimizationLevel::O0 ? pass_builder.buildO0DefaultPipeline(level)
+                                                    : pass_builder.buildPerModuleDefaultPipeline(level);
+    }
+
+    llvm::PassInstrumentationCallbacks instrumentation;
+    llvm::TimePassesHandler time_passes;
+    llvm::PassBuilder pass_builder;
+    llvm::ModulePassManager passes;
+  };
+
+  unsigned m_opt_level;
+  llvm::TargetMachine* m_machine;  // optional, gives the passes target cost info
+  bool m_time_passes;
+  ProfileConfig m_profile;
+  unique_ptr<Pipeline> m_pipeline;
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <charconv>
+#include <format>
+#include <thread>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <set>
+#include <vector>
+#include <llvm/Support/Error.h>
+
+using namespace std;
+
+namespace fs = filesystem;
+
+template<typename T>
+using Expected = llvm::Expected<T>;
+
+// compiler version, part of every compile cache key
+inline constexpr string_view HUSK_VERSION = "0.1.0";
+
+// cache directory used by a bare --cache
+inline constexpr string_view DEFAULT_CACHE_DIR = ".husk-cache";
+
+// raw profile an instrumented program writes when --profile-generate names none
+inline constexpr string_view DEFAULT_PROFILE = "default.profraw";
+
+// profile-guided optimization of the pipeline, off when both are empty
+struct ProfileConfig {
+  fs::path generate;  // --profile-generate[=file]: instrument; where the program writes its raw profile
+  fs::path use;       // --profile-use=<file>: indexed profile (llvm-profdata merge) to optimize with
+
+  auto operator<=>(const ProfileConfig&) const = default;
+};
+
+// what the compiler writes out
+enum class EmitKind
+{
+  ll,   // textual LLVM IR
+  bc,   // LLVM bitcode
+  asm_, // native assembly
+  obj,  // native object file
+  exe   // linked executable
+};
+
+// command line configuration for a single compiler invocation
+struct CompileOptions {
+  vector<fs::path> inputs;       // one or more .hsk files
+  fs::path output;               // -o, defaults per emit kind
+  EmitKind emit = EmitKind::ll;  // --emit=
+  unsigned opt_level = 0;        // -O0 .. -O3
+  bool run = false;              // `husk run`: execute main() in process
+  bool lazy = false;             // --lazy: compile functions on first call when running
+  unsigned jobs = 1;             // -j N: compile files or functions on N threads
+  bool time_report = false;      // --time-report: per-phase and per-pass timings
+  bool stats = false;            // --stats: token, AST and IR counters
+  fs::path cache_dir;            // --cache[=dir]: reuse per-function bitcode, empty when disabled
+  bool thinlto = false;          // --thinlto: bitcode with module summaries, ThinLTO link for exe
+  ProfileConfig profile;         // --profile-generate / --profile-use
+  bool server = false;           // --server[=socket]: stay resident and compile for --connect clients
+  bool connect = false;          // --connect[=socket]: hand this invocation to a running server
+  bool shutdown = false;         // --shutdown: with --connect, stop the server
+  fs::path socket;               // socket of --server / --connect, empty for the default
+};
+
+inline constexpr string_view USAGE =
+  "Usage: husk [-O0|-O1|-O2|-O3] [-j N] [--emit=ll|bc|asm|obj|exe] [--thinlto] [--profile-generate[=file]|--profile-use=<file>]\n"
+  "            [-o <path>] [--cache[=dir]] [--time-report] [--stats] <input.hsk>...\n"
+  "       husk run [-O0|-O1|-O2|-O3] [-j N] [--lazy] [--profile-use=<file>] [--cache[=dir]] [--time-report] [--stats] <input.hsk>...\n"
+  "       husk --server[=socket] [-j N]\n"
+  "       husk [run] --connect[=socket] <options and inputs as above> | husk --connect[=socket] --shutdown";
+
+// helper to parse the N of -j N; 0 means one job per hardware thread
+inline auto parse_jobs(string_view value) -> Expected<unsigned>
+{
+  unsigned jobs = 0;
+  const auto [end, ec] = from_chars(value.data(), value.data() + value.size(), jobs);
+  if (ec != errc() || end != value.data() + value.size()) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Invalid job count '{}'", value));
+  }
+  return jobs == 0 ? max(thread::hardware_concurrency(), 1u) : jobs;
+}
+
+// helper to map --emit= values
+inline auto parse_emit_kind(string_view value) -> Expected<EmitKind>
+{
+  if (value == "ll") return EmitKind::ll;
+  if (value == "bc") return EmitKind::bc;
+  if (value == "asm") return EmitKind::asm_;
+  if (value == "obj") return EmitKind::obj;
+  if (value == "exe") return EmitKind::exe;
+  return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Unknown emit kind '{}'", value));
+}
+
+// output file used when no -o is given
+inline fs::path default_output_path(EmitKind emit)
+{
+  switch (emit) {
+    case EmitKind::ll: return "out.ll";
+    case EmitKind::bc: return "out.bc";
+    case EmitKind::asm_: return "out.s";
+    case EmitKind::obj: return "out.o";
+    case EmitKind::exe: return "out";
+  }
+  return "out.ll";
+}
+
+// output of each input when several are compiled without linking:
+// <stem>.<ext> in the working directory, like `cc -c a.c b.c`
+inline fs::path per_input_output_path(const fs::path& input, EmitKind emit)
+{
+  return input.filename().replace_extension(default_output_path(emit).extension());
+}
+
+// parse argv into compile options
+inline auto parse_options(int argc, char* argv[]) -> Expected<CompileOptions>
+{
+  CompileOptions options;
+
+  int first = 1;
+  if (argc > 1 && string_view(argv[1]) == "run") {
+    options.run = true;
+    first = 2;
+  }
+
+  for (int i = first; i < argc; ++i) {
+    const auto arg = string_view(argv[i]);
+
+    if (arg.size() == 3 && arg.starts_with("-O") && arg[2] >= '0' && arg[2] <= '3') {
+      options.opt_level = static_cast<unsigned>(arg[2] - '0');
+    }
+    else if (arg.starts_with("--emit=")) {
+      auto emit = parse_emit_kind(arg.substr(string_view("--emit=").size()));
+      if (!emit) {
+        return emit.takeError();
+      }
+      options.emit = *emit;
+    }
+    else if (arg == "--time-report") {
+      options.time_report = true;
+    }
+    else if (arg == "--stats") {
+      options.stats = true;
+    }
+    else if (arg == "--cache") {
+      options.cache_dir = fs::path(DEFAULT_CACHE_DIR);
+    }
+    else if (arg.starts_with("--cache=")) {
+      options.cache_dir = fs::path(arg.substr(string_view("--cache=").size()));
+      if (options.cache_dir.empty()) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), "Expected directory after '--cache='");
+      }
+    }
+    else if (arg == "--server" || arg.starts_with("--server=")) {
+      options.server = true;
+      options.socket = fs::path(arg.substr(min(arg.size(), string_view("--server=").size())));
+    }
+    else if (arg == "--connect" || arg.starts_with("--connect=")) {
+      options.connect = true;
+      options.socket = fs::path(arg.substr(min(arg.size(), string_view("--connect=").size())));
+    }
+    else if (arg == "--shutdown") {
+      options.shutdown = true;
+    }
+    else if (arg == "--thinlto") {
+      options.thinlto = true;
+    }
+    else if (arg == "--profile-generate") {
+      options.profile.generate = fs::path(DEFAULT_PROFILE);
+    }
+    else if (arg.starts_with("--profile-generate=")) {
+      options.profile.generate = fs::path(arg.substr(string_view("--profile-generate=").size()));
+      if (options.profile.generate.empty()) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), "Expected file after '--profile-generate='");
+      }
+    }
+    else if (arg.starts_with("--profile-use=")) {
+      options.profile.use = fs::path(arg.substr(string_view("--profile-use=").size()));
+      if (options.profile.use.empty()) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), "Expected file after '--profile-use='");
+      }
+    }
+    else if (arg == "--lazy") {
+      options.lazy = true;
+    }
+    else if (arg.starts_with("-j")) {
+      if (arg == "-j" && i + 1 >= argc) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), "Expected job count after '-j'");
+      }
+      auto jobs = parse_jobs(arg == "-j" ? string_view(argv[++i]) : arg.substr(2));
+      if (!jobs) {
+        return jobs.takeError();
+      }
+      options.jobs = *jobs;
+    }
+    else if (arg == "-o") {
+      if (i + 1 >= argc) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), "Expected path after '-o'");
+      }
+      options.output = fs::path(argv[++i]);
+    }
+    else if (arg.starts_with("-") && arg.size() > 1) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Unknown option '{}'", arg));
+    }
+    else {
+      options.inputs.emplace_back(arg);
+    }
+  }
+
+  if (options.server && (options.connect || options.run || !options.inputs.empty())) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "'--server' takes no inputs; clients pass them with '--connect'");
+  }
+  if (options.server || options.shutdown) {
+    return options;
+  }
+
+  if (options.inputs.empty()) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "No input file");
+  }
+
+  // several inputs get one output each unless they are linked together
+  const bool links = options.run || options.emit == EmitKind::exe;
+  if (options.inputs.size() > 1 && !links && !options.output.empty()) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "'-o' needs a single input unless the inputs are linked (--emit=exe or run)");
+  }
+  if (options.inputs.size() > 1 && !links) {
+    set<fs::path> outputs;
+    for (const auto& input : options.inputs) {
+      if (!outputs.insert(per_input_output_path(input, options.emit)).second) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       format("Inputs would share the output '{}'", per_input_output_path(input, options.emit).string()));
+      }
+    }
+  }
+
+  if (options.lazy && !options.run) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "'--lazy' only applies to 'husk run'");
+  }
+
+  if (options.thinlto && (options.run || (options.emit != EmitKind::bc && options.emit != EmitKind::exe))) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "'--thinlto' only applies to '--emit=bc' and '--emit=exe'");
+  }
+
+  if (!options.profile.generate.empty() && !options.profile.use.empty()) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "'--profile-generate' and '--profile-use' are mutually exclusive");
+  }
+  if (!options.profile.generate.empty() && options.run) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "'--profile-generate' needs a compiled program; 'husk run' has no profile runtime");
+  }
+
+  if (options.output.empty()) {
+    options.output = default_output_path(options.emit);
+  }
+
+  return options;
+}
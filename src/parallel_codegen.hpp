@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <format>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include "codegen.hpp"
+#include "emitter.hpp"
+#include "optimizer.hpp"
+#include "options.hpp"
+#include "thread_pool.hpp"
+
+using namespace std;
+
+// Output of one partition: either its optimized module as bitcode (to be
+// linked back into a single module, or with a summary for a ThinLTO link)
+// or a native object on disk
+struct PartitionResult {
+  string error;                     // empty on success
+  llvm::SmallVector<char, 0> bitcode;
+  string object_path;
+};
+
+// One TargetMachine and Optimizer per pool slot, created on first use by
+// that slot's thread. Neither may be shared: a TargetMachine caches
+// subtargets without locking and an Optimizer reuses its pass pipeline.
+class Backends
+{
+public:
+  Backends(const ThreadPool& pool, unsigned opt_level, ProfileConfig profile = {})
+    : m_pool(pool), m_opt_level(opt_level), m_profile(std::move(profile)), m_slots(pool.slot_count())
+  {
+  }
+
+  // machine of the calling thread's slot
+  auto machine() -> Expected<llvm::TargetMachine*>
+  {
+    auto& slot = m_slots[m_pool.current_slot()];
+    if (!slot.machine) {
+      auto created = create_target_machine(m_opt_level);
+      if (!created) {
+        return created.takeError();
+      }
+      slot.machine = std::move(*created);
+    }
+    return slot.machine.get();
+  }
+
+  // optimizer of the calling thread's slot, bound to its machine
+  auto optimizer() -> Expected<Optimizer*>
+  {
+    auto machine = this->machine();
+    if (!machine) {
+      return machine.takeError();
+    }
+    auto& slot = m_slots[m_pool.current_slot()];
+    if (!slot.optimizer) {
+      slot.optimizer = make_unique<Optimizer>(m_opt_level, *machine, /*time_passes=*/false, m_profile);
+    }
+    return slot.optimizer.get();
+  }
+
+private:
+  struct Slot {
+    unique_ptr<llvm::TargetMachine> machine;
+    unique_ptr<Optimizer> optimizer;
+  };
+
+  const ThreadPool& m_pool;
+  unsigned m_opt_level;
+  ProfileConfig m_profile;
+  vector<Slot> m_slots;
+};
+
+// Split the program's functions into at most `jobs` groups of similar size.
+// Largest bodies are placed first, each onto the least loaded group, and
+// every group keeps source order so the output is deterministic.
+inline vector<vector<uint32_t>> partition_functions(const ASTProgram& program, unsigned jobs)
+{
+  const size_t count = clamp<size_t>(jobs, 1, max<size_t>(program.functions.size(), 1));
+  vector<vector<uint32_t>> partitions(count);
+  vector<size_t> load(count, 0);
+
+  vector<uint32_t> order(program.functions.size());
+  iota(order.begin(), order.end(), 0);
+  stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return program.functions[a].body.size() > program.functions[b].body.size();
+  });
+
+  for (const uint32_t index : order) {
+    const auto target = static_cast<size_t>(min_element(load.begin(), load.end()) - load.begin());
+    partitions[target].push_back(index);
+    load[target] += program.functions[index].body.size() + 1;
+  }
+
+  for (auto& partition : partitions) {
+    sort(partition.begin(), partition.end());
+  }
+  return partitions;
+}
+
+// Generate, optimize and serialize or emit one partition. Runs on a worker
+// thread with its own LLVMContext and CodeGen, and the worker's
+// TargetMachine and Optimizer; the program and interner are only read.
+// `summary` adds a module summary to the bitcode of a partition that is
+// not emitted as an object.
+inline void compile_partition(const ASTProgram& program, const Interner& interner, const vector<uint32_t>& functions,
+                              llvm::TargetMachine& machine, Optimizer& optimizer, bool emit_object, bool summary,
+                              PartitionResult& result)
+{
+  auto codegen = CodeGen(interner);
+  if (auto err = codegen.generate(program, functions)) {
+    result.error = format("Code generation error: {}", llvm::toString(std::move(err)));
+    return;
+  }
+
+  auto module = codegen.getModule();
+  configure_module(*module, machine);
+  if (auto err = optimizer.run(*module)) {
+    result.error = format("Optimization error: {}", llvm::toString(std::move(err)));
+    return;
+  }
+
+  if (!emit_object) {
+    llvm::raw_svector_ostream os(result.bitcode);
+    write_bitcode_to(*module, os, summary);
+    return;
+  }
+
+  llvm::SmallString<128> object_path;
+  if (auto ec = llvm::sys::fs::createTemporaryFile("husk", "o", object_path)) {
+    result.error = format("Could not create temporary object: {}", ec.message());
+    return;
+  }
+  result.object_path = object_path.str().str();
+
+  if (auto err = write_native(*module, machine, result.object_path, llvm::CodeGenFileType::ObjectFile)) {
+    result.error = llvm::toString(std::move(err));
+  }
+}
+
+// helper to delete the temporary objects written by compile_partitions
+inline void remove_partition_objects(const vector<PartitionResult>& results)
+{
+  for (const auto& result : results) {
+    if (!result.object_path.empty()) {
+      llvm::sys::fs::remove(result.object_path);
+    }
+  }
+}
+
+// Compile the given partitions as tasks on the pool. Idle threads steal
+// them, so many small partitions (e.g. one per function) spread evenly.
+inline auto run_partitions(ThreadPool& pool, Backends& backends, const ASTProgram& program, const Interner& interner,
+                           const vector<vector<uint32_t>>& partitions, bool emit_objects, bool summaries = false)
+  -> Expected<vector<PartitionResult>>
+{
+  vector<PartitionResult> results(partitions.size());
+  TaskGroup group;
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    pool.submit(group, [&, i] {
+      auto optimizer = backends.optimizer();
+      if (!optimizer) {
+        results[i].error = llvm::toString(optimizer.takeError());
+        return;
+      }
+      auto machine = backends.machine();  // already created for the optimizer
+      compile_partition(program, interner, partitions[i], **machine, **optimizer, emit_objects, summaries, results[i]);
+    });
+  }
+  pool.wait(group);
+
+  for (const auto& result : results) {
+    if (!result.error.empty()) {
+      remove_partition_objects(results);
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), result.error);
+    }
+  }
+  return results;
+}
+
+// Split the program into options.jobs partitions and run them on the pool (-j N)
+inline auto compile_partitions(ThreadPool& pool, Backends& backends, const ASTProgram& program,
+                               const Interner& interner, const CompileOptions& options,
+                               bool emit_objects, bool summaries = false) -> Expected<vector<PartitionResult>>
+{
+  return run_partitions(pool, backends, program, interner, partition_functions(program, options.jobs), emit_objects,
+                        summaries);
+}
+
+// Link bitcode modules, in order, into a single module in `context`
+inline auto link_bitcode(const vector<llvm::MemoryBufferRef>& buffers, llvm::LLVMContext& context,
+                         const llvm::TargetMachine& machine) -> Expected<unique_ptr<llvm::Module>>
+{
+  auto merged = make_unique<llvm::Module>("Husk", context);
+  configure_module(*merged, machine);
+
+  llvm::Linker linker(*merged);
+  for (const auto& buffer : buffers) {
+    auto module = llvm::parseBitcodeFile(buffer, context);
+    if (!module) {
+      return module.takeError();
+    }
+    if (linker.linkInModule(std::move(*module))) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not link {}", buffer.getBufferIdentifier().str()));
+    }
+  }
+  return merged;
+}
+
+// Link the partitions' bitcode back into a single module in `context`
+inline auto link_partitions(const vector<PartitionResult>& results, llvm::LLVMContext& context,
+                            const llvm::TargetMachine& machine) -> Expected<unique_ptr<llvm::Module>>
+{
+  vector<llvm::MemoryBufferRef> buffers;
+  for (const auto& result : results) {
+    buffers.emplace_back(llvm::StringRef(result.bitcode.data(), result.bitcode.size()), "partition");
+  }
+  return link_bitcode(buffers, context, machine);
+}
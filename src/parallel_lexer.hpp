@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <vector>
+#include "lexer.hpp"
+#include "thread_pool.hpp"
+
+using namespace std;
+
+// Parallel tokenize for large sources. The buffer is cut into one chunk per
+// pool slot, each cut moved forward to a whitespace byte or a ';', and every
+// chunk is lexed on its own task with its own Interner. Token offsets are
+// absolute and lines are only derived from offsets when a diagnostic is
+// formatted, so nothing needs rebasing; the merge pass only remaps each
+// chunk's symbol IDs onto the shared Interner and copies the chunks to
+// their prefix-sum positions.
+//
+// A cut is only a guess: once tokens can contain whitespace or ';' (string
+// literals, comments), one may land inside a token. Each chunk therefore
+// records where lexing resumes after its last token, and the next chunk's
+// tokens are kept only if its own lexing started exactly there. Otherwise,
+// and also for a chunk whose speculative lex failed, that chunk is lexed
+// again serially from the resume point. Lexical errors stay with their
+// chunk until it is validated, so speculative ones are never reported. The
+// result, including the errors and the symbol IDs, is always the serial
+// lexer's.
+
+// sources below two chunks of this size are lexed serially
+inline constexpr size_t PARALLEL_LEX_MIN_CHUNK = 256u << 10;
+
+struct LexedChunk {
+  size_t begin = 0;                 // where the chunk's lexing started
+  size_t end = 0;                   // tokens starting before this belong to it
+  size_t first_token = 0;           // where its first token, or error, starts
+  optional<size_t> resume;          // where lexing resumes after it; unset on error
+  string error;
+  vector<ErrorReporter::Diagnostic> diagnostics;
+  Interner interner;
+  TokenBuffer tokens;
+};
+
+// helper to pick a cut at or after `offset` where no current token can span
+inline size_t lex_cut_after(string_view src, size_t offset)
+{
+  while (offset < src.length()) {
+    const auto cls = char_table[src[offset]];
+    if (cls == CharClass::whitespace || cls == CharClass::newline || src[offset] == ';') {
+      return offset;
+    }
+    ++offset;
+  }
+  return src.length();
+}
+
+// helper to lex a chunk from `begin` with its own interner
+inline void lex_chunk(LexedChunk& chunk, size_t begin, const SourceFile& source, const ErrorReporter& error_reporter)
+{
+  chunk.begin = begin;
+  chunk.tokens = TokenBuffer();
+  chunk.interner = Interner();
+  chunk.error.clear();
+  chunk.first_token = simd_scan::skip_whitespace(source.text(), begin);
+
+  auto lexer = Lexer(source, chunk.interner, error_reporter);
+  auto resume = lexer.tokenize_range(begin, chunk.end, chunk.tokens);
+  if (!resume) {
+    chunk.resume.reset();
+    chunk.error = llvm::toString(resume.takeError());
+    return;
+  }
+  chunk.resume = *resume;
+  chunk.diagnostics = lexer.take_diagnostics();
+}
+
+inline auto tokenize_parallel(const SourceFile& source, Interner& interner, const ErrorReporter& error_reporter,
+                              ThreadPool& pool) -> Expected<TokenBuffer>
+{
+  const auto src = source.text();
+  const size_t chunk_count = min(pool.slot_count(), src.length() / PARALLEL_LEX_MIN_CHUNK);
+  if (chunk_count < 2) {
+    return Lexer(source, interner, error_reporter).tokenize();
+  }
+
+  vector<LexedChunk> chunks(chunk_count);
+  size_t begin = 0;
+  for (size_t i = 0; i < chunk_count; ++i) {
+    chunks[i].begin = begin;
+    chunks[i].end = i + 1 < chunk_count ? lex_cut_after(src, max(begin, src.length() / chunk_count * (i + 1))) : src.length();
+    begin = chunks[i].end;
+  }
+
+  TaskGroup group;
+  for (auto& chunk : chunks) {
+    pool.submit(group, [&chunk, &source, &error_reporter] { lex_chunk(chunk, chunk.begin, source, error_reporter); });
+  }
+  pool.wait(group);
+
+  // validate in order: a chunk stands if it starts where the previous one resumes
+  for (size_t i = 0; i < chunk_count; ++i) {
+    auto& chunk = chunks[i];
+    if (i > 0) {
+      const size_t resume = *chunks[i - 1].resume;
+      if (!chunk.resume || chunk.first_token != resume) {
+        lex_chunk(chunk, resume, source, error_reporter);
+      }
+    }
+    if (!chunk.resume) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), chunk.error);
+    }
+  }
+  for (auto& chunk : chunks) {
+    for (auto& diagnostic : chunk.diagnostics) {
+      error_reporter.report(std::move(diagnostic));
+    }
+  }
+
+  // symbols are interned chunk by chunk, so IDs come out in first-use order as when lexing serially
+  vector<vector<uint32_t>> symbols(chunk_count);
+  vector<size_t> first_index(chunk_count + 1, 0);
+  for (size_t i = 0; i < chunk_count; ++i) {
+    const auto& local = chunks[i].interner;
+    symbols[i].reserve(local.size());
+    for (uint32_t symbol = 0; symbol < local.size(); ++symbol) {
+      symbols[i].push_back(interner.intern(local.name(symbol)));
+    }
+    first_index[i + 1] = first_index[i] + chunks[i].tokens.size();
+  }
+
+  TokenBuffer tokens;
+  tokens.resize(first_index.back());
+  for (size_t i = 0; i < chunk_count; ++i) {
+    pool.submit(group, [&, i] {
+      const auto& chunk_tokens = chunks[i].tokens;
+      for (size_t j = 0; j < chunk_tokens.size(); ++j) {
+        Token token = chunk_tokens[j];
+        if (token.type == TokenType::ident) {
+          token.symbol = symbols[i][token.symbol];
+        }
+        tokens.set(first_index[i] + j, token);
+      }
+    });
+  }
+  pool.wait(group);
+  return tokens;
+}
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <print>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <llvm/Support/raw_ostream.h>
+#include "driver.hpp"
+#include "options.hpp"
+#include "session.hpp"
+
+using namespace std;
+
+// Compile server. `husk --server` binds a Unix socket and keeps one Session
+// (thread pool, TargetMachines, built pass pipelines, cache entries) warm
+// for its whole lifetime. `husk --connect ...` sends its working directory
+// and remaining arguments plus its stdout and stderr descriptors, and the
+// server runs the invocation with those descriptors in place, so output,
+// diagnostics and `husk run` programs print in the client's terminal. The
+// reply is the exit code. Requests are served one at a time because they
+// borrow the process-wide working directory and standard streams; each one
+// still uses the whole pool.
+//
+// Wire format: a count (uint32) sent together with the two descriptors,
+// then that many strings as length (uint32) and bytes, then an int32 exit
+// code back. All integers are in host byte order; both ends are local.
+
+// in-memory cache entries kept between requests before they are dropped
+inline constexpr size_t SERVER_CACHE_BUDGET = 256u << 20;
+
+// socket used when --server / --connect name none
+inline fs::path default_socket_path()
+{
+  return fs::temp_directory_path() / format("husk-{}.sock", getuid());
+}
+
+// helper to build a system error from errno
+inline llvm::Error make_socket_error(string_view what)
+{
+  return llvm::createStringError(llvm::inconvertibleErrorCode(), format("{}: {}", what, strerror(errno)));
+}
+
+// helper to fill a Unix socket address; the path has a small fixed limit
+inline auto make_socket_address(const fs::path& path) -> Expected<sockaddr_un>
+{
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  const auto& name = path.native();
+  if (name.size() >= sizeof(address.sun_path)) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Socket path '{}' is too long", name));
+  }
+  memcpy(address.sun_path, name.c_str(), name.size() + 1);
+  return address;
+}
+
+inline bool write_all(int fd, const void* data, size_t size)
+{
+  const auto* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t written = ::write(fd, bytes, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    bytes += written;
+    size -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+inline bool read_all(int fd, void* data, size_t size)
+{
+  auto* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t count = ::read(fd, bytes, size);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    bytes += count;
+    size -= static_cast<size_t>(count);
+  }
+  return true;
+}
+
+// one request as the server receives it
+struct ServerRequest {
+  vector<string> strings;  // working directory, then the arguments
+  int out_fd = -1;
+  int err_fd = -1;
+};
+
+// helper to send the string count with the client's stdout and stderr attached
+inline bool send_header(int socket_fd, uint32_t count, int out_fd, int err_fd)
+{
+  array<int, 2> fds{out_fd, err_fd};
+  alignas(cmsghdr) array<char, CMSG_SPACE(sizeof(fds))> control{};
+
+  iovec payload{&count, sizeof(count)};
+  msghdr message{};
+  message.msg_iov = &payload;
+  message.msg_iovlen = 1;
+  message.msg_control = control.data();
+  message.msg_controllen = control.size();
+
+  cmsghdr* header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(header), fds.data(), sizeof(fds));
+
+  ssize_t sent;
+  do {
+    sent = ::sendmsg(socket_fd, &message, 0);
+  } while (sent < 0 && errno == EINTR);
+  return sent == static_cast<ssize_t>(sizeof(count));
+}
+
+inline auto receive_request(int socket_fd) -> Expected<ServerRequest>
+{
+  uint32_t count = 0;
+  array<int, 2> fds{-1, -1};
+  alignas(cmsghdr) array<char, CMSG_SPACE(sizeof(fds))> control{};
+
+  iovec payload{&count, sizeof(count)};
+  msghdr message{};
+  message.msg_iov = &payload;
+  message.msg_iovlen = 1;
+  message.msg_control = control.data();
+  message.msg_controllen = control.size();
+
+  ssize_t received;
+  do {
+    received = ::recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+  } while (received < 0 && errno == EINTR);
+  if (received != static_cast<ssize_t>(sizeof(count))) {
+    return make_socket_error("Could not read request");
+  }
+
+  ServerRequest request;
+  for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+    if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS && header->cmsg_len == CMSG_LEN(sizeof(fds))) {
+      memcpy(fds.data(), CMSG_DATA(header), sizeof(fds));
+      request.out_fd = fds[0];
+      request.err_fd = fds[1];
+    }
+  }
+  if (request.out_fd < 0 || request.err_fd < 0) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "Request without stdout and stderr");
+  }
+
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t length = 0;
+    bool complete = read_all(socket_fd, &length, sizeof(length));
+    string text(complete ? length : 0, '\0');
+    complete = complete && read_all(socket_fd, text.data(), length);
+    if (!complete) {
+      ::close(request.out_fd);
+      ::close(request.err_fd);
+      return make_socket_error("Truncated request");
+    }
+    request.strings.push_back(move(text));
+  }
+  if (request.strings.empty()) {
+    ::close(request.out_fd);
+    ::close(request.err_fd);
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "Request without working directory");
+  }
+  return request;
+}
+
+// helper to flush every stream writing to stdout or stderr
+inline void flush_standard_streams()
+{
+  cout.flush();
+  cerr.flush();
+  fflush(stdout);
+  fflush(stderr);
+  llvm::outs().flush();
+  llvm::errs().flush();
+}
+
+// Run one request inside the client's working directory with its streams
+// in place of ours. Sets `stop` for --shutdown.
+inline int serve_request(ServerRequest& request, Session& session, bool& stop)
+{
+  vector<char*> argv{const_cast<char*>("husk")};
+  for (size_t i = 1; i < request.strings.size(); ++i) {
+    argv.push_back(request.strings[i].data());
+  }
+  argv.push_back(nullptr);
+
+  flush_standard_streams();
+  const int saved_out = ::dup(STDOUT_FILENO);
+  const int saved_err = ::dup(STDERR_FILENO);
+  ::dup2(request.out_fd, STDOUT_FILENO);
+  ::dup2(request.err_fd, STDERR_FILENO);
+
+  error_code ec;
+  const auto saved_cwd = fs::current_path();
+  fs::current_path(request.strings.front(), ec);
+
+  int exit_code = EXIT_FAILURE;
+  auto options = parse_options(static_cast<int>(argv.size() - 1), argv.data());
+  if (ec) {
+    llvm::consumeError(options.takeError());
+    println(cerr, "Error: Could not enter '{}': {}", request.strings.front(), ec.message());
+  }
+  else if (!options) {
+    println(cerr, "Error: {}", llvm::toString(options.takeError()));
+    println(cerr, "{}", USAGE);
+  }
+  else if (options->server || options->connect) {
+    println(cerr, "Error: The server cannot start or connect to another server");
+  }
+  else if (options->shutdown) {
+    stop = true;
+    exit_code = EXIT_SUCCESS;
+  }
+  else {
+    try {
+      exit_code = run_invocation(*options, session);
+    }
+    catch (const exception& e) {
+      println(cerr, "Error: {}", e.what());
+    }
+  }
+
+  flush_standard_streams();
+  fs::current_path(saved_cwd, ec);
+  ::dup2(saved_out, STDOUT_FILENO);
+  ::dup2(saved_err, STDERR_FILENO);
+  ::close(saved_out);
+  ::close(saved_err);
+  ::close(request.out_fd);
+  ::close(request.err_fd);
+  return exit_code;
+}
+
+// husk --server: accept requests until a client sends --shutdown
+inline auto run_server(const CompileOptions& options) -> Expected<int>
+{
+  const auto path = options.socket.empty() ? default_socket_path() : options.socket;
+  auto address = make_socket_address(path);
+  if (!address) {
+    return address.takeError();
+  }
+
+  const int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener < 0) {
+    return make_socket_error("Could not create socket");
+  }
+  ::unlink(path.c_str());  // a stale socket from an earlier server
+  if (::bind(listener, reinterpret_cast<const sockaddr*>(&*address), sizeof(*address)) < 0 || ::listen(listener, 64) < 0) {
+    auto err = make_socket_error(format("Could not listen on '{}'", path.string()));
+    ::close(listener);
+    return err;
+  }
+
+  // a client that goes away must not take the server with it
+  signal(SIGPIPE, SIG_IGN);
+
+  auto session = Session(options.jobs, /*resident=*/true);
+  bool stop = false;
+  while (!stop) {
+    const int client = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      auto err = make_socket_error("Could not accept connection");
+      ::close(listener);
+      ::unlink(path.c_str());
+      return err;
+    }
+
+    auto request = receive_request(client);
+    if (!request) {
+      println(cerr, "Error: {}", llvm::toString(request.takeError()));
+      ::close(client);
+      continue;
+    }
+    const auto exit_code = static_cast<int32_t>(serve_request(*request, session, stop));
+    write_all(client, &exit_code, sizeof(exit_code));
+    ::close(client);
+    session.trim(SERVER_CACHE_BUDGET);
+  }
+
+  ::close(listener);
+  ::unlink(path.c_str());
+  return EXIT_SUCCESS;
+}
+
+// husk --connect: forward this invocation, minus --connect, to the server
+// and return its exit code. Runs before any LLVM initialization.
+inline auto run_client(const CompileOptions& options, int argc, char* argv[]) -> Expected<int>
+{
+  const auto path = options.socket.empty() ? default_socket_path() : options.socket;
+  auto address = make_socket_address(path);
+  if (!address) {
+    return address.takeError();
+  }
+
+  vector<string> strings{fs::current_path().string()};
+  for (int i = 1; i < argc; ++i) {
+    const auto arg = string_view(argv[i]);
+    if (arg != "--connect" && !arg.starts_with("--connect=")) {
+      strings.emplace_back(arg);
+    }
+  }
+
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return make_socket_error("Could not create socket");
+  }
+  if (::connect(fd, reinterpret_cast<const sockaddr*>(&*address), sizeof(*address)) < 0) {
+    auto err = make_socket_error(format("Could not connect to a husk server at '{}'", path.string()));
+    ::close(fd);
+    return err;
+  }
+
+  bool sent = send_header(fd, static_cast<uint32_t>(strings.size()), STDOUT_FILENO, STDERR_FILENO);
+  for (size_t i = 0; sent && i < strings.size(); ++i) {
+    const auto length = static_cast<uint32_t>(strings[i].size());
+    sent = write_all(fd, &length, sizeof(length)) && write_all(fd, strings[i].data(), length);
+  }
+
+  int32_t exit_code = EXIT_FAILURE;
+  const bool replied = sent && read_all(fd, &exit_code, sizeof(exit_code));
+  ::close(fd);
+  if (!replied) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "The husk server closed the connection");
+  }
+  return exit_code;
+}
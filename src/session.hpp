@@ -0,0 +1,92 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <llvm/Target/TargetMachine.h>
+#include "compile_cache.hpp"
+#include "options.hpp"
+#include "parallel_codegen.hpp"
+#include "thread_pool.hpp"
+
+using namespace std;
+
+// State shared by every compile in the process: the thread pool, each
+// slot's TargetMachine and built pass pipeline per -O level and profile
+// configuration, and the open compile caches with their in-memory entries.
+// A plain invocation builds one and drops it; `husk --server` keeps it warm
+// across requests.
+class Session
+{
+public:
+  // jobs threads in total: jobs - 1 workers plus the caller; a resident
+  // session (the compile server's) outlives the programs `husk run` runs
+  explicit Session(unsigned jobs, bool resident = false)
+    : m_pool(max(jobs, 1u) - 1), m_resident(resident)
+  {
+  }
+
+  // programs run from a resident session run in a child process, so their
+  // runtime errors exit the child and not the server
+  bool resident() const
+  {
+    return m_resident;
+  }
+
+  ThreadPool& pool()
+  {
+    return m_pool;
+  }
+
+  Backends& backends(unsigned opt_level, const ProfileConfig& profile = {})
+  {
+    lock_guard lock(m_mutex);
+    auto& backends = m_backends[{opt_level, profile}];
+    if (!backends) {
+      backends = make_unique<Backends>(m_pool, opt_level, profile);
+    }
+    return *backends;
+  }
+
+  // the cache for a directory and configuration, opened on first use
+  auto cache(const fs::path& dir, const CompileOptions& options, const llvm::TargetMachine& machine)
+    -> Expected<CompileCache*>
+  {
+    auto config = CompileCache::config_for(options, machine);
+    lock_guard lock(m_mutex);
+    auto& cache = m_caches[{dir.lexically_normal().string(), config}];
+    if (!cache) {
+      auto opened = CompileCache::open(dir, move(config));
+      if (!opened) {
+        return opened.takeError();
+      }
+      cache = std::move(*opened);
+    }
+    return cache.get();
+  }
+
+  // Between requests, drop the caches' in-memory entries once they grow
+  // past `budget` bytes; they reload from disk on demand.
+  void trim(size_t budget)
+  {
+    lock_guard lock(m_mutex);
+    size_t total = 0;
+    for (const auto& [key, cache] : m_caches) {
+      total += cache->memory_bytes();
+    }
+    if (total > budget) {
+      for (auto& [key, cache] : m_caches) {
+        cache->forget();
+      }
+    }
+  }
+
+private:
+  ThreadPool m_pool;
+  bool m_resident;
+  mutex m_mutex;  // input tasks look up backends and caches concurrently
+  map<pair<unsigned, ProfileConfig>, unique_ptr<Backends>> m_backends;
+  map<pair<string, string>, unique_ptr<CompileCache>> m_caches;  // by directory and configuration
+};
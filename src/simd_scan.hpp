@@ -0,0 +1,213 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "tokens.hpp"
+
+#if !defined(HUSK_SCALAR_SCAN) && (defined(__SSE2__) || defined(_M_X64))
+#define HUSK_SCAN_SSE2 1
+#include <emmintrin.h>
+#elif !defined(HUSK_SCALAR_SCAN) && (defined(__ARM_NEON) || defined(_M_ARM64))
+#define HUSK_SCAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Byte-class scanning for the lexer and the error reporter, 16 bytes at a
+// time with SSE2 on x86-64 and NEON on AArch64. Each kernel classifies a
+// block into a lane mask and finds the first byte that ends the run with a
+// count of trailing zeros, or counts matches with a popcount. The last
+// partial block and other targets use scalar loops over char_table, which
+// also define the byte classes the vector code must agree with.
+// Define HUSK_SCALAR_SCAN to force the scalar code everywhere.
+namespace simd_scan {
+
+inline constexpr size_t block_size = 16;
+
+#if defined(HUSK_SCAN_SSE2)
+
+using Block = __m128i;
+
+// movemask sets bit i for lane i
+inline constexpr unsigned lane_shift = 0;
+inline constexpr uint64_t all_lanes = 0xFFFF;
+
+inline Block load(const char* p)
+{
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+// helper for lanes with lo <= byte <= lo + span, compared unsigned
+inline Block in_range(Block bytes, char lo, uint8_t span)
+{
+  const Block offset = _mm_sub_epi8(bytes, _mm_set1_epi8(lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(static_cast<char>(span))), offset);
+}
+
+inline uint64_t to_mask(Block lanes)
+{
+  return static_cast<uint32_t>(_mm_movemask_epi8(lanes));
+}
+
+inline Block either(Block a, Block b) { return _mm_or_si128(a, b); }
+inline Block equal(Block bytes, char c) { return _mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)); }
+inline Block lowercase(Block bytes) { return _mm_or_si128(bytes, _mm_set1_epi8(0x20)); }
+
+#elif defined(HUSK_SCAN_NEON)
+
+using Block = uint8x16_t;
+
+// NEON has no movemask: narrowing by 4 leaves a nibble per lane, of which
+// the top bit is kept, so lane i is bit 4 * i + 3
+inline constexpr unsigned lane_shift = 2;
+inline constexpr uint64_t all_lanes = 0x8888888888888888;
+
+inline Block load(const char* p)
+{
+  return vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+}
+
+inline Block in_range(Block bytes, char lo, uint8_t span)
+{
+  return vcleq_u8(vsubq_u8(bytes, vdupq_n_u8(static_cast<uint8_t>(lo))), vdupq_n_u8(span));
+}
+
+inline uint64_t to_mask(Block lanes)
+{
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(lanes), 4)), 0) & all_lanes;
+}
+
+inline Block either(Block a, Block b) { return vorrq_u8(a, b); }
+inline Block equal(Block bytes, char c) { return vceqq_u8(bytes, vdupq_n_u8(static_cast<uint8_t>(c))); }
+inline Block lowercase(Block bytes) { return vorrq_u8(bytes, vdupq_n_u8(0x20)); }
+
+#endif
+
+// Byte classes: `accepts` is the definition, `lanes` the same test on a block
+
+// ' ' and '\t' through '\r', newline included: the C locale's isspace
+struct Whitespace {
+  static constexpr size_t scalar_prefix = 2;
+  static bool accepts(char c)
+  {
+    return char_table[c] == CharClass::whitespace || char_table[c] == CharClass::newline;
+  }
+#if defined(HUSK_SCAN_SSE2) || defined(HUSK_SCAN_NEON)
+  static Block lanes(Block bytes)
+  {
+    return either(equal(bytes, ' '), in_range(bytes, '\t', '\r' - '\t'));
+  }
+#endif
+};
+
+struct Digit {
+  static constexpr size_t scalar_prefix = 16;
+  static bool accepts(char c)
+  {
+    return char_table[c] == CharClass::digit;
+  }
+#if defined(HUSK_SCAN_SSE2) || defined(HUSK_SCAN_NEON)
+  static Block lanes(Block bytes)
+  {
+    return in_range(bytes, '0', 9);
+  }
+#endif
+};
+
+struct IdentChar {
+  static constexpr size_t scalar_prefix = 16;
+  static bool accepts(char c)
+  {
+    return is_ident_char(c);
+  }
+#if defined(HUSK_SCAN_SSE2) || defined(HUSK_SCAN_NEON)
+  // OR-ing in 0x20 maps 'A'-'Z' onto 'a'-'z' and nothing else onto them
+  static Block lanes(Block bytes)
+  {
+    return either(in_range(lowercase(bytes), 'a', 25), Digit::lanes(bytes));
+  }
+#endif
+};
+
+// Helper to advance over a run of bytes of one class. Short runs are
+// cheaper to finish one byte at a time than to classify a block for, so
+// each class tests its first scalar_prefix bytes before loading blocks:
+// two for whitespace, whose long runs are indentation and blank lines,
+// sixteen for identifiers and literals, which are mostly shorter.
+template<typename Class>
+inline size_t scan_run(std::string_view src, size_t index)
+{
+  for (size_t i = 0; i < Class::scalar_prefix; ++i, ++index) {
+    if (index >= src.length() || !Class::accepts(src[index])) {
+      return index;
+    }
+  }
+#if defined(HUSK_SCAN_SSE2) || defined(HUSK_SCAN_NEON)
+  for (; index + block_size <= src.length(); index += block_size) {
+    const uint64_t rest = ~to_mask(Class::lanes(load(src.data() + index))) & all_lanes;
+    if (rest != 0) {
+      return index + (static_cast<size_t>(std::countr_zero(rest)) >> lane_shift);
+    }
+  }
+#endif
+  while (index < src.length() && Class::accepts(src[index])) {
+    ++index;
+  }
+  return index;
+}
+
+// index of the first byte at or after `index` that is not whitespace, or the end
+inline size_t skip_whitespace(std::string_view src, size_t index)
+{
+  return scan_run<Whitespace>(src, index);
+}
+
+// index just past the digits starting at `index`
+inline size_t digits_end(std::string_view src, size_t index)
+{
+  return scan_run<Digit>(src, index);
+}
+
+// index just past the identifier characters starting at `index`
+inline size_t ident_end(std::string_view src, size_t index)
+{
+  return scan_run<IdentChar>(src, index);
+}
+
+// number of '\n' bytes in `src`
+inline size_t count_newlines(std::string_view src)
+{
+  size_t count = 0;
+  size_t index = 0;
+#if defined(HUSK_SCAN_SSE2) || defined(HUSK_SCAN_NEON)
+  for (; index + block_size <= src.length(); index += block_size) {
+    count += static_cast<size_t>(std::popcount(to_mask(equal(load(src.data() + index), '\n'))));
+  }
+#endif
+  for (; index < src.length(); ++index) {
+    count += src[index] == '\n';
+  }
+  return count;
+}
+
+// call `fn` with the offset of every '\n' in `src`, in order
+template<typename Fn>
+inline void for_each_newline(std::string_view src, Fn fn)
+{
+  size_t index = 0;
+#if defined(HUSK_SCAN_SSE2) || defined(HUSK_SCAN_NEON)
+  for (; index + block_size <= src.length(); index += block_size) {
+    for (uint64_t mask = to_mask(equal(load(src.data() + index), '\n')); mask != 0; mask &= mask - 1) {
+      fn(index + (static_cast<size_t>(std::countr_zero(mask)) >> lane_shift));
+    }
+  }
+#endif
+  for (; index < src.length(); ++index) {
+    if (src[index] == '\n') {
+      fn(index);
+    }
+  }
+}
+
+}  // namespace simd_scan
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <format>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+using namespace std;
+
+namespace fs = filesystem;
+
+template<typename T>
+using Expected = llvm::Expected<T>;
+
+// Read-only view of a source file. Large files are memory-mapped by
+// llvm::MemoryBuffer, small ones are read once; either way the lexer,
+// parser and error reporter all borrow the same bytes instead of copying.
+class SourceFile
+{
+public:
+  static auto open(const fs::path& path) -> Expected<SourceFile>
+  {
+    // no null terminator needed, which lets page-multiple files be mapped too
+    auto buffer = llvm::MemoryBuffer::getFile(path.string(), /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buffer) {
+      return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        format("Could not open file: {} ({})", path.string(), buffer.getError().message())
+      );
+    }
+    return SourceFile(move(*buffer), path.filename().string());
+  }
+
+  // in-memory source, e.g. generated code or a benchmark corpus
+  static SourceFile from_string(string_view text, string filename)
+  {
+    return SourceFile(llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(text.data(), text.size()), filename), move(filename));
+  }
+
+  string_view text() const
+  {
+    return string_view(m_buffer->getBufferStart(), m_buffer->getBufferSize());
+  }
+
+  const string& filename() const
+  {
+    return m_filename;
+  }
+
+  size_t size() const
+  {
+    return m_buffer->getBufferSize();
+  }
+
+private:
+  SourceFile(unique_ptr<llvm::MemoryBuffer> buffer, string filename)
+    : m_buffer(move(buffer)), m_filename(move(filename))
+  {
+  }
+
+  unique_ptr<llvm::MemoryBuffer> m_buffer;
+  string m_filename;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <llvm/ADT/DenseMap.h>
+
+// Scoped symbol table keyed by interned symbol ID. Each binding records the
+// scope depth it was declared at, and leaving a scope restores whatever its
+// bindings shadowed, so a lookup is always a single hash probe no matter how
+// deeply scopes nest.
+template<typename Value>
+class ScopedSymbolTable
+{
+public:
+  void push_scope()
+  {
+    m_scopes.push_back(m_undo.size());
+  }
+
+  void pop_scope()
+  {
+    const size_t mark = m_scopes.back();
+    m_scopes.pop_back();
+
+    while (m_undo.size() > mark) {
+      const auto& entry = m_undo.back();
+      if (entry.had_previous) {
+        m_bindings[entry.symbol] = entry.previous;
+      } else {
+        m_bindings.erase(entry.symbol);
+      }
+      m_undo.pop_back();
+    }
+  }
+
+  // bind symbol in the innermost scope; false if it is already bound there
+  bool declare(std::uint32_t symbol, Value value)
+  {
+    const auto current = depth();
+    auto [it, inserted] = m_bindings.try_emplace(symbol, Binding{value, current});
+    if (inserted) {
+      m_undo.push_back(UndoEntry{.symbol = symbol, .previous = {}, .had_previous = false});
+      return true;
+    }
+
+    if (it->second.depth == current) {
+      return false;
+    }
+
+    // shadow a binding from an enclosing scope
+    m_undo.push_back(UndoEntry{.symbol = symbol, .previous = it->second, .had_previous = true});
+    it->second = Binding{value, current};
+    return true;
+  }
+
+  const Value* lookup(std::uint32_t symbol) const
+  {
+    auto it = m_bindings.find(symbol);
+    return it == m_bindings.end() ? nullptr : &it->second.value;
+  }
+
+  bool declared_in_current_scope(std::uint32_t symbol) const
+  {
+    auto it = m_bindings.find(symbol);
+    return it != m_bindings.end() && it->second.depth == depth();
+  }
+
+  // scope depth `symbol` is bound at, 0 when it is unbound
+  std::uint32_t depth_of(std::uint32_t symbol) const
+  {
+    auto it = m_bindings.find(symbol);
+    return it == m_bindings.end() ? 0 : it->second.depth;
+  }
+
+  // number of open scopes
+  std::uint32_t depth() const
+  {
+    return static_cast<std::uint32_t>(m_scopes.size());
+  }
+
+  void clear()
+  {
+    m_bindings.clear();
+    m_undo.clear();
+    m_scopes.clear();
+  }
+
+private:
+  struct Binding {
+    Value value{};
+    std::uint32_t depth = 0;
+  };
+
+  struct UndoEntry {
+    std::uint32_t symbol;
+    Binding previous;
+    bool had_previous;
+  };
+
+  llvm::DenseMap<std::uint32_t, Binding> m_bindings;
+  std::vector<UndoEntry> m_undo;
+  std::vector<size_t> m_scopes;  // undo log size when each scope was entered
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <format>
+#include <set>
+#include <string>
+#include <vector>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/LTO/Config.h>
+#include <llvm/LTO/LTO.h>
+#include <llvm/Support/Caching.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/TargetParser/Host.h>
+#include "emitter.hpp"
+
+using namespace std;
+
+// ThinLTO link of an `--emit=exe --thinlto` build of several files, or of
+// one file's -j partitions. Every input arrives as bitcode with a module
+// summary (write_bitcode_to). The thin link only reads the summaries to
+// decide which functions each module imports from the others; the
+// backends then import, optimize and emit the modules in parallel, one
+// object per input. Only main has to stay visible to the native link, so
+// every other function may be internalized and inlined across files.
+// Returns the temporary objects, which the caller links and removes.
+inline auto thin_link(const vector<llvm::MemoryBufferRef>& buffers, unsigned opt_level, unsigned jobs)
+    -> Expected<vector<string>>
+{
+  llvm::lto::Config config;
+  config.CPU = llvm::sys::getHostCPUName().str();
+  config.RelocModel = llvm::Reloc::PIC_;
+  config.OptLevel = opt_level;
+  config.CGOptLevel = codegen_opt_level(opt_level);
+
+  auto lto = llvm::lto::LTO(std::move(config), llvm::lto::createInProcessThinBackend(llvm::heavyweight_hardware_concurrency(jobs)));
+
+  // we are the linker: the first definition of a name prevails, a second is an error
+  set<string> defined;
+  for (const auto& buffer : buffers) {
+    auto input = llvm::lto::InputFile::create(buffer);
+    if (!input) {
+      return input.takeError();
+    }
+
+    vector<llvm::lto::SymbolResolution> resolutions;
+    for (const auto& symbol : (*input)->symbols()) {
+      llvm::lto::SymbolResolution resolution;
+      if (!symbol.isUndefined()) {
+        if (!defined.insert(symbol.getName().str()).second) {
+          return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                         format("'{}' is defined in more than one input", symbol.getName().str()));
+        }
+        resolution.Prevailing = true;
+        resolution.FinalDefinitionInLinkageUnit = true;
+        resolution.VisibleToRegularObj = symbol.getName() == "main";
+      }
+      resolutions.push_back(resolution);
+    }
+    if (auto err = lto.add(std::move(*input), resolutions)) {
+      return err;
+    }
+  }
+
+  // one stream per backend task, each a temporary object; tasks write distinct slots
+  vector<string> objects(lto.getMaxTasks());
+  const auto add_stream = [&](size_t task, const llvm::Twine&) -> Expected<unique_ptr<llvm::CachedFileStream>> {
+    int fd = -1;
+    llvm::SmallString<128> path;
+    if (auto ec = llvm::sys::fs::createTemporaryFile("husk", "o", fd, path)) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), format("Could not create temporary object: {}", ec.message()));
+    }
+    objects[task] = path.str().str();
+    return make_unique<llvm::CachedFileStream>(make_unique<llvm::raw_fd_ostream>(fd, /*shouldClose=*/true), objects[task]);
+  };
+
+  auto result = lto.run(add_stream);
+  erase(objects, string());
+  if (result) {
+    for (const auto& object : objects) {
+      llvm::sys::fs::remove(object);
+    }
+    return std::move(result);
+  }
+  return objects;
+}
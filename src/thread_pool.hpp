@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// tasks submitted together and waited for together
+class TaskGroup
+{
+  friend class ThreadPool;
+  atomic<size_t> m_pending = 0;
+};
+
+// Work-stealing thread pool shared by the driver (one task per input file)
+// and the backend (one task per partition or cached function). Every thread
+// owns a slot with its own deque: it pushes and pops at the back of its own
+// deque and steals from the front of the others. The thread that created
+// the pool owns the last slot, and wait() runs tasks instead of blocking, so
+// tasks may submit and wait for nested groups, and a pool without workers
+// simply runs everything on the caller.
+class ThreadPool
+{
+public:
+  explicit ThreadPool(unsigned workers)
+    : m_queues(workers + 1)
+  {
+    for (unsigned slot = 0; slot < workers; ++slot) {
+      m_workers.emplace_back([this, slot] { work(slot); });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool()
+  {
+    {
+      lock_guard lock(m_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_all();
+  }
+
+  // number of threads that can run tasks: the workers plus the caller
+  size_t slot_count() const
+  {
+    return m_queues.size();
+  }
+
+  // slot of the calling thread; threads outside the pool share the last one
+  size_t current_slot() const
+  {
+    return t_pool == this ? t_slot : m_queues.size() - 1;
+  }
+
+  void submit(TaskGroup& group, function<void()> fn)
+  {
+    ++group.m_pending;
+    {
+      auto& queue = m_queues[current_slot()];
+      lock_guard guard(queue.lock);
+      queue.tasks.push_back(Task{move(fn), &group});
+    }
+    {
+      lock_guard lock(m_mutex);
+      ++m_queued;
+    }
+    m_wake.notify_all();
+  }
+
+  // run queued tasks until every task of the group has finished
+  void wait(TaskGroup& group)
+  {
+    const size_t slot = current_slot();
+    while (group.m_pending > 0) {
+      if (run_one(slot)) {
+        continue;
+      }
+      unique_lock lock(m_mutex);
+      m_wake.wait(lock, [&] { return group.m_pending == 0 || m_queued > 0; });
+    }
+  }
+
+private:
+  struct Task {
+    function<void()> fn;
+    TaskGroup* group;
+  };
+
+  struct Queue {
+    mutex lock;
+    deque<Task> tasks;
+  };
+
+  void work(size_t slot)
+  {
+    t_pool = this;
+    t_slot = slot;
+    while (true) {
+      if (run_one(slot)) {
+        continue;
+      }
+      unique_lock lock(m_mutex);
+      m_wake.wait(lock, [&] { return m_stop || m_queued > 0; });
+      if (m_stop && m_queued == 0) {
+        return;
+      }
+    }
+  }
+
+  // helper to pop from the own deque or steal from another; false if all are empty
+  bool run_one(size_t slot)
+  {
+    optional<Task> task = pop(m_queues[slot], /*back=*/true);
+    for (size_t i = 1; !task && i < m_queues.size(); ++i) {
+      task = pop(m_queues[(slot + i) % m_queues.size()], /*back=*/false);
+    }
+    if (!task) {
+      return false;
+    }
+
+    --m_queued;
+    task->fn();
+    if (--task->group->m_pending == 0) {
+      // pass through the mutex so a waiter between its check and its sleep sees this
+      lock_guard lock(m_mutex);
+    }
+    m_wake.notify_all();
+    return true;
+  }
+
+  static optional<Task> pop(Queue& queue, bool back)
+  {
+    lock_guard guard(queue.lock);
+    if (queue.tasks.empty()) {
+      return {};
+    }
+    Task task = move(back ? queue.tasks.back() : queue.tasks.front());
+    back ? queue.tasks.pop_back() : queue.tasks.pop_front();
+    return task;
+  }
+
+  static inline thread_local const ThreadPool* t_pool = nullptr;
+  static inline thread_local size_t t_slot = 0;
+
+  vector<Queue> m_queues;
+  mutex m_mutex;  // guards sleeping; m_stop and increments of m_queued happen under it
+  condition_variable m_wake;
+  atomic<size_t> m_queued = 0;
+  bool m_stop = false;
+  vector<jthread> m_workers;  // last member: joined before the queues go away
+};
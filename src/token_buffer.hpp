@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "tokens.hpp"
+
+using namespace std;
+
+// Token stream as a structure of arrays: one byte of type per token, then
+// offsets, lengths and symbols in arrays of their own, 13 bytes per token
+// instead of the padded 16 of a Token. The parser's lookahead only reads
+// the dense type array; the other fields are fetched when a token is
+// consumed. Line and column stay derived from the offset by the
+// ErrorReporter's lazily built line table.
+class TokenBuffer
+{
+public:
+  void reserve(size_t count)
+  {
+    m_types.reserve(count);
+    m_offsets.reserve(count);
+    m_lengths.reserve(count);
+    m_symbols.reserve(count);
+  }
+
+  // grow or shrink to `count` tokens, e.g. before filling them in parallel with set()
+  void resize(size_t count)
+  {
+    m_types.resize(count);
+    m_offsets.resize(count);
+    m_lengths.resize(count);
+    m_symbols.resize(count);
+  }
+
+  void push_back(const Token& token)
+  {
+    m_types.push_back(token.type);
+    m_offsets.push_back(token.offset);
+    m_lengths.push_back(token.length);
+    m_symbols.push_back(token.symbol);
+  }
+
+  void set(size_t index, const Token& token)
+  {
+    m_types[index] = token.type;
+    m_offsets[index] = token.offset;
+    m_lengths[index] = token.length;
+    m_symbols[index] = token.symbol;
+  }
+
+  size_t size() const { return m_types.size(); }
+  bool empty() const { return m_types.empty(); }
+
+  TokenType type(size_t index) const { return m_types[index]; }
+  uint32_t offset(size_t index) const { return m_offsets[index]; }
+  uint32_t symbol(size_t index) const { return m_symbols[index]; }
+  span<const TokenType> types() const { return m_types; }
+
+  // the whole token, gathered from the arrays
+  Token operator[](size_t index) const
+  {
+    return Token{.type = m_types[index], .offset = m_offsets[index], .length = m_lengths[index], .symbol = m_symbols[index]};
+  }
+
+private:
+  vector<TokenType> m_types;
+  vector<uint32_t> m_offsets;
+  vector<uint32_t> m_lengths;  // int_lit: high value bits
+  vector<uint32_t> m_symbols;  // ident: symbol ID, int_lit: low value bits
+};
@@ -1,17 +1,17 @@
 #pragma once
 
+#include <array>
+#include <bit>
+#include <cstdint>
 #include <string>
 #include <string_view>
-#include <memory>
-#include <vector>
-#include <cctype>
 #include <optional>
 #include <llvm/Support/Error.h>
 
 template<typename T>
 using Expected = llvm::Expected<T>;
 
-enum class TokenType
+enum class TokenType : std::uint8_t
 {
   int_lit,
   semi,
@@ -28,257 +28,234 @@ enum class TokenType
   fslash,
   print,
   fn,
-  ret
+  ret,
+  mut,
+  spawn,
+  channel,
+  dot,
+  lt,
+  gt,
+  while_,
+  for_,
+  in,
+  eq_eq,
+  not_eq_,
+  lt_eq,
+  gt_eq,
+  dot_dot,
+  open_bracket,
+  close_bracket,
+  comma,
+  colon
 };
 
+inline constexpr std::uint32_t no_symbol = UINT32_MAX;
+
+// Compact token: the spelling stays in the source buffer and is only
+// referred to by offset and length. Identifiers carry their interned symbol
+// ID; integer literals are parsed once by the lexer and carry their 64-bit
+// value in the symbol and length fields, as nothing needs the length of a
+// literal's spelling. Line and column are recovered from the offset when a
+// diagnostic needs them.
 struct Token
 {
   TokenType type;
-  std::optional<std::string> value{};
-  size_t line = 1;
-  size_t column = 1;
+  std::uint32_t offset = 0;
+  std::uint32_t length = 0;          // int_lit: high value bits
+  std::uint32_t symbol = no_symbol;  // ident: symbol ID, int_lit: low value bits
+
+  // value of an int_lit
+  [[nodiscard]] constexpr std::int64_t value() const
+  {
+    return static_cast<std::int64_t>(static_cast<std::uint64_t>(length) << 32 | symbol);
+  }
+
+  // helper to build an int_lit token, e.g. for a folded constant
+  [[nodiscard]] static constexpr Token int_lit(std::int64_t value, std::uint32_t offset)
+  {
+    const auto bits = static_cast<std::uint64_t>(value);
+    return Token{.type = TokenType::int_lit, .offset = offset, .length = static_cast<std::uint32_t>(bits >> 32),
+                 .symbol = static_cast<std::uint32_t>(bits)};
+  }
 };
 
-struct TokenInfo {
-    std::string_view name;
-    std::string_view description;
-    bool has_value;
+static_assert(sizeof(Token) == 16);
+
+// Fixed spelling of a keyword or operator token
+struct TokenSpec {
+    std::string_view text;
+    TokenType type;
 };
 
-// Base token parser interface
-struct TokenParser {
-    virtual ~TokenParser() = default;
-    virtual Expected<Token> parse(
-        std::string_view source, 
-        size_t& index, 
-        size_t& line, 
-        size_t& column
-    ) const = 0;
-    virtual bool matches(std::string_view source, size_t index) const = 0;
-    virtual TokenInfo get_info() const = 0;
+// Token registry - declarative list of every fixed token spelling. The
+// lexer's dispatch tables below are generated from it at compile time.
+class TokenRegistry {
+public:
+    // Keywords (recognized after an identifier has been scanned)
+    static constexpr std::array keywords = {
+        TokenSpec{"return", TokenType::ret},
+        TokenSpec{"print", TokenType::print},
+        TokenSpec{"let", TokenType::let},
+        TokenSpec{"fn", TokenType::fn},
+        TokenSpec{"mut", TokenType::mut},
+        TokenSpec{"spawn", TokenType::spawn},
+        TokenSpec{"channel", TokenType::channel},
+        TokenSpec{"while", TokenType::while_},
+        TokenSpec{"for", TokenType::for_},
+        TokenSpec{"in", TokenType::in},
+    };
+
+    // Operators of one or two characters; at most one two-character
+    // operator per first character, which the lexer tries first
+    static constexpr std::array operators = {
+        TokenSpec{"(", TokenType::open_paren},
+        TokenSpec{")", TokenType::close_paren},
+        TokenSpec{"{", TokenType::open_curly},
+        TokenSpec{"}", TokenType::close_curly},
+        TokenSpec{"+", TokenType::plus},
+        TokenSpec{"-", TokenType::minus},
+        TokenSpec{"*", TokenType::star},
+        TokenSpec{"/", TokenType::fslash},
+        TokenSpec{"=", TokenType::eq},
+        TokenSpec{";", TokenType::semi},
+        TokenSpec{".", TokenType::dot},
+        TokenSpec{"<", TokenType::lt},
+        TokenSpec{">", TokenType::gt},
+        TokenSpec{"==", TokenType::eq_eq},
+        TokenSpec{"!=", TokenType::not_eq_},
+        TokenSpec{"<=", TokenType::lt_eq},
+        TokenSpec{">=", TokenType::gt_eq},
+        TokenSpec{"..", TokenType::dot_dot},
+        TokenSpec{"[", TokenType::open_bracket},
+        TokenSpec{"]", TokenType::close_bracket},
+        TokenSpec{",", TokenType::comma},
+        TokenSpec{":", TokenType::colon},
+    };
 };
 
-// Integer literal parser
-struct IntLitParser : TokenParser {
-    ~IntLitParser() override = default;
-    TokenInfo info = {"int_lit", "Integer literal", true};
-    
-    Expected<Token> parse(
-        std::string_view source, 
-        size_t& index, 
-        size_t& line, 
-        size_t& column
-    ) const override {
-        std::string value;
-        size_t start_col = column;
-        
-        // Consume all digits
-        while (index < source.length() && std::isdigit(source[index])) {
-            value.push_back(source[index]);
-            index++;
-            column++;
-        }
-        
-        return Token{
-            .type = TokenType::int_lit,
-            .value = value,
-            .line = line,
-            .column = start_col
-        };
-    }
-    
-    bool matches(std::string_view source, size_t index) const override {
-        return index < source.length() && std::isdigit(source[index]);
-    }
-    
-    TokenInfo get_info() const override { return info; }
+// What the first byte of a token tells the lexer
+enum class CharClass : std::uint8_t
+{
+    invalid,
+    whitespace,
+    newline,
+    digit,
+    alpha,
+    op
 };
 
-// Identifier parser
-struct IdentifierParser : TokenParser {
-    ~IdentifierParser() override = default;
-    TokenInfo info = {"ident", "Identifier", true};
-    
-    Expected<Token> parse(
-        std::string_view source, 
-        size_t& index, 
-        size_t& line, 
-        size_t& column
-    ) const override {
-        std::string value;
-        size_t start_col = column;
-        
-        // First character must be alpha
-        if (index < source.length() && std::isalpha(source[index])) {
-            value.push_back(source[index]);
-            index++;
-            column++;
-        }
-        
-        // Subsequent characters can be alphanumeric
-        while (index < source.length() && std::isalnum(source[index])) {
-            value.push_back(source[index]);
-            index++;
-            column++;
-        }
-        
-        return Token{
-            .type = TokenType::ident,
-            .value = value,
-            .line = line,
-            .column = start_col
-        };
-    }
-    
-    bool matches(std::string_view source, size_t index) const override {
-        return index < source.length() && std::isalpha(source[index]);
+// 256-entry first-byte dispatch table
+struct CharTable {
+    std::array<CharClass, 256> classes{};
+    std::array<TokenType, 256> op_types{};     // the one-character operator, if single_op
+    std::array<bool, 256> single_op{};
+    std::array<char, 256> pair_second{};       // second byte of the two-character operator, or 0
+    std::array<TokenType, 256> pair_types{};
+
+    constexpr CharClass operator[](char c) const {
+        return classes[static_cast<unsigned char>(c)];
     }
-    
-    TokenInfo get_info() const override { return info; }
 };
 
-// Keyword parser
-struct KeywordParser : TokenParser {
-    ~KeywordParser() override = default;
-    std::string keyword;
-    TokenType type;
-    TokenInfo info;
-    
-    KeywordParser(std::string kw, TokenType t) 
-        : keyword(std::move(kw)), type(t) {
-        info = {keyword, keyword + " keyword", false};
+constexpr CharTable make_char_table() {
+    CharTable table{};
+
+    // the same set isspace() accepts in the C locale
+    for (char c : std::string_view(" \t\v\f\r")) {
+        table.classes[static_cast<unsigned char>(c)] = CharClass::whitespace;
     }
-    
-    Expected<Token> parse(
-        std::string_view source, 
-        size_t& index, 
-        size_t& line, 
-        size_t& column
-    ) const override {
-        size_t start_col = column;
-        
-        // Consume the keyword
-        for (char c : keyword) {
-            if (index >= source.length() || source[index] != c) {
-                return llvm::createStringError(llvm::inconvertibleErrorCode(), "Keyword parsing failed");
-            }
-            index++;
-            column++;
-        }
-        
-        // Ensure we're not in the middle of an identifier
-        if (index < source.length() && std::isalnum(source[index])) {
-            return llvm::createStringError(llvm::inconvertibleErrorCode(), "Invalid keyword parsing");
-        }
-        
-        return Token{
-            .type = type,
-            .value = std::nullopt,
-            .line = line,
-            .column = start_col
-        };
+    table.classes['\n'] = CharClass::newline;
+
+    for (char c = '0'; c <= '9'; ++c) {
+        table.classes[static_cast<unsigned char>(c)] = CharClass::digit;
+    }
+    for (char c = 'a'; c <= 'z'; ++c) {
+        table.classes[static_cast<unsigned char>(c)] = CharClass::alpha;
+        table.classes[static_cast<unsigned char>(c - 'a' + 'A')] = CharClass::alpha;
     }
-    
-    bool matches(std::string_view source, size_t index) const override {
-        if (index + keyword.length() > source.length()) {
-            return false;
+
+    for (const auto& spec : TokenRegistry::operators) {
+        const auto index = static_cast<unsigned char>(spec.text.front());
+        table.classes[index] = CharClass::op;
+        if (spec.text.size() == 1) {
+            table.single_op[index] = true;
+            table.op_types[index] = spec.type;
+        } else {
+            table.pair_second[index] = spec.text[1];
+            table.pair_types[index] = spec.type;
         }
-        
-        // Check if the keyword matches
-        for (size_t i = 0; i < keyword.length(); ++i) {
-            if (source[index + i] != keyword[i]) {
+    }
+
+    return table;
+}
+
+inline constexpr CharTable char_table = make_char_table();
+
+// helper to check the one-pair-per-first-character rule the table relies on
+constexpr bool operator_pairs_are_unique() {
+    for (std::size_t i = 0; i < TokenRegistry::operators.size(); ++i) {
+        for (std::size_t j = i + 1; j < TokenRegistry::operators.size(); ++j) {
+            const auto a = TokenRegistry::operators[i].text;
+            const auto b = TokenRegistry::operators[j].text;
+            if (a.size() == 2 && b.size() == 2 && a.front() == b.front()) {
                 return false;
             }
         }
-        
-        // Ensure we're not in the middle of an identifier
-        if (index + keyword.length() < source.length() && 
-            std::isalnum(source[index + keyword.length()])) {
-            return false;
-        }
-        
-        return true;
     }
-    
-    TokenInfo get_info() const override { return info; }
-};
+    return true;
+}
+static_assert(operator_pairs_are_unique(), "two two-character operators share a first character");
 
-// Single character parser
-struct SingleCharParser : TokenParser {
-    ~SingleCharParser() override = default;
-    char character;
-    TokenType type;
-    TokenInfo info;
-    
-    SingleCharParser(char c, TokenType t) : character(c), type(t) {
-        std::string char_str = std::string(1, c);
-        info = {char_str, char_str + " operator", false};
+// helper for identifier continuation characters (isalnum in the C locale)
+constexpr bool is_ident_char(char c) {
+    const auto cls = char_table[c];
+    return cls == CharClass::alpha || cls == CharClass::digit;
+}
+
+// Perfect hash over the registry's keywords: the seed is searched at compile
+// time so that every keyword lands in its own slot, and a lookup costs one
+// hash plus one string compare.
+struct KeywordTable {
+    static constexpr std::size_t size = std::bit_ceil(TokenRegistry::keywords.size() * 4);
+    static constexpr std::int8_t empty = -1;
+
+    std::uint32_t seed = 0;
+    std::array<std::int8_t, size> slots{};
+
+    static constexpr std::size_t hash(std::string_view word, std::uint32_t seed) {
+        const auto first = static_cast<unsigned char>(word.front());
+        const auto last = static_cast<unsigned char>(word.back());
+        return ((first * seed) ^ (last + static_cast<std::uint32_t>(word.size()) * 31u)) & (size - 1);
     }
-    
-    Expected<Token> parse(
-        std::string_view source, 
-        size_t& index, 
-        size_t& line, 
-        size_t& column
-    ) const override {
-        size_t start_col = column;
-        
-        if (index >= source.length() || source[index] != character) {
-            return llvm::createStringError(llvm::inconvertibleErrorCode(), "Single character parsing failed");
+
+    constexpr std::optional<TokenType> find(std::string_view word) const {
+        const auto slot = slots[hash(word, seed)];
+        if (slot == empty || TokenRegistry::keywords[slot].text != word) {
+            return std::nullopt;
         }
-        
-        index++;
-        column++;
-        
-        return Token{
-            .type = type,
-            .value = std::nullopt,
-            .line = line,
-            .column = start_col
-        };
-    }
-    
-    bool matches(std::string_view source, size_t index) const override {
-        return index < source.length() && source[index] == character;
+        return TokenRegistry::keywords[slot].type;
     }
-    
-    TokenInfo get_info() const override { return info; }
 };
 
-// Token registry - centralized collection of all token parsers
-class TokenRegistry {
-public:
-    static const std::vector<std::unique_ptr<TokenParser>>& get_parsers() {
-        static std::vector<std::unique_ptr<TokenParser>> parsers = create_parsers();
-        return parsers;
-    }
-    
-private:
-    static std::vector<std::unique_ptr<TokenParser>> create_parsers() {
-        std::vector<std::unique_ptr<TokenParser>> parsers;
-        
-        // Keywords (must come before identifiers to match first)
-        parsers.push_back(std::make_unique<KeywordParser>("return", TokenType::ret));
-        parsers.push_back(std::make_unique<KeywordParser>("print", TokenType::print));
-        parsers.push_back(std::make_unique<KeywordParser>("let", TokenType::let));
-        parsers.push_back(std::make_unique<KeywordParser>("fn", TokenType::fn));
-        
-        // Single character operators
-        parsers.push_back(std::make_unique<SingleCharParser>('(', TokenType::open_paren));
-        parsers.push_back(std::make_unique<SingleCharParser>(')', TokenType::close_paren));
-        parsers.push_back(std::make_unique<SingleCharParser>('{', TokenType::open_curly));
-        parsers.push_back(std::make_unique<SingleCharParser>('}', TokenType::close_curly));
-        parsers.push_back(std::make_unique<SingleCharParser>('+', TokenType::plus));
-        parsers.push_back(std::make_unique<SingleCharParser>('-', TokenType::minus));
-        parsers.push_back(std::make_unique<SingleCharParser>('*', TokenType::star));
-        parsers.push_back(std::make_unique<SingleCharParser>('/', TokenType::fslash));
-        parsers.push_back(std::make_unique<SingleCharParser>('=', TokenType::eq));
-        parsers.push_back(std::make_unique<SingleCharParser>(';', TokenType::semi));
-        
-        // Complex parsers (must come last)
-        parsers.push_back(std::make_unique<IntLitParser>());
-        parsers.push_back(std::make_unique<IdentifierParser>());
-        
-        return parsers;
+constexpr KeywordTable make_keyword_table() {
+    for (std::uint32_t seed = 1; seed < 4096; ++seed) {
+        KeywordTable table{};
+        table.seed = seed;
+        table.slots.fill(KeywordTable::empty);
+
+        bool collision = false;
+        for (std::size_t i = 0; i < TokenRegistry::keywords.size() && !collision; ++i) {
+            auto& slot = table.slots[KeywordTable::hash(TokenRegistry::keywords[i].text, seed)];
+            collision = slot != KeywordTable::empty;
+            slot = static_cast<std::int8_t>(i);
+        }
+
+        if (!collision) {
+            return table;
+        }
     }
-};
+    return KeywordTable{};
+}
+
+inline constexpr KeywordTable keyword_table = make_keyword_table();
+static_assert(keyword_table.seed != 0, "no perfect hash seed found for TokenRegistry::keywords");
@@ -0,0 +1,488 @@
+#pragma once
+
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+#include "ast.hpp"
+#include "symbol_table.hpp"
+
+using namespace std;
+
+// Type checking, run on every program between parsing and folding: it
+// resolves the type of each expression into ASTExpr::type, so CodeGen
+// builds every value at the width the program gives it and never has to
+// extend or truncate one it guessed wrong. Integer literals are untyped
+// until their context gives them a width, as in Go:
+//   - in x + 1 or x < 1 the literal takes x's width, and in
+//     let y: i32 = 1; the declared one
+//   - where nothing does (let y = 1 + 2;, print(7)) they are int, i.e. i64
+//   - indices, slice bounds, lengths and channel capacities are int; an
+//     i32 one is accepted and sign-extended
+//   - a comparison gives 1 or 0 at whatever width its context wants
+// The operands of an operation must have the same width, and i32(x) or
+// i64(x) converts between them. Functions return int, except main (see
+// function_return_type). Names that do not resolve and operands of the
+// wrong kind, like an array added to an integer, are left to CodeGen,
+// which reports them; the checker reports mismatched widths and literals
+// that do not fit, every one of them, and returns them as one error.
+class TypeChecker
+{
+public:
+  TypeChecker(ASTArena& arena, const Interner& interner, const ErrorReporter& error_reporter)
+    : m_arena(arena), m_interner(interner), m_error_reporter(error_reporter)
+  {
+  }
+
+  // check every function of the program, filling in the type of each expression
+  static auto check(ASTProgram& program, const Interner& interner, const ErrorReporter& error_reporter) -> llvm::Error
+  {
+    auto checker = TypeChecker(program.arena, interner, error_reporter);
+    for (const auto& function : program.functions) {
+      checker.m_return_type = Type::integer(function_return_type(interner.name(function.name.symbol)));
+      checker.check_block(function.body);
+    }
+    if (error_reporter.error_count() > 0) {
+      return llvm::createStringError(llvm::inconvertibleErrorCode(), error_reporter.diagnostics());
+    }
+    return llvm::Error::success();
+  }
+
+private:
+  // helper to check a block's statements in a scope of their own
+  void check_block(const vector<StmtId>& body)
+  {
+    m_variables.push_scope();
+    for (const StmtId id : body) {
+      check_statement(m_arena.stmt(id));
+    }
+    m_variables.pop_scope();
+  }
+
+  void check_statement(const ASTStmt& stmt)
+  {
+    visit([this](auto&& arg) {
+      using T = decay_t<decltype(arg)>;
+
+      if constexpr (is_same_v<T, ASTLetStmt>) {
+        check_let(arg);
+      }
+      else if constexpr (is_same_v<T, ASTAssignStmt>) {
+        const auto* type = m_variables.lookup(arg.ident.symbol);
+        expect(arg.expr, type ? optional(*type) : nullopt, format("for '{}'", name(arg.ident)));
+      }
+      else if constexpr (is_same_v<T, ASTStoreStmt>) {
+        const auto* type = m_variables.lookup(arg.array.symbol);
+        synthesize(arg.index);
+        size_operand(arg.index);
+        expect(arg.expr, type ? element_type(*type) : nullopt, format("for an element of '{}'", name(arg.array)));
+      }
+      else if constexpr (is_same_v<T, ASTPrintStmt> || is_same_v<T, ASTExprStmt>) {
+        expect(arg.expr, nullopt, "");
+      }
+      else if constexpr (is_same_v<T, ASTReturnStmt>) {
+        expect(arg.expr, m_return_type, "return value");
+      }
+      else if constexpr (is_same_v<T, ASTSendStmt>) {
+        const auto* type = m_variables.lookup(arg.channel.symbol);
+        const bool is_channel = type && type->kind == TypeKind::channel;
+        expect(arg.expr, is_channel ? optional(Type::integer(type->element)) : nullopt,
+               format("to send on '{}'", name(arg.channel)));
+      }
+      else if constexpr (is_same_v<T, ASTSpawnStmt>) {
+        check_block(arg.body);
+      }
+      else if constexpr (is_same_v<T, ASTWhileStmt>) {
+        expect(arg.condition, nullopt, "");
+        check_block(arg.body);
+      }
+      else if constexpr (is_same_v<T, ASTForStmt>) {
+        synthesize(arg.start);
+        synthesize(arg.end);
+        Type type = unify(arg.start, arg.end, offset_of(arg.end));
+        if (type.kind == TypeKind::literal) {
+          resolve(arg.start, TypeKind::i64);
+          resolve(arg.end, TypeKind::i64);
+          type = Type::integer(TypeKind::i64);
+        }
+        m_variables.push_scope();
+        m_variables.declare(arg.ident.symbol, type);
+        check_block(arg.body);
+        m_variables.pop_scope();
+      }
+    }, stmt.var);
+  }
+
+  // let x = expr; takes the initializer's type, let x: T = expr; checks it against T
+  void check_let(const ASTLetStmt& stmt)
+  {
+    if (!stmt.annotation.has_value()) {
+      expect(stmt.expr, nullopt, "");
+      // the initializer does not see the new binding
+      m_variables.declare(stmt.ident.symbol, m_arena.expr(stmt.expr).type);
+      return;
+    }
+
+    const auto& annotation = *stmt.annotation;
+    expect(stmt.expr, annotation.type, format("for '{}'", name(stmt.ident)));
+    if (annotation.length.has_value()) {
+      const auto* array = get_if<ASTArrayExpr>(&m_arena.expr(stmt.expr).var);
+      const int64_t count = !array ? -1 : array->count ? array->count->value() : static_cast<int64_t>(array->elements.size());
+      if (count != *annotation.length) {
+        report(array ? format("Expected {} elements for '{}', got {}", *annotation.length, name(stmt.ident), count)
+                     : format("Expected an array literal of {} elements for '{}'", *annotation.length, name(stmt.ident)),
+               offset_of(stmt.expr));
+      }
+    }
+    m_variables.declare(stmt.ident.symbol, annotation.type);
+  }
+
+  // Helper to check an expression where its context needs `expected`, or
+  // anything when that is nullopt, which gives its literals the type int.
+  // `what` describes the context in the error.
+  void expect(ExprId id, optional<Type> expected, string_view what)
+  {
+    const Type type = synthesize(id);
+    if (!expected.has_value() || expected->kind == TypeKind::unresolved) {
+      default_literals(id);
+      return;
+    }
+    if (type.kind == TypeKind::literal && expected->is_integer()) {
+      resolve(id, expected->kind);
+      return;
+    }
+    if (type.kind == TypeKind::array && type.element == TypeKind::literal && expected->kind == TypeKind::array &&
+        expected->element != TypeKind::unresolved) {
+      resolve_elements(id, expected->element);
+      return;
+    }
+
+    default_literals(id);
+    const Type actual = m_arena.expr(id).type;
+    if (actual.kind != TypeKind::unresolved && actual != *expected) {
+      const bool convertible = actual.is_integer() && expected->is_integer();
+      report(format("Expected {} {}, got {}{}", type_name(*expected), what, type_name(actual),
+                    convertible ? format(" (convert it with {}(...))", type_name(*expected)) : ""),
+             offset_of(id));
+    }
+  }
+
+  // Give every node of an expression its type, operands first. The tree
+  // is walked with an explicit stack, like CodeGen::generateExpr, so deep
+  // trees cannot overflow the call stack. Literals stay TypeKind::literal
+  // until the caller resolves them.
+  Type synthesize(ExprId root)
+  {
+    m_pending.clear();
+    m_pending.push_back({root, false});
+    while (!m_pending.empty()) {
+      const auto [id, operands_done] = m_pending.back();
+      m_pending.pop_back();
+      if (!operands_done) {
+        m_pending.push_back({id, true});
+        push_operands(id);
+        continue;
+      }
+      m_arena.expr(id).type = type_node(id);
+    }
+    return m_arena.expr(root).type;
+  }
+
+  // helper to queue a node's operands, last first so the leftmost is typed first
+  void push_operands(ExprId id)
+  {
+    const auto& var = m_arena.expr(id).var;
+    const auto push = [this](ExprId operand) { m_pending.push_back({operand, false}); };
+    if (const auto* bin = get_if<ASTBinaryExpr>(&var)) {
+      push(bin->rhs);
+      push(bin->lhs);
+    }
+    else if (const auto* channel = get_if<ASTChannelExpr>(&var); channel && channel->capacity) {
+      push(*channel->capacity);
+    }
+    else if (const auto* array = get_if<ASTArrayExpr>(&var)) {
+      for (auto it = array->elements.rbegin(); it != array->elements.rend(); ++it) {
+        push(*it);
+      }
+    }
+    else if (const auto* len = get_if<ASTLenExpr>(&var)) {
+      push(len->array);
+    }
+    else if (const auto* index = get_if<ASTIndexExpr>(&var)) {
+      push(index->index);
+      push(index->array);
+    }
+    else if (const auto* slice = get_if<ASTSliceExpr>(&var)) {
+      if (slice->end) {
+        push(*slice->end);
+      }
+      if (slice->start) {
+        push(*slice->start);
+      }
+      push(slice->array);
+    }
+    else if (const auto* convert = get_if<ASTConvertExpr>(&var)) {
+      push(convert->operand);
+    }
+  }
+
+  // the type of a node whose operands are typed
+  Type type_node(ExprId id)
+  {
+    const auto& var = m_arena.expr(id).var;
+
+    if (const auto* primary = get_if<ASTPrimaryExpr>(&var)) {
+      if (primary->int_lit.has_value()) {
+        return Type{.kind = TypeKind::literal};
+      }
+      const auto* type = m_variables.lookup(primary->ident->symbol);
+      return type ? *type : Type{};
+    }
+
+    if (const auto* bin = get_if<ASTBinaryExpr>(&var)) {
+      const Type operands = unify(bin->lhs, bin->rhs, bin->op.offset);
+      if (!is_comparison(bin->kind)) {
+        return operands;
+      }
+      // the operands of a comparison are compared as int when nothing else
+      // fixes their width; the 1 or 0 takes its own from the context
+      if (operands.kind == TypeKind::literal) {
+        resolve(bin->lhs, TypeKind::i64);
+        resolve(bin->rhs, TypeKind::i64);
+      }
+      return Type{.kind = TypeKind::literal};
+    }
+
+    if (const auto* channel = get_if<ASTChannelExpr>(&var)) {
+      if (channel->capacity.has_value()) {
+        size_operand(*channel->capacity);
+      }
+      return Type::channel_of(TypeKind::i64);
+    }
+
+    if (const auto* receive = get_if<ASTReceiveExpr>(&var)) {
+      const auto* type = m_variables.lookup(receive->channel.symbol);
+      return type && type->kind == TypeKind::channel ? Type::integer(type->element) : Type{};
+    }
+
+    if (const auto* array = get_if<ASTArrayExpr>(&var)) {
+      return type_array_literal(*array);
+    }
+
+    if (const auto* len = get_if<ASTLenExpr>(&var)) {
+      default_literals(len->array);
+      return Type::integer(TypeKind::i64);
+    }
+
+    if (const auto* index = get_if<ASTIndexExpr>(&var)) {
+      default_literals(index->array);
+      size_operand(index->index);
+      return element_type(m_arena.expr(index->array).type).value_or(Type{});
+    }
+
+    if (const auto* slice = get_if<ASTSliceExpr>(&var)) {
+      default_literals(slice->array);
+      for (const auto bound : {slice->start, slice->end}) {
+        if (bound.has_value()) {
+          size_operand(*bound);
+        }
+      }
+      const Type array = m_arena.expr(slice->array).type;
+      return array.kind == TypeKind::array ? array : Type{};
+    }
+
+    const auto& convert = get<ASTConvertExpr>(var);
+    const Type operand = m_arena.expr(convert.operand).type;
+    if (operand.kind == TypeKind::literal) {
+      resolve(convert.operand, convert.target);
+    }
+    else if (operand.kind != TypeKind::unresolved && !operand.is_integer()) {
+      report(format("Cannot convert {} to {}", type_name(operand), type_name(Type::integer(convert.target))),
+             convert.type_name.offset);
+    }
+    return Type::integer(convert.target);
+  }
+
+  // the elements of an array literal share one width, which a literal
+  // element takes from the others; with only literals it stays open
+  Type type_array_literal(const ASTArrayExpr& array)
+  {
+    TypeKind element = TypeKind::literal;
+    for (const ExprId id : array.elements) {
+      const Type type = m_arena.expr(id).type;
+      if (type.kind == TypeKind::literal) {
+        continue;
+      }
+      if (!type.is_integer()) {
+        element = TypeKind::unresolved;
+      }
+      else if (element == TypeKind::literal) {
+        element = type.kind;
+      }
+      else if (element != TypeKind::unresolved && element != type.kind) {
+        report(format("Mismatched array elements {} and {}", type_name(Type::integer(element)), type_name(type)),
+               offset_of(id));
+      }
+    }
+    if (element != TypeKind::literal) {
+      for (const ExprId id : array.elements) {
+        resolve(id, element == TypeKind::unresolved ? TypeKind::i64 : element);
+      }
+    }
+    return Type::array_of(element);
+  }
+
+  // Helper to find the common type of two operands: a literal takes the
+  // other's width, two literals stay one, and two different widths are an
+  // error. Unresolved when either is not an integer.
+  Type unify(ExprId lhs, ExprId rhs, uint32_t offset)
+  {
+    const Type a = m_arena.expr(lhs).type;
+    const Type b = m_arena.expr(rhs).type;
+    if (a.kind == TypeKind::literal && b.kind == TypeKind::literal) {
+      return a;
+    }
+    if (a.kind == TypeKind::literal && b.is_integer()) {
+      resolve(lhs, b.kind);
+      return b;
+    }
+    if (b.kind == TypeKind::literal && a.is_integer()) {
+      resolve(rhs, a.kind);
+      return a;
+    }
+
+    default_literals(lhs);
+    default_literals(rhs);
+    if (a.is_integer() && b.is_integer()) {
+      if (a != b) {
+        report(format("Mismatched types {} and {} (convert one with i32(...) or i64(...))", type_name(a), type_name(b)),
+               offset);
+      }
+      return a;
+    }
+    return Type{};
+  }
+
+  // Helper to give a literal expression its width: the literals and the
+  // arithmetic on them take it, a comparison only for its 1 or 0, whose
+  // operands are already resolved. A literal must fit.
+  void resolve(ExprId root, TypeKind width)
+  {
+    m_resolving.push_back(root);
+    while (!m_resolving.empty()) {
+      const ExprId id = m_resolving.back();
+      m_resolving.pop_back();
+      auto& expr = m_arena.expr(id);
+      if (expr.type.kind != TypeKind::literal) {
+        continue;
+      }
+      expr.type = Type::integer(width);
+
+      if (const auto* primary = get_if<ASTPrimaryExpr>(&expr.var)) {
+        const Token literal = *primary->int_lit;
+        if (width == TypeKind::i32 && literal.value() > INT32_MAX) {
+          report(format("Integer literal {} does not fit in i32", literal.value()), literal.offset);
+        }
+      }
+      else if (const auto* bin = get_if<ASTBinaryExpr>(&expr.var); bin && !is_comparison(bin->kind)) {
+        m_resolving.push_back(bin->rhs);
+        m_resolving.push_back(bin->lhs);
+      }
+    }
+  }
+
+  // helper to give an array literal whose elements are all literals its element width
+  void resolve_elements(ExprId id, TypeKind width)
+  {
+    auto& expr = m_arena.expr(id);
+    expr.type.element = width;
+    for (const ExprId element : get<ASTArrayExpr>(expr.var).elements) {
+      resolve(element, width);
+    }
+  }
+
+  // helper to give whatever is still open in an expression the type int
+  void default_literals(ExprId id)
+  {
+    const Type type = m_arena.expr(id).type;
+    if (type.kind == TypeKind::literal) {
+      resolve(id, TypeKind::i64);
+    }
+    else if (type.kind == TypeKind::array && type.element == TypeKind::literal) {
+      resolve_elements(id, TypeKind::i64);
+    }
+  }
+
+  // an index, bound or capacity: int unless it is an i32 already
+  void size_operand(ExprId id)
+  {
+    if (m_arena.expr(id).type.kind == TypeKind::literal) {
+      resolve(id, TypeKind::i64);
+    }
+  }
+
+  // helper to get the type of an array's elements, nullopt for anything else
+  static optional<Type> element_type(Type array)
+  {
+    if (array.kind != TypeKind::array || !Type::integer(array.element).is_integer()) {
+      return nullopt;
+    }
+    return Type::integer(array.element);
+  }
+
+  // helper to find the source offset an error about an expression points at
+  uint32_t offset_of(ExprId id) const
+  {
+    while (true) {
+      const auto& var = m_arena.expr(id).var;
+      if (const auto* primary = get_if<ASTPrimaryExpr>(&var)) {
+        return primary->int_lit.has_value() ? primary->int_lit->offset : primary->ident->offset;
+      }
+      if (const auto* bin = get_if<ASTBinaryExpr>(&var)) {
+        return bin->op.offset;
+      }
+      if (const auto* channel = get_if<ASTChannelExpr>(&var)) {
+        return channel->keyword.offset;
+      }
+      if (const auto* receive = get_if<ASTReceiveExpr>(&var)) {
+        return receive->channel.offset;
+      }
+      if (const auto* array = get_if<ASTArrayExpr>(&var)) {
+        return array->bracket.offset;
+      }
+      if (const auto* index = get_if<ASTIndexExpr>(&var)) {
+        return index->bracket.offset;
+      }
+      if (const auto* slice = get_if<ASTSliceExpr>(&var)) {
+        return slice->bracket.offset;
+      }
+      if (const auto* convert = get_if<ASTConvertExpr>(&var)) {
+        return convert->type_name.offset;
+      }
+      id = get<ASTLenExpr>(var).array;
+    }
+  }
+
+  string_view name(const Token& ident) const
+  {
+    return m_interner.name(ident.symbol);
+  }
+
+  // helper to collect an error; like the parser, the checker stops reporting after MAX_ERRORS
+  void report(string_view message, uint32_t offset) const
+  {
+    if (m_error_reporter.error_count() < MAX_ERRORS) {
+      m_error_reporter.report(message, offset);
+    }
+  }
+
+  ASTArena& m_arena;
+  const Interner& m_interner;
+  const ErrorReporter& m_error_reporter;
+  ScopedSymbolTable<Type> m_variables;  // type of each name in scope
+  Type m_return_type;                   // of the function being checked
+  vector<pair<ExprId, bool>> m_pending;  // synthesize work stack: node, operands typed
+  vector<ExprId> m_resolving;            // resolve work stack
+};
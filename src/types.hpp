@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// What a value is, as the TypeChecker resolves it for every expression.
+// Integers are i32 or i64, and `int` is another name for i64; arrays,
+// slices and channels record the width of their elements.
+enum class TypeKind : uint8_t
+{
+  unresolved,  // not checked, or not an integer where one was needed
+  literal,     // an integer literal, or arithmetic on them, still waiting for the width its context gives it
+  i32,
+  i64,
+  array,       // an array or a slice
+  channel
+};
+
+struct Type {
+  TypeKind kind = TypeKind::unresolved;
+  TypeKind element = TypeKind::unresolved;  // of an array or a channel
+
+  static constexpr Type integer(TypeKind width) { return Type{.kind = width}; }
+  static constexpr Type array_of(TypeKind width) { return Type{.kind = TypeKind::array, .element = width}; }
+  static constexpr Type channel_of(TypeKind width) { return Type{.kind = TypeKind::channel, .element = width}; }
+
+  constexpr bool is_integer() const { return kind == TypeKind::i32 || kind == TypeKind::i64; }
+  constexpr unsigned bits() const { return kind == TypeKind::i32 ? 32 : 64; }
+
+  constexpr bool operator==(const Type&) const = default;
+};
+
+// helper to map the name of an integer type onto its width
+inline optional<TypeKind> integer_type_named(string_view name)
+{
+  if (name == "i32") {
+    return TypeKind::i32;
+  }
+  if (name == "i64" || name == "int") {
+    return TypeKind::i64;
+  }
+  return nullopt;
+}
+
+// What a function returns: int, except main, whose result is the
+// process's exit status and so an i32. Only spawn calls functions, and it
+// drops the result; the rule only has to agree between the modules of a
+// program, which it does by depending on the name alone.
+inline TypeKind function_return_type(string_view name)
+{
+  return name == "main" ? TypeKind::i32 : TypeKind::i64;
+}
+
+// helper to name a type in diagnostics, e.g. i32 or []i64
+inline string type_name(Type type)
+{
+  const auto width = [](TypeKind kind) -> string {
+    switch (kind) {
+      case TypeKind::i32: return "i32";
+      case TypeKind::i64: return "i64";
+      default: return "int";
+    }
+  };
+  switch (type.kind) {
+    case TypeKind::array: return "[]" + width(type.element);
+    case TypeKind::channel: return "channel<" + width(type.element) + ">";
+    case TypeKind::i32:
+    case TypeKind::i64:
+    case TypeKind::literal:
+      return width(type.kind);
+    default: return "an unknown type";
+  }
+}
@@ -0,0 +1,47 @@
+# Run one Husk program and compare what it did with what it should do:
+#   cmake -DHUSK=<husk> -DINPUT=<dir>/<name>.hsk [-DSTATUS=<exit status>] [-DARGS=<husk run options>] -P run_hsk.cmake
+# stdout must equal <name>.out when it exists, stderr (colors removed) must
+# contain every line of <name>.err when it exists, and the exit status must
+# be STATUS (default 0).
+
+if(NOT DEFINED STATUS)
+  set(STATUS 0)
+endif()
+
+get_filename_component(directory "${INPUT}" DIRECTORY)
+get_filename_component(name "${INPUT}" NAME_WE)
+execute_process(
+  COMMAND "${HUSK}" run ${ARGS} "${name}.hsk"
+  WORKING_DIRECTORY "${directory}"
+  OUTPUT_VARIABLE stdout
+  ERROR_VARIABLE stderr
+  RESULT_VARIABLE status
+)
+string(ASCII 27 escape)
+string(REGEX REPLACE "${escape}\\[[0-9;]*m" "" stderr "${stderr}")
+
+set(failures "")
+if(NOT "${status}" STREQUAL "${STATUS}")
+  string(APPEND failures "exit status ${status}, expected ${STATUS}\n")
+endif()
+
+if(EXISTS "${directory}/${name}.out")
+  file(READ "${directory}/${name}.out" expected)
+  if(NOT "${stdout}" STREQUAL "${expected}")
+    string(APPEND failures "stdout differs from ${name}.out:\n${stdout}\n")
+  endif()
+endif()
+
+if(EXISTS "${directory}/${name}.err")
+  file(STRINGS "${directory}/${name}.err" expected_lines)
+  foreach(line IN LISTS expected_lines)
+    string(FIND "${stderr}" "${line}" found)
+    if(found EQUAL -1)
+      string(APPEND failures "stderr does not contain '${line}'\n")
+    endif()
+  endforeach()
+endif()
+
+if(failures)
+  message(FATAL_ERROR "${name}.hsk:\n${failures}stderr:\n${stderr}")
+endif()